@@ -0,0 +1,58 @@
+#include "AstArena.h"
+
+#include <type_traits>
+
+static_assert( std::is_trivially_destructible< AstItem >::value,
+			   "arena never runs destructors of syntax tree nodes" );
+
+AstArena::AstArena() :
+	_count( 0 ),
+	_adoptedCount( 0 )
+{
+}
+
+AstArena::~AstArena()
+{
+	for( AstItem* chunk : _chunks )
+		::operator delete( chunk );
+	for( AstItem* chunk : _adopted )
+		::operator delete( chunk );
+}
+
+void AstArena::Rewind( int watermark )
+{
+	Q_ASSERT( watermark >= 0 && watermark <= _count );
+	_count = watermark;
+}
+
+/*
+** takes over all chunks of other, which is left empty; nodes created
+** here later go to own chunks only
+*/
+void AstArena::Adopt( AstArena& other )
+{
+	_adopted += other._chunks;
+	_adopted += other._adopted;
+	_adoptedCount += other.Count();
+
+	other._chunks.clear();
+	other._adopted.clear();
+	other._count = other._adoptedCount = 0;
+}
+
+/*
+** forgets all nodes but keeps the chunks for the next parse, adopted ones
+** too, all chunks are of the same size
+*/
+void AstArena::Clear()
+{
+	_count = 0;
+	_chunks += _adopted;
+	_adopted.clear();
+	_adoptedCount = 0;
+}
+
+int AstArena::MemoryUsage() const
+{
+	return ( _chunks.size() + _adopted.size() ) * ChunkSize * sizeof( AstItem );
+}
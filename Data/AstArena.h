@@ -0,0 +1,82 @@
+#ifndef AST_ARENA_H
+#define AST_ARENA_H
+
+#include <QVector>
+
+#include <new>
+
+#include "AstItem.h"
+
+/*
+** Bump allocator for syntax tree nodes of one parse. Nodes live in chunks
+** of ChunkSize items, creating a node is an index increment and a
+** placement new, releasing the whole tree frees only the chunks.
+**
+** AstItem is trivially destructible, so rolling back to a watermark just
+** forgets the nodes created after it; the caller must make sure none of
+** them is linked into a node created before the watermark.
+**
+** Chunks of another arena can be adopted, nodes built by parsers on other
+** threads then live as long as the tree they were linked into.
+*/
+class AstArena
+{
+public:
+	AstArena();
+	~AstArena();
+
+	AstItem*	Create( AstInfo::Type type );
+	AstItem*	Create( AstInfo::Type type, AstItem* parent );
+
+	int			Watermark() const;
+	void		Rewind( int watermark );
+	void		Adopt( AstArena& other );
+	void		Clear();
+
+	int			Count() const;
+	int			MemoryUsage() const;
+
+private:
+	Q_DISABLE_COPY( AstArena )
+
+	enum {
+		ChunkShift	= 12,
+		ChunkSize	= 1 << ChunkShift
+	};
+
+	QVector< AstItem* >	_chunks;
+	int					_count;
+
+	QVector< AstItem* >	_adopted;
+	int					_adoptedCount;
+};
+
+inline AstItem* AstArena::Create( AstInfo::Type type )
+{
+	const int chunk = _count >> ChunkShift;
+	if( chunk == _chunks.size() )
+		_chunks.append( static_cast< AstItem* >( ::operator new( ChunkSize * sizeof( AstItem ) ) ) );
+
+	AstItem* item = _chunks[ chunk ] + ( _count & ( ChunkSize - 1 ) );
+	++_count;
+	return new( item ) AstItem( type );
+}
+
+inline AstItem* AstArena::Create( AstInfo::Type type, AstItem* parent )
+{
+	AstItem* item = Create( type );
+	parent->AppendChild( item );
+	return item;
+}
+
+inline int AstArena::Watermark() const
+{
+	return _count;
+}
+
+inline int AstArena::Count() const
+{
+	return _count + _adoptedCount;
+}
+
+#endif // AST_ARENA_H
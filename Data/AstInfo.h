@@ -38,10 +38,24 @@ struct AstInfo {
 		FunctionBody
 	};
 
+	// syntax the tree keeps no token of: ':' of 'function a.b:c()' and
+	// '[' of '[key] = value' field
+	enum Flag {
+		NoFlags			= 0,
+		MethodFlag		= 1,
+		BracketKeyFlag	= 2
+	};
+
     Type    AstType;
     int     Pos;
     int     Size;
     int     Line;
+
+    // StringInterner symbol of a Name, -1 for other nodes
+    int     Symbol;
+
+    // Flag bits
+    int     Flags;
 };
 
 QString AstTypeText( AstInfo::Type type );
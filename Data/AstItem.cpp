@@ -1,21 +1,23 @@
 #include "AstItem.h"
 
-#include <QtAlgorithms>
+#include <QVector>
 
-AstItem::AstItem( AstItem* parent ) :
-    _pos( -1 ),
-    _size( -1 ),
+#include <algorithm>
 
-    _parent( parent )
-{
-    if( _parent ) {
-        _parent->_children.append( this );
-    }
-}
+AstItem::AstItem( AstInfo::Type type ) :
+	_childrenCount( 0 ),
 
-AstItem::~AstItem()
+	_parent( nullptr ),
+	_firstChild( nullptr ),
+	_lastChild( nullptr ),
+	_next( nullptr )
 {
-    qDeleteAll( _children );
+	Info.AstType = type;
+	Info.Pos = -1;
+	Info.Size = -1;
+	Info.Line = -1;
+	Info.Symbol = -1;
+	Info.Flags = AstInfo::NoFlags;
 }
 
 bool AstItem::HasParent() const
@@ -25,18 +27,175 @@ bool AstItem::HasParent() const
 
 bool AstItem::HasSiblings() const
 {
-   return _parent->_children.size() > 1;
+   return _parent && _parent->_childrenCount > 1;
 }
 
 bool AstItem::HasChildren() const
 {
-    return _children.size() > 0;
+    return _childrenCount > 0;
 }
 
+/*
+** counted along the children list of parent
+*/
 int AstItem::SiblingPos() const
 {
-    if( !_parent )
-        return 0;
+	if( !_parent )
+		return 0;
+
+	int row = 0;
+	for( const AstItem* child = _parent->_firstChild; child != this; child = child->_next )
+		++row;
+	return row;
+}
+
+int AstItem::ChildrenCount() const
+{
+	return _childrenCount;
+}
+
+AstItem* AstItem::Parent() const
+{
+	return _parent;
+}
+
+AstItem* AstItem::FirstChild() const
+{
+	return _firstChild;
+}
+
+AstItem* AstItem::LastChild() const
+{
+	return _lastChild;
+}
+
+AstItem* AstItem::Next() const
+{
+	return _next;
+}
+
+const AstItem* AstItem::Child( int row ) const
+{
+	if( row < 0 || row >= _childrenCount )
+		return nullptr;
+
+	const AstItem* child = _firstChild;
+	while( row-- > 0 )
+		child = child->_next;
+	return child;
+}
+
+void AstItem::AppendChild( AstItem* child )
+{
+	child->_parent = this;
+	child->_next = nullptr;
+	++_childrenCount;
+
+	if( _lastChild )
+		_lastChild->_next = child;
+	else
+		_firstChild = child;
+	_lastChild = child;
+}
+
+/*
+** Children between before and after, both kept, are replaced by children
+** of holder, null before is the list start and null after its end
+*/
+void AstItem::ReplaceChildren( AstItem* before, AstItem* after, AstItem* holder )
+{
+	AstItem* removed = before ? before->_next : _firstChild;
+	for( ; removed != after; removed = removed->_next )
+		--_childrenCount;
+
+	for( AstItem* child = holder->_firstChild; child; child = child->_next )
+		child->_parent = this;
+
+	AstItem* first = holder->HasChildren() ? holder->_firstChild : after;
+	AstItem* last = holder->HasChildren() ? holder->_lastChild : before;
+	if( holder->HasChildren() )
+		holder->_lastChild->_next = after;
+
+	if( before )
+		before->_next = first;
+	else
+		_firstChild = first;
+	if( !after )
+		_lastChild = last;
+
+	_childrenCount += holder->_childrenCount;
+	holder->_firstChild = holder->_lastChild = nullptr;
+	holder->_childrenCount = 0;
+}
+
+/*
+** forgets the only child, it can be appended to another node then
+*/
+AstItem* AstItem::TakeOnlyChild()
+{
+	Q_ASSERT( _childrenCount == 1 );
+
+	AstItem* child = _firstChild;
+	child->_parent = nullptr;
+	_firstChild = _lastChild = nullptr;
+	_childrenCount = 0;
+	return child;
+}
+
+/*
+** forgets all children, their nodes stay where the arena keeps them
+*/
+void AstItem::RemoveChildren()
+{
+	_firstChild = _lastChild = nullptr;
+	_childrenCount = 0;
+}
+
+bool AstItem::HasSpan() const
+{
+	return Info.Size >= 0;
+}
+
+bool AstItem::Is( AstInfo::Type type ) const
+{
+	return Info.AstType == type;
+}
+
+void AstItem::SetType( AstInfo::Type type )
+{
+	Info.AstType = type;
+}
+
+QString AstItem::TypeText() const
+{
+	return AstTypeText( Info.AstType );
+}
+
+QString AstItem::DebugString() const
+{
+	struct Pending {
+		const AstItem*	Item;
+		int				Depth;
+	};
 
+	// right associative operator chains are as deep as they are long,
+	// so walk with explicit stack
+	QString result;
+	QVector< Pending > stack;
+	const Pending root = { this, 0 };
+	stack.append( root );
+	while( !stack.isEmpty() ) {
+		const Pending pending = stack.takeLast();
+		result.append( QString( pending.Depth * 2, QLatin1Char( ' ' ) ) )
+				.append( pending.Item->TypeText() ).append( "\n" );
 
+		// children go in reversed, so the first one is on top
+		const int first = stack.size();
+		for( const AstItem* child = pending.Item->_firstChild; child; child = child->_next ) {
+			const Pending next = { child, pending.Depth + 1 };
+			stack.append( next );
+		}
+		std::reverse( stack.begin() + first, stack.end() );
+	}
+	return result;
 }
@@ -1,26 +1,65 @@
 #ifndef ASTITEM_H
 #define ASTITEM_H
 
-#include <QLinkedList>
+#include <QString>
 
+#include "AstInfo.h"
+
+/*
+** Fixed size syntax tree node. Nodes are allocated by AstArena and never
+** deleted one by one, children are kept as an intrusive singly linked
+** list with a pointer to the last child for appending.
+**
+** Nodes keep the tokens they cover in Info: Pos is the first token
+** relative to the anchor of the previous sibling, or of the parent for a
+** first child, Size is the token count. The anchor of a node with span is
+** its first token, nodes of a failed statement may be left with Size -1
+** and pass the anchor they got on. So an edit moves the nodes
+** behind it by changing the next node with span only, AstTree turns
+** spans into source positions.
+*/
 class AstItem
 {
 public:
-    AstItem( AstItem* parent );
-    ~AstItem();
+	explicit AstItem( AstInfo::Type type );
+
+	bool HasParent() const;
+	bool HasSiblings() const;
+	bool HasChildren() const;
+
+	int SiblingPos() const;
+	int ChildrenCount() const;
+
+	AstItem* Parent() const;
+	AstItem* FirstChild() const;
+	AstItem* LastChild() const;
+	AstItem* Next() const;
+	const AstItem* Child( int row ) const;
 
-    bool HasParent() const;
-    bool HasSiblings() const;
-    bool HasChildren() const;
+	void AppendChild( AstItem* child );
+	void ReplaceChildren( AstItem* before, AstItem* after, AstItem* holder );
+	AstItem* TakeOnlyChild();
+	void RemoveChildren();
 
-    int SiblingPos() const;
+	bool HasSpan() const;
+
+	bool Is( AstInfo::Type type ) const;
+	void SetType( AstInfo::Type type );
+
+	QString TypeText() const;
+	QString DebugString() const;
+
+public:
+	AstInfo Info;
 
 private:
-    int _pos;
-    int _size;
+	// next to Info, fills the padding in front of the pointers
+	int			_childrenCount;
 
-    AstItem*   _parent;
-    QLinkedList< AstItem* > _children;
+	AstItem*	_parent;
+	AstItem*	_firstChild;
+	AstItem*	_lastChild;
+	AstItem*	_next;
 };
 
 #endif // ASTITEM_H
@@ -0,0 +1,530 @@
+#include "AstTree.h"
+
+#include <QVarLengthArray>
+
+#include <algorithm>
+#include <climits>
+
+#include "AstItem.h"
+
+#include "Lexer/TokenBuffer.h"
+
+namespace {
+
+/*
+** relative token span of item to source position, anchor of the node the
+** span is relative to becomes the anchor of item
+*/
+AstInfo SourceInfo( const AstItem* item, const TokenBuffer& tokens, int& anchor )
+{
+	AstInfo info = item->Info;
+	if( !item->HasSpan() ) {
+		info.Pos = info.Size = info.Line = -1;
+		return info;
+	}
+
+	anchor += item->Info.Pos;
+	info.Pos = tokens.Offset( anchor );
+	info.Size = item->Info.Size > 0 ? tokens.End( anchor + item->Info.Size - 1 ) - info.Pos : 0;
+	info.Line = tokens.Line( anchor );
+	return info;
+}
+
+/*
+** new index of an old node, NoNode stays
+*/
+inline int Remapped( const QVector< int >& remap, int index )
+{
+	return index != AstTree::NoNode ? remap[ index ] : index;
+}
+
+} // namespace
+
+AstTree::AstTree()
+{
+	Clear();
+}
+
+AstTree::AstTree( const AstItem* root, const TokenBuffer& tokens )
+{
+	Build( root, tokens );
+}
+
+void AstTree::Build( const AstItem* root, const TokenBuffer& tokens )
+{
+	_nodes.clear();
+
+	int anchor = 0;
+	AstNode rootNode;
+	rootNode.Info = SourceInfo( root, tokens, anchor );
+	rootNode.Parent = NoNode;
+	rootNode.NextSibling = NoNode;
+	rootNode.Row = 0;
+	_nodes.append( rootNode );
+
+	QVector< Source > queue;
+	const Source source = { root, anchor, RootNode };
+	queue.append( source );
+	AppendDescendants( queue, tokens );
+
+	_nodes.squeeze();
+
+	// children follow their parents, so in reverse their hashes are ready
+	for( int index = _nodes.size() - 1; index >= 0; --index )
+		Rehash( index );
+
+	BuildIndex();
+}
+
+/*
+** Takes statements Reparse replaced in one block of the parsed tree. Nodes
+** of the old statements are dropped and the rest are moved up in one pass,
+** positions behind the change are shifted on the way; the new statements
+** take the gap in the children of the block and their descendants are
+** appended. Spans and hashes of the nodes from the block up to the root
+** are taken again, and the source index is rebuilt only for the changed
+** range of text.
+*/
+void AstTree::Patch( const AstItem* root, const TokenBuffer& tokens, const AstSplice& splice )
+{
+	// nodes from the root down to the block, their items and new spans
+	QVarLengthArray< int, 32 > path;
+	QVarLengthArray< const AstItem*, 32 > items;
+	QVarLengthArray< AstInfo, 32 > infos;
+
+	int anchor = 0;
+	path.append( RootNode );
+	items.append( root );
+	infos.append( SourceInfo( root, tokens, anchor ) );
+	for( int i = 0; i < splice.Path.size(); ++i ) {
+		const AstItem* item = items.last()->FirstChild();
+		for( int row = 0; row < splice.Path[ i ]; ++row, item = item->Next() ) {
+			if( item->HasSpan() )
+				anchor += item->Info.Pos;
+		}
+		path.append( Child( path.last(), splice.Path[ i ] ) );
+		items.append( item );
+		infos.append( SourceInfo( item, tokens, anchor ) );
+	}
+
+	// new statements, each relative to the one before
+	QVector< Source > queue;
+	QVector< AstInfo > inserted;
+	const AstItem* statement = items.last()->FirstChild();
+	for( int row = 0; row < splice.FirstRow; ++row, statement = statement->Next() ) {
+		if( statement->HasSpan() )
+			anchor += statement->Info.Pos;
+	}
+	for( int row = 0; row < splice.InsertedRows; ++row, statement = statement->Next() ) {
+		inserted.append( SourceInfo( statement, tokens, anchor ) );
+		const Source source = { statement, anchor, NoNode };
+		queue.append( source );
+	}
+
+	// changed text runs from first up to oldEnd in old positions, nodes
+	// from oldEnd on move by delta; old nodes are only read, the tree may
+	// share them with the one it was copied from
+	const AstNode* old = _nodes.constData();
+	const int block = path.last();
+	const int oldFirst = old[ block ].FirstChild;
+	const int oldCount = old[ block ].ChildrenCount;
+	const int delta = splice.AddedChars - splice.RemovedChars;
+	int first = splice.Position;
+	int oldEnd = splice.Position + splice.RemovedChars;
+	if( splice.RemovedRows > 0 ) {
+		const AstInfo& head = old[ oldFirst + splice.FirstRow ].Info;
+		const AstInfo& tail = old[ oldFirst + splice.FirstRow + splice.RemovedRows - 1 ].Info;
+		if( head.Size >= 0 )
+			first = qMin( first, head.Pos );
+		if( tail.Size >= 0 )
+			oldEnd = qMax( oldEnd, tail.Pos + tail.Size );
+	}
+	if( splice.InsertedRows > 0 ) {
+		if( inserted.first().Size >= 0 )
+			first = qMin( first, inserted.first().Pos );
+		if( inserted.last().Size >= 0 )
+			oldEnd = qMax( oldEnd, inserted.last().Pos + inserted.last().Size - delta );
+	}
+
+	// relexing may move ends of the nodes around the statements too, as
+	// when a comment takes the rest of a line; the index goes over both
+	int pathEnd = oldEnd;
+	for( int i = 0; i < path.size(); ++i ) {
+		const AstInfo& info = old[ path[ i ] ].Info;
+		if( info.Size < 0 )
+			continue;
+		const int end = info.Pos + info.Size;
+		const int newEnd = infos[ i ].Pos + infos[ i ].Size - delta;
+		if( info.Pos != infos[ i ].Pos )
+			first = qMin( first, qMin( info.Pos, infos[ i ].Pos ) );
+		if( end != newEnd && ( end > oldEnd || newEnd > oldEnd ) )
+			pathEnd = qMax( pathEnd, qMax( end, newEnd ) );
+	}
+
+	// old statements and everything below them are dropped
+	QVector< int > remap( _nodes.size(), 0 );
+	QVector< int > removed;
+	for( int row = 0; row < splice.RemovedRows; ++row )
+		removed.append( oldFirst + splice.FirstRow + row );
+	while( !removed.isEmpty() ) {
+		const AstNode& node = old[ removed.last() ];
+		remap[ removed.takeLast() ] = NoNode;
+		for( int row = 0; row < node.ChildrenCount; ++row )
+			removed.append( node.FirstChild + row );
+	}
+
+	// kept nodes move up, new statements take the place of the old ones
+	const int gap = oldCount > 0 ? oldFirst + splice.FirstRow : _nodes.size();
+	int gapIndex = NoNode;
+	int count = 0;
+	for( int index = 0; index <= _nodes.size(); ++index ) {
+		if( index == gap ) {
+			gapIndex = count;
+			count += splice.InsertedRows;
+		}
+		if( index < _nodes.size() && remap[ index ] != NoNode )
+			remap[ index ] = count++;
+	}
+
+	QVector< AstNode > nodes;
+	nodes.reserve( count + Descendants( queue ) );
+	for( int index = 0; index <= _nodes.size(); ++index ) {
+		if( index == gap )
+			nodes.resize( gapIndex + splice.InsertedRows );
+		if( index == _nodes.size() || remap[ index ] == NoNode )
+			continue;
+
+		AstNode node = old[ index ];
+		if( node.Info.Size >= 0 && node.Info.Pos >= oldEnd ) {
+			node.Info.Pos += delta;
+			node.Info.Line += splice.LineDelta;
+		}
+		node.Parent = Remapped( remap, node.Parent );
+		node.FirstChild = Remapped( remap, node.FirstChild );
+		node.NextSibling = Remapped( remap, node.NextSibling );
+		nodes.append( node );
+	}
+	_nodes.swap( nodes );
+
+	// children of the block are one run again
+	AstNode& blockNode = _nodes[ remap[ block ] ];
+	blockNode.ChildrenCount = oldCount - splice.RemovedRows + splice.InsertedRows;
+	if( splice.FirstRow > 0 )
+		blockNode.FirstChild = remap[ oldFirst ];
+	else if( splice.InsertedRows > 0 )
+		blockNode.FirstChild = gapIndex;
+	else if( blockNode.ChildrenCount > 0 )
+		blockNode.FirstChild = remap[ oldFirst + splice.RemovedRows ];
+	else
+		blockNode.FirstChild = NoNode;
+
+	const int firstChild = blockNode.FirstChild;
+	const int children = blockNode.ChildrenCount;
+	for( int row = 0; row < children; ++row ) {
+		AstNode& child = _nodes[ firstChild + row ];
+		child.Row = row;
+		child.NextSibling = row + 1 < children ? firstChild + row + 1 : NoNode;
+	}
+
+	for( int row = 0; row < splice.InsertedRows; ++row ) {
+		AstNode& node = _nodes[ gapIndex + row ];
+		node.Info = inserted[ row ];
+		node.Parent = remap[ block ];
+		queue[ row ].Index = gapIndex + row;
+	}
+	const int appended = _nodes.size();
+	AppendDescendants( queue, tokens );
+
+	for( int index = _nodes.size() - 1; index >= appended; --index )
+		Rehash( index );
+	for( int row = splice.InsertedRows - 1; row >= 0; --row )
+		Rehash( gapIndex + row );
+	for( int i = path.size() - 1; i >= 0; --i ) {
+		const int index = remap[ path[ i ] ];
+		_nodes[ index ].Info = infos[ i ];
+		Rehash( index );
+	}
+
+	// a node left empty at oldEnd may be gone, the walk takes it too
+	PatchIndex( remap, first, qMax( oldEnd, pathEnd ) + 1, delta );
+}
+
+/*
+** Nodes for the children of queued items, breadth first. Queue holds
+** items already in the vector, their descendants are appended.
+*/
+void AstTree::AppendDescendants( QVector< Source >& queue, const TokenBuffer& tokens )
+{
+	for( int i = 0; i < queue.size(); ++i ) {
+		const Source source = queue[ i ];
+
+		const int first = _nodes.size();
+		_nodes[ source.Index ].FirstChild = source.Item->HasChildren() ? first : NoNode;
+		_nodes[ source.Index ].ChildrenCount = source.Item->ChildrenCount();
+
+		int row = 0;
+		int anchor = source.Anchor;
+		for( const AstItem* child = source.Item->FirstChild(); child; child = child->Next(), ++row ) {
+			AstNode node;
+			node.Info = SourceInfo( child, tokens, anchor );
+			node.Parent = source.Index;
+			node.NextSibling = child->Next() ? first + row + 1 : NoNode;
+			node.Row = row;
+			_nodes.append( node );
+
+			const Source next = { child, anchor, first + row };
+			queue.append( next );
+		}
+	}
+}
+
+/*
+** count of nodes AppendDescendants adds for queue
+*/
+int AstTree::Descendants( const QVector< Source >& queue )
+{
+	int count = 0;
+	QVarLengthArray< const AstItem*, 64 > pending;
+	for( int i = 0; i < queue.size(); ++i )
+		pending.append( queue[ i ].Item );
+	while( !pending.isEmpty() ) {
+		const AstItem* item = pending.last();
+		pending.removeLast();
+		for( const AstItem* child = item->FirstChild(); child; child = child->Next(), ++count )
+			pending.append( child );
+	}
+	return count;
+}
+
+/*
+** hash of node from its type and the hashes of its children
+*/
+void AstTree::Rehash( int index )
+{
+	AstNode& node = _nodes[ index ];
+	quint32 hash = 2166136261u ^ quint32( node.Info.AstType );
+	for( int row = 0; row < node.ChildrenCount; ++row )
+		hash = ( hash ^ _nodes[ node.FirstChild + row ].Hash ) * 16777619u;
+	node.Hash = ( hash ^ quint32( node.ChildrenCount ) ) * 16777619u;
+}
+
+/*
+** leaves only an empty global node
+*/
+void AstTree::Clear()
+{
+	_nodes.clear();
+
+	AstNode root;
+	root.Info.AstType = AstInfo::Global;
+	root.Info.Pos = -1;
+	root.Info.Size = -1;
+	root.Info.Line = -1;
+	root.Info.Symbol = -1;
+	root.Info.Flags = AstInfo::NoFlags;
+	root.Parent = NoNode;
+	root.FirstChild = NoNode;
+	root.NextSibling = NoNode;
+	root.ChildrenCount = 0;
+	root.Row = 0;
+	root.Hash = 0;
+	_nodes.append( root );
+
+	BuildIndex();
+}
+
+QString AstTree::TypeText( int index ) const
+{
+	return AstTypeText( _nodes[ index ].Info.AstType );
+}
+
+/*
+** deepest node with span holding source position pos, NoNode when none
+*/
+int AstTree::NodeAt( int pos ) const
+{
+	const int piece = int( std::upper_bound( _bounds.constBegin(), _bounds.constEnd(), pos )
+						   - _bounds.constBegin() ) - 1;
+	return piece >= 0 ? _deepest[ piece ] : NoNode;
+}
+
+/*
+** nodes with span intersecting source range [first, end) in depth first
+** order: ones holding first, then ones starting inside of the range
+*/
+QVector< int > AstTree::NodesIn( int first, int end ) const
+{
+	QVector< int > nodes;
+	if( end <= first )
+		return nodes;
+
+	// nodes holding first are the deepest one and its parents with span
+	for( int index = NodeAt( first ); index != NoNode; index = _nodes[ index ].Parent )
+		if( _nodes[ index ].Info.Pos < first && _nodes[ index ].Info.Size >= 0 )
+			nodes.append( index );
+	std::reverse( nodes.begin(), nodes.end() );
+
+	const int from = int( std::lower_bound( _starts.constBegin(), _starts.constEnd(), first ) - _starts.constBegin() );
+	const int to = int( std::lower_bound( _starts.constBegin() + from, _starts.constEnd(), end ) - _starts.constBegin() );
+	for( int i = from; i < to; ++i )
+		nodes.append( _order[ i ] );
+	return nodes;
+}
+
+void AstTree::BuildIndex()
+{
+	_bounds.clear();
+	_deepest.clear();
+	_order.clear();
+	_starts.clear();
+	_order.reserve( _nodes.size() );
+	_starts.reserve( _nodes.size() );
+
+	IndexRange( INT_MIN, INT_MAX, _bounds, _deepest, _order, _starts );
+
+	_bounds.squeeze();
+	_deepest.squeeze();
+	_order.squeeze();
+	_starts.squeeze();
+}
+
+/*
+** Index after Patch: pieces and starts before first are kept, ones from
+** oldEnd on are shifted by delta, the range between is walked again. Old
+** node indexes are taken through remap.
+*/
+void AstTree::PatchIndex( const QVector< int >& remap, int first, int oldEnd, int delta )
+{
+	const int end = oldEnd + delta;
+
+	QVector< int > bounds;
+	QVector< int > deepest;
+	QVector< int > order;
+	QVector< int > starts;
+	IndexRange( first, end, bounds, deepest, order, starts );
+
+	// old vectors are only read, they may be shared with another tree
+	const int* oldOrder = _order.constData();
+	const int* oldStarts = _starts.constData();
+	const int* oldBounds = _bounds.constData();
+	const int* oldDeepest = _deepest.constData();
+
+	// starts of depth first order
+	QVector< int > newOrder;
+	QVector< int > newStarts;
+	newOrder.reserve( _nodes.size() );
+	newStarts.reserve( _nodes.size() );
+
+	const int head = int( std::lower_bound( oldStarts, oldStarts + _starts.size(), first ) - oldStarts );
+	const int tail = int( std::lower_bound( oldStarts, oldStarts + _starts.size(), oldEnd ) - oldStarts );
+	for( int i = 0; i < head; ++i ) {
+		newOrder.append( remap[ oldOrder[ i ] ] );
+		newStarts.append( oldStarts[ i ] );
+	}
+	for( int i = 0; i < order.size(); ++i ) {
+		if( starts[ i ] >= first && starts[ i ] < end ) {
+			newOrder.append( order[ i ] );
+			newStarts.append( starts[ i ] );
+		}
+	}
+	for( int i = tail; i < _order.size(); ++i ) {
+		if( remap[ oldOrder[ i ] ] == NoNode )
+			continue;
+		newOrder.append( remap[ oldOrder[ i ] ] );
+		newStarts.append( oldStarts[ i ] + delta );
+	}
+
+	// pieces, the ones at first and end are those holding the position
+	QVector< int > newBounds;
+	QVector< int > newDeepest;
+	newBounds.reserve( _bounds.size() + bounds.size() );
+	newDeepest.reserve( _bounds.size() + bounds.size() );
+
+	int piece = 0;
+	for( ; piece < _bounds.size() && oldBounds[ piece ] < first; ++piece )
+		MarkPiece( newBounds, newDeepest, oldBounds[ piece ], Remapped( remap, oldDeepest[ piece ] ) );
+
+	int walked = 0;
+	int holding = NoNode;
+	for( ; walked < bounds.size() && bounds[ walked ] <= first; ++walked )
+		holding = deepest[ walked ];
+	MarkPiece( newBounds, newDeepest, first, holding );
+	for( ; walked < bounds.size() && bounds[ walked ] < end; ++walked )
+		MarkPiece( newBounds, newDeepest, bounds[ walked ], deepest[ walked ] );
+
+	holding = piece > 0 ? Remapped( remap, oldDeepest[ piece - 1 ] ) : int( NoNode );
+	for( ; piece < _bounds.size() && oldBounds[ piece ] <= oldEnd; ++piece )
+		holding = Remapped( remap, oldDeepest[ piece ] );
+	MarkPiece( newBounds, newDeepest, end, holding );
+	for( ; piece < _bounds.size(); ++piece )
+		MarkPiece( newBounds, newDeepest, oldBounds[ piece ] + delta, Remapped( remap, oldDeepest[ piece ] ) );
+
+	_bounds.swap( newBounds );
+	_deepest.swap( newDeepest );
+	_order.swap( newOrder );
+	_starts.swap( newStarts );
+}
+
+/*
+** Walks the tree depth first keeping nodes holding the current position
+** open. A node opens a piece of source at its start, closing it gives the
+** rest back to the node it is in. Nodes with span outside of source range
+** [first, end) are skipped, the pieces hold beyond the range only for the
+** nodes holding first.
+*/
+void AstTree::IndexRange( int first, int end, QVector< int >& bounds, QVector< int >& deepest,
+						  QVector< int >& order, QVector< int >& starts ) const
+{
+	QVarLengthArray< int, 64 > open;
+	QVarLengthArray< int, 64 > pending;
+	pending.append( RootNode );
+
+	forever {
+		int pos = INT_MAX;
+		int index = NoNode;
+		if( !pending.isEmpty() ) {
+			index = pending.last();
+			pending.removeLast();
+
+			const AstNode& node = _nodes[ index ];
+			if( node.Info.Size >= 0 && ( node.Info.Pos >= end
+					|| ( node.Info.Pos < first && node.Info.Pos + node.Info.Size <= first ) ) )
+				continue;
+			for( int row = node.ChildrenCount - 1; row >= 0; --row )
+				pending.append( node.FirstChild + row );
+			if( node.Info.Size < 0 )
+				continue;
+			pos = node.Info.Pos;
+		}
+
+		while( !open.isEmpty() && _nodes[ open.last() ].Info.Pos + _nodes[ open.last() ].Info.Size <= pos ) {
+			const AstInfo& info = _nodes[ open.last() ].Info;
+			open.removeLast();
+			MarkPiece( bounds, deepest, info.Pos + info.Size, open.isEmpty() ? int( NoNode ) : open.last() );
+		}
+		if( index == NoNode )
+			break;
+
+		MarkPiece( bounds, deepest, pos, index );
+		open.append( index );
+
+		order.append( index );
+		starts.append( pos );
+	}
+}
+
+/*
+** piece starting at the same position as the last one replaces it, one
+** of the same node as the last one goes on with it
+*/
+void AstTree::MarkPiece( QVector< int >& bounds, QVector< int >& deepest, int pos, int index )
+{
+	if( !bounds.isEmpty() && bounds.last() == pos ) {
+		bounds.removeLast();
+		deepest.removeLast();
+	}
+	if( deepest.isEmpty() ? index != NoNode : deepest.last() != index ) {
+		bounds.append( pos );
+		deepest.append( index );
+	}
+}
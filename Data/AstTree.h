@@ -0,0 +1,150 @@
+#ifndef AST_TREE_H
+#define AST_TREE_H
+
+#include <QString>
+#include <QVector>
+
+#include "AstInfo.h"
+
+class AstItem;
+class TokenBuffer;
+
+struct AstNode {
+	AstInfo	Info;
+
+	int		Parent;
+	int		FirstChild;
+	int		NextSibling;
+	int		ChildrenCount;
+	int		Row;
+
+	// of node types in the subtree, equal subtrees have equal hashes
+	quint32	Hash;
+};
+
+/*
+** Statements of one block an incremental parse replaced: Path holds rows
+** from the root down to the block, RemovedRows statements from FirstRow on
+** gave way to InsertedRows new ones. RemovedChars characters at Position
+** of the old text were replaced by AddedChars, adding LineDelta lines.
+*/
+struct AstSplice {
+	QVector< int >	Path;
+	int		FirstRow;
+	int		RemovedRows;
+	int		InsertedRows;
+
+	int		Position;
+	int		RemovedChars;
+	int		AddedChars;
+	int		LineDelta;
+};
+
+/*
+** Syntax tree flattened into one vector, nodes are addressed by index and
+** node 0 is the root. Children of a node are stored one after another
+** behind it, so child lookup by row, parent and row of a node are all
+** constant time. Build lays the nodes out in breadth first order, Patch
+** keeps the order of nodes left and appends the new ones.
+**
+** Each node carries a hash of its subtree shape, so consumers can match
+** unchanged subtrees of two trees quickly. Token spans of the parser
+** nodes become source position, size and line here, nodes without a span
+** get -1.
+**
+** Spans of children lie inside the span of their parent one after
+** another, so the tree is also an interval index: source is cut into
+** pieces each covered by one deepest node, and nodes with span are kept
+** ordered by position. Both are binary searched by NodeAt and NodesIn.
+*/
+class AstTree
+{
+public:
+	enum {
+		NoNode		= -1,
+		RootNode	= 0
+	};
+
+	AstTree();
+	AstTree( const AstItem* root, const TokenBuffer& tokens );
+
+	void			Build( const AstItem* root, const TokenBuffer& tokens );
+	void			Patch( const AstItem* root, const TokenBuffer& tokens, const AstSplice& splice );
+	void			Clear();
+
+	int				Count() const;
+
+	const AstNode&	Node( int index ) const;
+	int				Parent( int index ) const;
+	int				Child( int index, int row ) const;
+	int				ChildrenCount( int index ) const;
+	int				Row( int index ) const;
+
+	QString			TypeText( int index ) const;
+
+	int				NodeAt( int pos ) const;
+	QVector< int >	NodesIn( int first, int end ) const;
+
+private:
+	// source node of a flat one and the token the spans of its children
+	// are relative to
+	struct Source {
+		const AstItem*	Item;
+		int				Anchor;
+		int				Index;
+	};
+
+	void			AppendDescendants( QVector< Source >& queue, const TokenBuffer& tokens );
+	static int		Descendants( const QVector< Source >& queue );
+	void			Rehash( int index );
+
+	void			BuildIndex();
+	void			PatchIndex( const QVector< int >& remap, int first, int oldEnd, int delta );
+	void			IndexRange( int first, int end, QVector< int >& bounds, QVector< int >& deepest,
+								QVector< int >& order, QVector< int >& starts ) const;
+	static void		MarkPiece( QVector< int >& bounds, QVector< int >& deepest, int pos, int index );
+
+private:
+	QVector< AstNode >	_nodes;
+
+	// pieces of source starting at _bounds, covered by deepest node
+	QVector< int >		_bounds;
+	QVector< int >		_deepest;
+
+	// nodes with span in depth first order and their positions
+	QVector< int >		_order;
+	QVector< int >		_starts;
+};
+
+inline int AstTree::Count() const
+{
+	return _nodes.size();
+}
+
+inline const AstNode& AstTree::Node( int index ) const
+{
+	return _nodes[ index ];
+}
+
+inline int AstTree::Parent( int index ) const
+{
+	return _nodes[ index ].Parent;
+}
+
+inline int AstTree::Child( int index, int row ) const
+{
+	const AstNode& node = _nodes[ index ];
+	return row >= 0 && row < node.ChildrenCount ? node.FirstChild + row : NoNode;
+}
+
+inline int AstTree::ChildrenCount( int index ) const
+{
+	return _nodes[ index ].ChildrenCount;
+}
+
+inline int AstTree::Row( int index ) const
+{
+	return _nodes[ index ].Row;
+}
+
+#endif // AST_TREE_H
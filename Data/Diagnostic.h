@@ -0,0 +1,18 @@
+#ifndef DIAGNOSTIC_H
+#define DIAGNOSTIC_H
+
+#include <QString>
+
+/*
+** Problem found in source, span is the token the problem was noticed at,
+** Line and Column are counted from 1
+*/
+struct Diagnostic {
+	QString	Description;
+	int		Pos;
+	int		Size;
+	int		Line;
+	int		Column;
+};
+
+#endif // DIAGNOSTIC_H
@@ -5,6 +5,17 @@
 
 #include <QChar>
 
+/*
+** Where the lexer stands relative to constructs that may span lines,
+** long brackets keep their level ('=' count) in LexerState::Level
+*/
+enum LexerContext {
+	LC_CODE,
+	LC_LONG_COMMENT,
+	LC_LONG_STRING,
+	LC_SHORT_STRING
+};
+
 struct LexerState
 {
 	const QChar*	Begin;
@@ -15,6 +26,22 @@ struct LexerState
 
 	TokenType		Type;
 	int				LineNumber;
+	int				PreviosLine;
+
+	LexerContext	Context;
+	int				Level;
+};
+
+/*
+** Lexer state at the start of a line, Token is the index of the first
+** token that ends after the line start
+*/
+struct LexerCheckpoint
+{
+	int				Offset;
+	int				Token;
+	LexerContext	Context;
+	int				Level;
 };
 
 #endif // LEXERSTATE_H
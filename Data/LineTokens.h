@@ -0,0 +1,35 @@
+#ifndef LINE_TOKENS_H
+#define LINE_TOKENS_H
+
+#include <QVector>
+
+#include "LexerState.h"
+
+/*
+** Token of one line, offset from the line start
+*/
+struct LineToken
+{
+	quint16		Offset;
+	quint16		Length;
+	qint8		Type;
+};
+
+/*
+** Tokens of a line as the highlighter lexed them, Context and Level are
+** the lexer state the line starts in, Length counts the line break too.
+** A long string going on to the next lines is cut at line ends, each
+** line has its own piece of it.
+**
+** Tokens are implicitly shared with the QTextBlock they come from, so a
+** copy for another thread takes no lexing and no copying of tokens.
+*/
+struct LineTokens
+{
+	QVector< LineToken >	Tokens;
+	int						Length;
+	LexerContext			Context;
+	int						Level;
+};
+
+#endif // LINE_TOKENS_H
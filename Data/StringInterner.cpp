@@ -0,0 +1,127 @@
+#include "StringInterner.h"
+
+#include <cstring>
+
+StringInterner::StringInterner()
+{
+	Clear();
+}
+
+/*
+** symbol of text, a new one if text is met first time
+*/
+int StringInterner::Intern( const QChar* text, int length )
+{
+	const quint32 hash = Hash( text, length );
+	const int slot = Probe( hash, text, length );
+	if( _slots[ slot ].Symbol != NoSymbol )
+		return _slots[ slot ].Symbol;
+
+	const int symbol = Count();
+	_chars.append( text, length );
+	_starts.append( _chars.size() );
+	_slots[ slot ].Hash = hash;
+	_slots[ slot ].Symbol = symbol;
+
+	if( 2 * Count() > _slots.size() )
+		Grow();
+	return symbol;
+}
+
+/*
+** symbol of text or NoSymbol, nothing is added
+*/
+int StringInterner::Find( const QChar* text, int length ) const
+{
+	return _slots[ Probe( Hash( text, length ), text, length ) ].Symbol;
+}
+
+/*
+** interns all texts of other, result maps symbols of other to the ones
+** they have here
+*/
+QVector< int > StringInterner::Merge( const StringInterner& other )
+{
+	QVector< int > symbols( other.Count() );
+	for( int symbol = 0; symbol < other.Count(); ++symbol ) {
+		const int start = other._starts[ symbol ];
+		symbols[ symbol ] = Intern( other._chars.constData() + start, other._starts[ symbol + 1 ] - start );
+	}
+	return symbols;
+}
+
+void StringInterner::Clear()
+{
+	const Slot empty = { 0, NoSymbol };
+	_slots.fill( empty, InitialSlots );
+	_chars.clear();
+	_starts.clear();
+	_starts.append( 0 );
+}
+
+QString StringInterner::Text( int symbol ) const
+{
+	const int start = _starts[ symbol ];
+	return _chars.mid( start, _starts[ symbol + 1 ] - start );
+}
+
+int StringInterner::MemoryUsage() const
+{
+	return _slots.capacity() * sizeof( Slot )
+			+ _chars.capacity() * sizeof( QChar )
+			+ _starts.capacity() * sizeof( int );
+}
+
+/*
+** FNV-1a over UTF-16 code units
+*/
+quint32 StringInterner::Hash( const QChar* text, int length )
+{
+	quint32 hash = 2166136261u;
+	for( int i = 0; i < length; ++i )
+		hash = ( hash ^ text[ i ].unicode() ) * 16777619u;
+	return hash;
+}
+
+/*
+** slot holding text or the empty slot it would go to
+*/
+int StringInterner::Probe( quint32 hash, const QChar* text, int length ) const
+{
+	const int mask = _slots.size() - 1;
+	int slot = int( hash & quint32( mask ) );
+	forever {
+		const Slot& current = _slots[ slot ];
+		if( current.Symbol == NoSymbol
+				|| ( current.Hash == hash && Equals( current.Symbol, text, length ) ) )
+			return slot;
+		slot = ( slot + 1 ) & mask;
+	}
+}
+
+bool StringInterner::Equals( int symbol, const QChar* text, int length ) const
+{
+	const int start = _starts[ symbol ];
+	return _starts[ symbol + 1 ] - start == length
+			&& memcmp( _chars.constData() + start, text, length * sizeof( QChar ) ) == 0;
+}
+
+/*
+** twice as many slots, symbols keep their hashes so no text is read
+*/
+void StringInterner::Grow()
+{
+	const QVector< Slot > old = _slots;
+	const Slot empty = { 0, NoSymbol };
+	_slots.fill( empty, old.size() * 2 );
+
+	const int mask = _slots.size() - 1;
+	for( const Slot& slot : old ) {
+		if( slot.Symbol == NoSymbol )
+			continue;
+		int index = int( slot.Hash & quint32( mask ) );
+		while( _slots[ index ].Symbol != NoSymbol )
+			index = ( index + 1 ) & mask;
+		_slots[ index ] = slot;
+	}
+}
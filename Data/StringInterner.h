@@ -0,0 +1,61 @@
+#ifndef STRING_INTERNER_H
+#define STRING_INTERNER_H
+
+#include <QString>
+#include <QVector>
+
+/*
+** Identifier texts mapped to dense symbols 0, 1, 2... in order of first
+** appearance. The table is open addressed with linear probing over a
+** power of two number of slots, a slot keeps the hash next to the symbol
+** so probing rarely looks at the text. Texts are stored one after another
+** in one buffer, a repeated name takes no memory.
+**
+** Not thread safe, parsers on other threads intern into their own
+** interners and Merge them afterwards.
+*/
+class StringInterner
+{
+public:
+	enum { NoSymbol = -1 };
+
+	StringInterner();
+
+	int				Intern( const QChar* text, int length );
+	int				Find( const QChar* text, int length ) const;
+	QVector< int >	Merge( const StringInterner& other );
+	void			Clear();
+
+	int				Count() const;
+	QString			Text( int symbol ) const;
+
+	int				MemoryUsage() const;
+
+private:
+	struct Slot {
+		quint32	Hash;
+		int		Symbol;
+	};
+
+	// slots are kept at most half full
+	enum { InitialSlots = 256 };
+
+	static quint32	Hash( const QChar* text, int length );
+	int				Probe( quint32 hash, const QChar* text, int length ) const;
+	bool			Equals( int symbol, const QChar* text, int length ) const;
+	void			Grow();
+
+private:
+	QVector< Slot >	_slots;
+
+	// text of symbol i is [_starts[ i ], _starts[ i + 1 ]) of _chars
+	QString			_chars;
+	QVector< int >	_starts;
+};
+
+inline int StringInterner::Count() const
+{
+	return _starts.size() - 1;
+}
+
+#endif // STRING_INTERNER_H
@@ -1,6 +1,7 @@
 #include "Editor.h"
 
 #include <QPainter>
+#include <QScrollBar>
 #include <QTextBlock>
 
 #include "LineNumberArea.h"
@@ -13,6 +14,8 @@ Editor::Editor( QWidget* parent) :
 	connect(this, SIGNAL(blockCountChanged(int)), this, SLOT(updateLineNumberAreaWidth(int)));
 	connect(this, SIGNAL(updateRequest(QRect,int)), this, SLOT(updateLineNumberArea(QRect,int)));
 	connect(this, SIGNAL(cursorPositionChanged()), this, SLOT(highlightCurrentLine()));
+	connect(this, SIGNAL(blockCountChanged(int)), this, SLOT(updateVisibleBlocks()));
+	connect(verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(updateVisibleBlocks()));
 
 	updateLineNumberAreaWidth( 0 );
 	highlightCurrentLine();
@@ -74,6 +77,19 @@ void Editor::resizeEvent(QResizeEvent *e)
 
 	QRect cr = contentsRect();
 	lineNumberArea->setGeometry(QRect(cr.left(), cr.top(), lineNumberAreaWidth(), cr.height()));
+
+	updateVisibleBlocks();
+}
+
+/*
+** a line per block is assumed, with wrapped lines the range is only wider
+** than what is shown
+*/
+void Editor::updateVisibleBlocks()
+{
+	const int first = firstVisibleBlock().blockNumber();
+	const int lines = viewport()->height() / qMax( 1, fontMetrics().height() ) + 1;
+	emit visibleBlocksChanged( first, first + lines );
 }
 
 void Editor::highlightCurrentLine()
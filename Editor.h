@@ -21,6 +21,9 @@ public:
 	void lineNumberAreaPaintEvent( QPaintEvent *event );
 	int lineNumberAreaWidth();
 
+signals:
+	void visibleBlocksChanged( int first, int last );
+
 protected:
 	void resizeEvent( QResizeEvent *event );
 
@@ -28,6 +31,7 @@ private slots:
 	void updateLineNumberAreaWidth(int newBlockCount);
 	void highlightCurrentLine();
 	void updateLineNumberArea(const QRect &, int);
+	void updateVisibleBlocks();
 
 private:
 	QWidget *lineNumberArea;
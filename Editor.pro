@@ -2,6 +2,8 @@
 QT += widgets
 QT += concurrent
 
+CONFIG += c++14
+
 DESTDIR = ${PWD}/../../Editor/bin
 
 HEADERS +=              \
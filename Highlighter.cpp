@@ -1,182 +1,441 @@
-#include "highlighter.h"
+#include "Highlighter.h"
 
 #include <QApplication>
+#include <QTextBlock>
 #include <QTextDocument>
 
 #include <QStringRef>
 
-enum {
-	MaxMultiLine = 255
-};
+#include "Lexer/Lexer2.h"
 
+/*
+** Block state is the lexer context at the block end in the low two bits
+** and the long bracket level above them, any level fits. Code has level
+** 0, so it is BlockState_Default.
+*/
 enum BlockState {
-	BlockState_Default = -1,
-	BlockState_MultilineComment = 0,
-	BlockState_MaxMultilineComment = BlockState_MultilineComment + MaxMultiLine,
-	BlockState_MultilineText = BlockState_MaxMultilineComment + 1,
-	BlockState_MaxMultilineText = BlockState_MultilineText + MaxMultiLine
+	BlockState_Unknown = -1,
+	BlockState_Default = LC_CODE,
+
+	BlockState_ContextBits = 2,
+	BlockState_ContextMask = ( 1 << BlockState_ContextBits ) - 1
 };
 
 Highlighter::Highlighter( QTextDocument* parent )
 	: QSyntaxHighlighter( parent )
 {
-	_symbols = QRegExp( "(\\w+)|(\\S)" );
-
 	_keywordFormat.setForeground( QBrush( "#93C763" ) );
-	_keywords.insert( QStringRef( new QString( "local" ) ) );
-	_keywords.insert( QStringRef( new QString( "function" ) ) );
-	_keywords.insert( QStringRef( new QString( "end" ) ) );
-	_keywords.insert( QStringRef( new QString( "return" ) ) );
-	_keywords.insert( QStringRef( new QString( "if" ) ) );
-	_keywords.insert( QStringRef( new QString( "then" ) ) );
-	_keywords.insert( QStringRef( new QString( "else" ) ) );
-	_keywords.insert( QStringRef( new QString( "elseif" ) ) );
-	_keywords.insert( QStringRef( new QString( "for" ) ) );
-	_keywords.insert( QStringRef( new QString( "in" ) ) );
-	_keywords.insert( QStringRef( new QString( "setmetatable" ) ) );
-	_keywords.insert( QStringRef( new QString( "do" ) ) );
-	_keywords.insert( QStringRef( new QString( "break" ) ) );
-	_keywords.insert( QStringRef( new QString( "and" ) ) );
-	_keywords.insert( QStringRef( new QString( "not" ) ) );
-	_keywords.insert( QStringRef( new QString( "or" ) ) );
-	_keywords.insert( QStringRef( new QString( "true" ) ) );
-	_keywords.insert( QStringRef( new QString( "nil" ) ) );
-	_keywords.insert( QStringRef( new QString( "false" ) ) );
-	_keywords.insert( QStringRef( new QString( "repeat" ) ) );
-	_keywords.insert( QStringRef( new QString( "until" ) ) );
 
 	_commentFormat.setForeground( QBrush( "#7D8C93" ) );
 	_textFormat.setForeground( QBrush( "#EC7600" ) );
 
-    _commentChar = new QString( "-" );
-    _multilineBeginChar = new QString( "[" );
-	_multilineBegin = QRegExp( "\\[=*\\[" );
-	_multilineEnd = QString( "\\]={%1}\\]" );
+	_next = 0;
+	_pendingLast = -1;
+	_blockCount = parent ? parent->blockCount() : 0;
+	_deferredFirst = NoBlock;
+	_deferredLast = -1;
+	_firstVisible = 0;
+	_lastVisible = -1;
+	_restyleVisible = false;
+	_restyleState = BlockState_Unknown;
 
-	_quot = new QString( "\"" );
-	_apos = new QString( "'" );
-	_escape = new QString( "\\" );
+	_timer.setSingleShot( true );
+	_timer.setInterval( 0 );
+	connect( &_timer, SIGNAL( timeout() ), this, SLOT( HighlightSlice() ) );
+	if( parent )
+		connect( parent, SIGNAL( contentsChange(int,int,int) ), this, SLOT( ContentsChanged(int,int,int) ) );
+}
+
+/*
+** blocks shown by the editor, they go before the rest
+*/
+void Highlighter::SetVisibleBlocks( int first, int last )
+{
+	_firstVisible = first;
+	_lastVisible = last;
+	_restyleVisible = true;
+	_timer.start();
 }
 
 void Highlighter::highlightBlock( const QString& text )
 {
-	int pos = 0;
+	if( _restyleState != BlockState_Unknown ) {
+		// colors only, the state is left to the chain
+		_restyleState = Highlight( text, _restyleState );
+		return;
+	}
 
-	int state = previousBlockState();
-	if( state > BlockState_Default ) {
-		int level = state;
-		if( state > BlockState_MaxMultilineComment ) {
-			level -= BlockState_MultilineText;
-        }
+	// the first block of a pass starts the budget, the timer ends it
+	if( !_clock.isValid() ) {
+		_clock.start();
+		_timer.start();
+	}
 
-		QRegExp end( _multilineEnd.arg( level ) );
-		int endPos = end.indexIn( text );
-		if( endPos == -1 ) {
-			setFormat( 0, text.size(), state > BlockState_MaxMultilineComment ? _textFormat : _commentFormat );
-			setCurrentBlockState( state );
-			return;
-		}
-		else {
-			pos = endPos + end.matchedLength();
-			setFormat( 0, pos, state > BlockState_MaxMultilineComment ? _textFormat : _commentFormat );
-			++pos;
+	const QTextBlock block = currentBlock();
+	const QTextBlock previous = block.previous();
+	const bool known = !previous.isValid() || IsKnown( previous );
+	const bool visible = IsVisible( block.blockNumber() );
+
+	if( known && ( visible || !_clock.hasExpired( SliceMilliseconds ) ) ) {
+		BlockTokens* tokens = static_cast< BlockTokens* >( currentBlockUserData() );
+		if( !tokens ) {
+			tokens = new BlockTokens;
+			setCurrentBlockUserData( tokens );
 		}
+		setCurrentBlockState( Highlight( text, previousBlockState(), tokens ) );
+		if( !tokens->Complete )
+			setCurrentBlockUserData( 0 );
+	}
+	else if( visible ) {
+		// guessed, the chain redoes it
+		Highlight( text, previousBlockState() );
+		setCurrentBlockState( BlockState_Unknown );
+		setCurrentBlockUserData( 0 );
+		Defer( block.blockNumber() );
 	}
+	else {
+		setCurrentBlockUserData( 0 );
+		Defer( block.blockNumber() );
+	}
+}
 
-	while( ( pos = _symbols.indexIn( text, pos ) ) != -1 ) {
-		QStringRef symbol = text.midRef( pos, _symbols.matchedLength() );
-		if( symbol == _commentChar ) {
-			int advance = pos + 1;
-			if( advance < text.size() && text.midRef( advance, 1 ) == _commentChar ) {
-				// Comments
-				++advance;
-				if( _multilineBegin.indexIn( text, advance ) == advance ) {
-					int level = _multilineBegin.matchedLength() - 2;
-					// ToDo: check max level
-					QRegExp end( _multilineEnd.arg( level ) );
-					advance += _multilineBegin.matchedLength();
-					int endPos = end.indexIn( text, advance );
-					if( endPos == -1 ) {
-						// start multiline comment
-						setFormat( pos, text.size() - pos, _commentFormat );
-						setCurrentBlockState( level );
-						return;
-					}
-					else {
-						// single line comment, begin and end in one line
-						endPos += end.matchedLength();
-						setFormat( pos, endPos - pos, _commentFormat );
-						pos = endPos;
-						continue;
-					}
-				}
-				else {
-					// single line comment till end line
-					setFormat( pos, text.size() - pos, _commentFormat );
-					break;
-				}
-			}
-		}
-		else if( symbol == _multilineBeginChar ) {
-			if( _multilineBegin.indexIn( text, pos ) == pos ) {
-				// Text
-				int level = _multilineBegin.matchedLength() - 2;
-				// ToDo: check max level
-				QRegExp end( _multilineEnd.arg( level ) );
-				int advance = pos + _multilineBegin.matchedLength();
-				int endPos = end.indexIn( text, advance );
-				if( endPos == -1 ) {
-					// start multiline text
-					setFormat( pos, text.size() - pos, _textFormat );
-					setCurrentBlockState( level + BlockState_MultilineText );
-					return;
-				}
-				else {
-					// single line text, begin and end in one line
-					endPos += end.matchedLength();
-					setFormat( pos, endPos - pos, _textFormat );
-					pos = endPos;
-					continue;
-				}
-			}
+/*
+** no block waits for the chain, every state is known
+*/
+bool Highlighter::IsChainDone() const
+{
+	return _pendingLast < 0 && _deferredLast < 0;
+}
+
+/*
+** Tokens of all blocks for the parser; lines share the token arrays of
+** the blocks, nothing is lexed or copied. False if the chain is not done
+** or a block has no tokens.
+*/
+bool Highlighter::CachedTokens( QVector< LineTokens >& lines ) const
+{
+	lines.clear();
+	if( !IsChainDone() )
+		return false;
+
+	lines.reserve( document()->blockCount() );
+	LineTokens line;
+	for( QTextBlock block = document()->begin(); block.isValid(); block = block.next() ) {
+		if( !CachedLine( block, line ) ) {
+			lines.clear();
+			return false;
 		}
-		else if( symbol == _quot || symbol == _apos ) {
-			// String
-			int endPos = pos + 1;
-			while( ( endPos = text.indexOf( symbol.toString(), endPos ) ) != -1) {
-				// Check escape symbol
-				int testPos = endPos - 1;
-				int escape = 0;
-				while( testPos > pos && text.midRef( testPos, 1 ) == _escape ) {
-					--testPos;
-					++escape;
-				}
-				if( ( escape & 1 ) == 0 )
-					break;
-
-				++endPos;
-			}
+		lines.append( line );
+	}
+	return true;
+}
 
-			if( endPos == -1 ) {
-				// Not closed string
-				setFormat( pos, text.size() - pos, _textFormat );
+/*
+** tokens of one block with the lexer state it starts in, false if the
+** state of the block or of the one before it is not known or the block
+** has no tokens
+*/
+bool Highlighter::CachedLine( const QTextBlock& block, LineTokens& line ) const
+{
+	const BlockTokens* tokens = static_cast< const BlockTokens* >( block.userData() );
+	const QTextBlock previous = block.previous();
+	if( !tokens || !IsKnown( block ) || ( previous.isValid() && !IsKnown( previous ) ) )
+		return false;
+
+	LexerState entry;
+	entry.Context = LC_CODE;
+	entry.Level = -1;
+	EnterState( previous.isValid() ? previous.userState() : int( BlockState_Default ), entry );
+
+	line.Tokens = tokens->Tokens;
+	line.Length = block.length();
+	line.Context = entry.Context;
+	line.Level = entry.Level;
+	return true;
+}
+
+/*
+** Continues the chain from the first block of unknown state up to the
+** last one, visible blocks first. Cascades of QSyntaxHighlighter started
+** here stop at the end of the slice as well.
+*/
+void Highlighter::HighlightSlice()
+{
+	MarkDeferred();
+	_clock.start();
+
+	if( _restyleVisible ) {
+		_restyleVisible = false;
+		RestyleVisible();
+		MarkDeferred();
+	}
+
+	QTextBlock block = document()->findBlockByNumber( _next );
+	while( block.isValid() && block.blockNumber() <= _pendingLast
+			&& !_clock.hasExpired( SliceMilliseconds ) ) {
+		if( !IsKnown( block ) ) {
+			rehighlightBlock( block );
+			MarkDeferred();
+
+			// budget ran out before the block itself, it goes first next time
+			if( !IsKnown( block ) )
 				break;
+		}
+		block = block.next();
+	}
+
+	_clock.invalidate();
+	if( block.isValid() && block.blockNumber() <= _pendingLast ) {
+		_next = block.blockNumber();
+		_timer.start();
+	}
+	else {
+		_next = NoBlock;
+		_pendingLast = -1;
+		if( IsChainDone() )
+			emit ChainDone();
+	}
+}
+
+/*
+** Visible blocks past the first block of unknown state may show colors of
+** an old chain, e.g. after '--[[' was typed above them. States are lexed
+** on from the last exact one without coloring, and visible blocks are
+** recolored from them; their own states are left for the chain, so it
+** still goes through them. If the budget ends before the viewport,
+** visible blocks of unknown state get a guess.
+*/
+void Highlighter::RestyleVisible()
+{
+	QTextBlock block = document()->findBlockByNumber( _next );
+	if( !block.isValid() || block.blockNumber() > _lastVisible )
+		return;
+
+	int state = block.previous().isValid() ? block.previous().userState() : int( BlockState_Default );
+	bool exact = true;
+	for( ; block.isValid() && block.blockNumber() <= _lastVisible; block = block.next() ) {
+		exact = exact && IsKnown( block );
+		if( IsVisible( block.blockNumber() ) ) {
+			if( exact ) {
+				state = block.userState();
 			}
 			else {
-				// closed string
-				setFormat( pos, endPos - pos + 1, _textFormat );
-				pos = endPos + 1;
-				continue;
+				_restyleState = state;
+				rehighlightBlock( block );
+				state = _restyleState;
+				_restyleState = BlockState_Unknown;
 			}
 		}
-		else if( _keywords.contains( symbol ) ) {
-			setFormat( pos, _symbols.matchedLength(), _keywordFormat );
+		else if( _clock.hasExpired( SliceMilliseconds ) ) {
+			break;
+		}
+		else {
+			state = exact ? block.userState() : StateAfter( block.text(), state );
+		}
+	}
+
+	if( !block.isValid() || block.blockNumber() > _lastVisible )
+		return;
+
+	for( block = document()->findBlockByNumber( _firstVisible );
+			block.isValid() && block.blockNumber() <= _lastVisible; block = block.next() ) {
+		if( !IsKnown( block ) )
+			rehighlightBlock( block );
+	}
+}
+
+/*
+** QSyntaxHighlighter has colored the changed blocks already. Blocks of
+** unknown state past the edit moved with it, removed lines may have
+** moved some before _next.
+*/
+void Highlighter::ContentsChanged( int position, int /* removed */, int /* added */ )
+{
+	const int block = document()->findBlock( position ).blockNumber();
+	const int count = document()->blockCount();
+	if( _pendingLast >= block )
+		_pendingLast = qMax( block, _pendingLast + count - _blockCount );
+	_blockCount = count;
+
+	MarkDeferred();
+	_next = qMin( _next, block );
+}
+
+/*
+** One lexer pass over the block, nothing is allocated. Comments are not
+** tokens, they are what is left between tokens besides spaces. Returns
+** the state at the block end.
+*/
+int Highlighter::Highlight( const QString& text, int blockState, BlockTokens* cache )
+{
+	LexerState state = Lexer2::InitialState( &text );
+	EnterState( blockState, state );
+
+	if( cache ) {
+		cache->Tokens.clear();
+		cache->Complete = text.size() <= 0xFFFF;
+	}
+
+	// a resumed long comment starts at the block start
+	int gap = state.Context == LC_LONG_COMMENT ? -1 : 0;
+
+	Lexer2 lexer( state );
+	for( TokenType type = lexer.Next(); type != TT_END_OF_FILE; type = lexer.Next() ) {
+		const int start = lexer.CurrentStart();
+		const int end = lexer.CurrentPos();
+		FormatComment( text, gap, start );
+		gap = end;
+
+		switch( type ) {
+		case TT_STRING:
+			setFormat( start, end - start, _textFormat );
+			break;
+		case TT_ERROR: {
+			// not closed string
+			const ushort first = text[ start ].unicode();
+			if( lexer.State().Context == LC_LONG_STRING || first == L'"' || first == L'\'' )
+				setFormat( start, end - start, _textFormat );
+			break;
+		}
+		case TT_NAME:
+			if( QStringRef( &text, start, end - start ) == QLatin1String( "setmetatable" ) )
+				setFormat( start, end - start, _keywordFormat );
+			break;
+		case TT_NIL: case TT_TRUE: case TT_FALSE:
+		case TT_DO: case TT_WHILE: case TT_REPEAT: case TT_UNTIL:
+		case TT_IF: case TT_THEN: case TT_ELSEIF: case TT_ELSE:
+		case TT_FOR: case TT_IN: case TT_RETURN: case TT_BREAK:
+		case TT_END: case TT_LOCAL: case TT_FUNCTION:
+		case TT_OR: case TT_AND: case TT_NOT:
+			setFormat( start, end - start, _keywordFormat );
+			break;
+		default:
+			break;
 		}
 
-		pos += _symbols.matchedLength();
-	};
+		if( cache && cache->Complete )
+			CacheToken( cache, text, type, start, end, lexer.State().Context == LC_LONG_STRING );
+	}
+	FormatComment( text, gap, text.size() );
 
-	if( currentBlockState() != BlockState_Default )
-		setCurrentBlockState( BlockState_Default );
+	return BlockStateOf( lexer.State() );
 }
 
+/*
+** Token as the parser lexes it from QTextDocument::toPlainText, which has
+** a space for a no-break space and a line break for a line separator. A
+** short string open at the block end may go on past an escaped line
+** break, such a block is not cached.
+*/
+void Highlighter::CacheToken( BlockTokens* cache, const QString& text, TokenType type,
+							  int start, int end, bool longString )
+{
+	if( type == TT_ERROR && !longString ) {
+		const QChar first = text[ start ];
+		if( first == QChar::Nbsp )
+			return;
+		if( first == QChar::LineSeparator
+				|| ( ( first == QLatin1Char( '"' ) || first == QLatin1Char( '\'' ) ) && end == text.size() ) ) {
+			cache->Complete = false;
+			return;
+		}
+	}
+
+	const LineToken token = { quint16( start ), quint16( end - start ), qint8( type ) };
+	cache->Tokens.append( token );
+}
+
+/*
+** comment in text between tokens [begin, end), from its first to its
+** last non space character; begin -1 colors from the block start
+*/
+void Highlighter::FormatComment( const QString& text, int begin, int end )
+{
+	const QChar* data = text.constData();
+	if( begin < 0 )
+		begin = 0;
+	else
+		while( begin < end && data[ begin ].isSpace() )
+			++begin;
+
+	while( end > begin && data[ end - 1 ].isSpace() )
+		--end;
+
+	if( begin < end )
+		setFormat( begin, end - begin, _commentFormat );
+}
+
+/*
+** state at the block end, nothing is colored
+*/
+int Highlighter::StateAfter( const QString& text, int blockState )
+{
+	LexerState state = Lexer2::InitialState( &text );
+	EnterState( blockState, state );
+
+	Lexer2 lexer( state );
+	while( lexer.Next() != TT_END_OF_FILE )
+		;
+	return BlockStateOf( lexer.State() );
+}
+
+/*
+** lexer state at the start of a block from the state of the previous one
+*/
+void Highlighter::EnterState( int blockState, LexerState& state )
+{
+	if( blockState <= BlockState_Default )
+		return;
+
+	state.Context = static_cast< LexerContext >( blockState & BlockState_ContextMask );
+	state.Level = blockState >> BlockState_ContextBits;
+}
+
+/*
+** only long brackets go on to the next block, a short string ends with
+** its line
+*/
+int Highlighter::BlockStateOf( const LexerState& state )
+{
+	if( state.Context != LC_LONG_COMMENT && state.Context != LC_LONG_STRING )
+		return BlockState_Default;
+	return ( state.Level << BlockState_ContextBits ) | state.Context;
+}
+
+bool Highlighter::IsKnown( const QTextBlock& block ) const
+{
+	const int number = block.blockNumber();
+	return block.userState() != BlockState_Unknown
+			&& ( number < _deferredFirst || number > _deferredLast );
+}
+
+bool Highlighter::IsVisible( int block ) const
+{
+	return block >= _firstVisible && block <= _lastVisible;
+}
+
+/*
+** block is left for the chain; a skipped block keeps its state so that
+** QSyntaxHighlighter does not go further, a stale viewport past it is
+** recolored
+*/
+void Highlighter::Defer( int block )
+{
+	_deferredFirst = qMin( _deferredFirst, block );
+	_deferredLast = qMax( _deferredLast, block );
+	_next = qMin( _next, block );
+	if( block < _firstVisible )
+		_restyleVisible = true;
+	_timer.start();
+}
+
+void Highlighter::MarkDeferred()
+{
+	QTextBlock block = document()->findBlockByNumber( _deferredFirst );
+	for( ; block.isValid() && block.blockNumber() <= _deferredLast; block = block.next() )
+		block.setUserState( BlockState_Unknown );
+
+	_pendingLast = qMax( _pendingLast, _deferredLast );
+	_deferredFirst = NoBlock;
+	_deferredLast = -1;
+}
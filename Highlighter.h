@@ -41,13 +41,55 @@
 #ifndef HIGHLIGHTER_H
 #define HIGHLIGHTER_H
 
-#include <QSet>
-#include <QRegExp>
+#include <QElapsedTimer>
 #include <QSyntaxHighlighter>
+#include <QTextBlockUserData>
 #include <QTextCharFormat>
+#include <QTimer>
+
+#include <climits>
+
+#include "Data/LexerState.h"
+#include "Data/LineTokens.h"
 
 class QTextDocument;
 
+/*
+** Tokens of a block lexed in its real chain, kept for the parser. A block
+** whose text reads differently in QTextDocument::toPlainText has none.
+*/
+class BlockTokens : public QTextBlockUserData
+{
+public:
+	QVector< LineToken >	Tokens;
+	bool					Complete;
+};
+
+/*
+** Colors a block with the same Lexer2 the parser uses. The block state
+** keeps an open long comment or long string with its level, the next
+** block resumes the lexer inside of it.
+**
+** Highlighting runs in slices of SliceMilliseconds. A block is colored
+** for real only when the state of the block before it is known, blocks
+** past the budget keep BlockState_Unknown (the state Qt gives to new
+** blocks) and are done later from a zero timer, in document order, so
+** states stay chained. Visible blocks are colored at once: with the real
+** entry state if it is known, otherwise with a guess that is redone when
+** the chain gets to them.
+**
+** An edit that changes the state at a block end, like typing '--[[',
+** is followed through the next blocks only within the budget as well.
+** The rest of such a cascade goes on in slices; the viewport is
+** recolored at once from states lexed ahead, and a follow up edit that
+** restores the old state ends the cascade where its states match again.
+**
+** Tokens of every block colored for real are kept in its BlockTokens, a
+** block gets new ones only when it is highlighted again, so an edit drops
+** just the tokens of the blocks it touched. Once the chain is done they
+** make up the tokens of the whole text for the parser, ChainDone tells
+** when; those of known blocks around an edit stand for the edited lines.
+*/
 class Highlighter : public QSyntaxHighlighter
 {
 	Q_OBJECT
@@ -55,25 +97,70 @@ class Highlighter : public QSyntaxHighlighter
 public:
 	Highlighter(QTextDocument* parent = 0);
 
+	bool		IsChainDone() const;
+	bool		CachedTokens( QVector< LineTokens >& lines ) const;
+	bool		CachedLine( const QTextBlock& block, LineTokens& line ) const;
+
+signals:
+	void ChainDone();
+
+public slots:
+	void SetVisibleBlocks( int first, int last );
+
 protected:
 	void highlightBlock( const QString& text );
 
+private slots:
+	void HighlightSlice();
+	void ContentsChanged( int position, int removed, int added );
+
+private:
+	enum {
+		SliceMilliseconds = 4,
+		NoBlock = INT_MAX
+	};
+
+	int				Highlight		( const QString& text, int blockState, BlockTokens* cache = 0 );
+	static void		CacheToken		( BlockTokens* cache, const QString& text, TokenType type,
+									  int start, int end, bool longString );
+	static int		StateAfter		( const QString& text, int blockState );
+	static void		EnterState		( int blockState, LexerState& state );
+	static int		BlockStateOf	( const LexerState& state );
+
+	void			FormatComment	( const QString& text, int begin, int end );
+
+	bool			IsKnown			( const QTextBlock& block ) const;
+	bool			IsVisible		( int block ) const;
+	void			RestyleVisible	();
+	void			Defer			( int block );
+	void			MarkDeferred	();
+
 private:
 	QTextCharFormat		_keywordFormat;
-	QSet< QStringRef >	_keywords;
 
 	QTextCharFormat		_textFormat;
 	QTextCharFormat		_commentFormat;
-	QStringRef			_multilineBeginChar;
-	QStringRef			_commentChar;
 
-	QRegExp _symbols;
-	QRegExp _multilineBegin;
-	QString _multilineEnd;
+	QTimer				_timer;
+	QElapsedTimer		_clock;
+
+	// blocks before _next have known states, none after _pendingLast is
+	// unknown
+	int					_next;
+	int					_pendingLast;
+	int					_blockCount;
+
+	// blocks left in a pass, marked unknown once QSyntaxHighlighter is
+	// done with them as changing their state would make it go on
+	int					_deferredFirst;
+	int					_deferredLast;
+
+	int					_firstVisible;
+	int					_lastVisible;
+	bool				_restyleVisible;
 
-	QStringRef _quot;
-	QStringRef _apos;
-	QStringRef _escape;
+	// entry state while visible blocks are recolored only
+	int					_restyleState;
 };
 
 
@@ -1,23 +1,54 @@
 #include "Lexer2.h"
 
-#include <QMap>
+#include "LexerScan.h"
+#include "LuaKeywords.h"
 
-Lexer2::Lexer2()
+Lexer2::Lexer2() :
+	_checkpoints( nullptr )
 {
 
 }
 
-Lexer2::Lexer2( const QString* source )
+Lexer2::Lexer2( const QString* source ) :
+	_state( InitialState( source ) ),
+	_checkpoints( nullptr )
 {
-	_state.Begin = _state.Current = _state.Previos = source->data();
-	_state.End = _state.Begin + source->size();
-    _state.LineNumber = 1;
 	_state.Type = Next();
 }
 
+/*
+** resume lexing from a saved state, the first Next() continues an open
+** long comment or long string if the state is inside one
+*/
 Lexer2::Lexer2( const LexerState& state ) :
-	_state( state )
+	_state( state ),
+	_checkpoints( nullptr )
+{
+}
+
+LexerState Lexer2::InitialState( const QString* source )
+{
+	LexerState state;
+	state.Begin = state.Current = state.Previos = source->data();
+	state.End = state.Begin + source->size();
+	state.Type = TT_END_OF_FILE;
+	state.LineNumber = state.PreviosLine = 1;
+	state.Context = LC_CODE;
+	state.Level = -1;
+	return state;
+}
+
+/*
+** record lexer state at every line start passed from now on
+*/
+void Lexer2::SetCheckpoints( QVector< LexerCheckpoint >* checkpoints )
 {
+	_checkpoints = checkpoints;
+}
+
+const LexerState& Lexer2::State() const
+{
+	return _state;
 }
 
 bool Lexer2::HasNext() const
@@ -36,8 +67,19 @@ bool Lexer2::NextIf( TokenType type )
 
 TokenType Lexer2::Next()
 {
+	if( ( _state.Context == LC_LONG_COMMENT || _state.Context == LC_LONG_STRING ) && HasNext() ) {
+		/* resumed inside a long bracket */
+		_state.Previos = _state.Current;
+		_state.PreviosLine = _state.LineNumber;
+		const bool comment = _state.Context == LC_LONG_COMMENT;
+		const bool closed = SkipMultiLineBody( _state.Level );
+		if( !comment )
+			return _state.Type = closed ? TT_STRING : TT_ERROR;
+	}
+
 	while( HasNext() ) {
 		_state.Previos = _state.Current;
+		_state.PreviosLine = _state.LineNumber;
 		switch ( _state.Current->unicode() ) {
 		case L'\n': case L'\r': {  /* line breaks */
 			SkipNewLine();
@@ -45,6 +87,9 @@ TokenType Lexer2::Next()
 		}
 		case L' ': case L'\f': case L'\t': case L'\v': {  /* spaces */
 			++_state.Current;
+			/* most runs are a single space between tokens */
+			if( HasNext() && _state.Current->unicode() <= L' ' )
+				_state.Current = LexerScan::SkipSpaces( _state.Current, _state.End );
 			break;
 		}
 		case L'-': {  /* '-' or '--' (comment) */
@@ -55,29 +100,24 @@ TokenType Lexer2::Next()
 			/* else is a comment */
 			++_state.Current;
 			if( !HasNext() ) {
-				return _state.Type = TT_END_OF_FILE;
+				break;
 			}
 
 			if( _state.Current->unicode() == L'[' ) {  /* long comment? */
 				int count = SkipMultiLineSeparator();
 				if( count >= 0 ) {
-					SkipMultiLineContent( count );  /* skip long comment */
+					SkipMultiLineContent( count, LC_LONG_COMMENT );  /* skip long comment */
 					break;
 				}
 			}
-			/* else short comment */
-			while( !CurrIsNewline() ) {
-				++_state.Current;  /* skip until end of line (or end of file) */
-				if( !HasNext() )
-					break;
-			}
-            SkipNewLine();
+			/* else short comment, skip until end of line (or end of file) */
+			_state.Current = LexerScan::FindLineEnd( _state.Current, _state.End );
 			break;
 		}
 		case L'[': {  /* long string or simply '[' */
 			int count = SkipMultiLineSeparator();
 			if( count >= 0 ) {
-				if( SkipMultiLineContent( count ) ) {
+				if( SkipMultiLineContent( count, LC_LONG_STRING ) ) {
 					return _state.Type = TT_STRING;
 				}
 				return _state.Type = TT_ERROR;
@@ -166,7 +206,8 @@ TokenType Lexer2::Next()
 		default: {
 			if( CurrentIsAlpha() ) {  /* identifier or reserved word? */
 				do {
-					++_state.Current;
+					/* ASCII part in bulk, other letters and digits one by one */
+					_state.Current = LexerScan::SkipIdentifier( _state.Current + 1, _state.End );
 					if( !HasNext() )
 						break;
 				} while( CurrentIsAlphaOrNumber() );
@@ -205,6 +246,7 @@ TokenType Lexer2::Next()
 	}
 
 	_state.Previos = _state.Current;
+	_state.PreviosLine = _state.LineNumber;
     return _state.Type = TT_END_OF_FILE;
 }
 
@@ -233,6 +275,16 @@ int Lexer2::CurrentPos() const
 	return _state.Current - _state.Begin;
 }
 
+int Lexer2::CurrentStart() const
+{
+	return _state.Previos - _state.Begin;
+}
+
+int Lexer2::CurrentStartLine() const
+{
+	return _state.PreviosLine;
+}
+
 /*
 ** skip a sequence '[=*[' or ']=*]' and return its number of '='s or
 ** -1 if sequence is malformed
@@ -248,16 +300,29 @@ int Lexer2::SkipMultiLineSeparator() {
 	return ( _state.Current->unicode() == bracket ) ? count : ( -count ) - 1;
 }
 
-bool Lexer2::SkipMultiLineContent( int count ) {
+bool Lexer2::SkipMultiLineContent( int count, LexerContext context ) {
+	_state.Context = context;
+	_state.Level = count;
+
 	++_state.Current;             /* skip 2nd `[' */
 	if( CurrIsNewline() )   /* string starts with a newline? */
 		SkipNewLine();      /* skip it */
 
+	return SkipMultiLineBody( count );
+}
+
+/*
+** skip long bracket content up to and including the closing bracket,
+** on end of source the state stays inside the long bracket
+*/
+bool Lexer2::SkipMultiLineBody( int count ) {
 	while( HasNext() ) {
 		switch( _state.Current->unicode() ) {
 		case L']': {
 			if( SkipMultiLineSeparator() == count ) {
 				++_state.Current;  /* skip 2nd `]' */
+				_state.Context = LC_CODE;
+				_state.Level = -1;
 				return true;
 			}
 			break;
@@ -267,7 +332,7 @@ bool Lexer2::SkipMultiLineContent( int count ) {
 			break;
 		}
         default:
-            ++_state.Current;
+			_state.Current = LexerScan::FindLongBracketStop( _state.Current + 1, _state.End );
         }
 	}
 
@@ -280,16 +345,39 @@ bool Lexer2::CurrIsNewline() const
 	return v == L'\r' || v == L'\n';
 }
 
+/*
+** "\r\n" is one line break, "\n" and "\r" alone are one as well
+*/
 void Lexer2::SkipNewLine()
 {
 	++_state.LineNumber;
+	if( _state.Current->unicode() == L'\r' && _state.Current + 1 != _state.End && _state.Current[ 1 ].unicode() == L'\n' )
+		++_state.Current;
 	++_state.Current;
+
+	if( _checkpoints ) {
+		LexerCheckpoint checkpoint;
+		checkpoint.Offset = _state.Current - _state.Begin;
+		checkpoint.Token = -1;
+		checkpoint.Context = _state.Context;
+		checkpoint.Level = _state.Level;
+		_checkpoints->append( checkpoint );
+	}
 }
 
 bool Lexer2::ReadString()
 {
 	const ushort quote = _state.Current->unicode();
 	++_state.Current;
+
+	_state.Context = LC_SHORT_STRING;
+	const bool closed = SkipString( quote );
+	_state.Context = LC_CODE;
+	return closed;
+}
+
+bool Lexer2::SkipString( ushort quote )
+{
 	while( HasNext() ) {
 		if( _state.Current->unicode() == quote ) {
 			++_state.Current;
@@ -318,7 +406,7 @@ bool Lexer2::ReadString()
 					return false;
 				break;
 			case L'\n': case L'\r':
-				SkipNewLine(); break; /* escape sequences */
+				SkipNewLine(); continue; /* escaped line break, already skipped */
 			case L'z': { /* zap following span of spaces */
 				++_state.Current; /* skip the 'z' */
 				while( HasNext() && _state.Current->isSpace() ) {
@@ -327,7 +415,7 @@ bool Lexer2::ReadString()
 					else
 						++_state.Current;
 				}
-				break; /* escape sequences */
+				continue; /* spaces already skipped */
 			}
 			default: {
 				if( !_state.Current->unicode() ) {
@@ -342,7 +430,7 @@ bool Lexer2::ReadString()
 			}// /* escape sequences */
 		}
 		default:
-			++_state.Current;
+			_state.Current = LexerScan::FindStringStop( _state.Current + 1, _state.End, quote );
 		}
 	}
 	return false;
@@ -420,44 +508,23 @@ void Lexer2::SkipNumber()
 
 bool Lexer2::CurrentIsAlpha() const
 {
-	return _state.Current->isLetter() || _state.Current->unicode() == L'_';
+	const ushort c = _state.Current->unicode();
+	if( c < 0x80 ) {
+		const ushort lower = c | 0x20;
+		return ( lower >= L'a' && lower <= L'z' ) || c == L'_';
+	}
+	return _state.Current->isLetter();
 }
 
 bool Lexer2::CurrentIsAlphaOrNumber() const
 {
-	return CurrentIsAlpha() || _state.Current->isDigit();
+	const ushort c = _state.Current->unicode();
+	if( c < 0x80 )
+		return CurrentIsAlpha() || ( c >= L'0' && c <= L'9' );
+	return _state.Current->isLetter() || _state.Current->isDigit();
 }
 
 TokenType Lexer2::CurrentKeyword() const
 {
-	static QMap< QString, TokenType > _keywords;
-	if( _keywords.isEmpty() ) {
-		_keywords.insert( "nil",		TT_NIL );
-		_keywords.insert( "true",		TT_TRUE );
-		_keywords.insert( "false",		TT_FALSE );
-
-		_keywords.insert( "not",		TT_NOT );
-		_keywords.insert( "and",		TT_AND );
-		_keywords.insert( "or",			TT_OR );
-
-		_keywords.insert( "local",		TT_LOCAL );
-		_keywords.insert( "function",	TT_FUNCTION );
-
-		_keywords.insert( "do",			TT_DO );
-		_keywords.insert( "while",		TT_WHILE );
-		_keywords.insert( "repeat",		TT_REPEAT );
-		_keywords.insert( "until",		TT_UNTIL );
-		_keywords.insert( "if",			TT_IF );
-		_keywords.insert( "then",		TT_THEN );
-		_keywords.insert( "elseif",		TT_ELSEIF );
-		_keywords.insert( "else",		TT_ELSE );
-		_keywords.insert( "for",		TT_FOR );
-		_keywords.insert( "in",			TT_IN );
-
-		_keywords.insert( "return",		TT_RETURN );
-		_keywords.insert( "break",		TT_BREAK );
-		_keywords.insert( "end",		TT_END );
-	}
-
-	return _keywords.value( CurrentString(), TT_ERROR );
+	return LuaKeywords::Find( _state.Previos, _state.Current - _state.Previos );
 }
@@ -2,6 +2,7 @@
 #define LEXER_2_H
 
 #include <QString>
+#include <QVector>
 
 #include "Data/LexerState.h"
 
@@ -12,6 +13,11 @@ public:
 	explicit Lexer2	( const QString* source );
 	explicit Lexer2	( const LexerState& state );
 
+	static LexerState	InitialState( const QString* source );
+
+	void			SetCheckpoints( QVector< LexerCheckpoint >* checkpoints );
+	const LexerState&	State() const;
+
 	bool            HasNext() const;
     bool            NextIf( TokenType type );
 	TokenType       Next();
@@ -22,15 +28,19 @@ public:
 	TokenType       CurrentType() const;
 	int             CurrentLine() const;
 	int             CurrentPos() const;
+	int             CurrentStart() const;
+	int             CurrentStartLine() const;
 
 private:
 	int				SkipMultiLineSeparator();
-	bool			SkipMultiLineContent( int count );
+	bool			SkipMultiLineContent( int count, LexerContext context );
+	bool			SkipMultiLineBody( int count );
 
 	bool			CurrIsNewline() const;
 	void			SkipNewLine();
 
 	bool			ReadString();
+	bool			SkipString( ushort quote );
 	bool			SkipDecimalEscapeSequence();
 	bool			SkipHexEscapeSequence();
 
@@ -42,6 +52,8 @@ private:
 
 private:
 	LexerState _state;
+
+	QVector< LexerCheckpoint >* _checkpoints;
 };
 
 #endif // LEXER_H
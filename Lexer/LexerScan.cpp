@@ -0,0 +1,155 @@
+#include "LexerScan.h"
+
+#ifdef LEXER_SCAN_SSE2
+#	include <emmintrin.h>
+#endif
+
+#if defined( LEXER_SCAN_AVX2 ) && defined( _MSC_VER ) && !defined( __clang__ )
+#	include <immintrin.h>
+#	include <intrin.h>
+#endif
+
+#include "LexerScanKernels.h"
+
+namespace {
+
+#ifdef LEXER_SCAN_SSE2
+struct Sse2Ops {
+	typedef __m128i Vector;
+	enum { VectorSize = 8 };
+
+	static Vector Load( const ushort* chars ) {
+		return _mm_loadu_si128( reinterpret_cast< const __m128i* >( chars ) );
+	}
+	static uint StopMask( Vector stops ) {
+		return uint( _mm_movemask_epi8( stops ) );
+	}
+
+	static Vector Eq( Vector chars, ushort c ) {
+		return _mm_cmpeq_epi16( chars, _mm_set1_epi16( short( c ) ) );
+	}
+	/* lo <= chars <= hi as unsigned 16 bit values */
+	static Vector InRange( Vector chars, ushort lo, ushort hi ) {
+		const __m128i shifted = _mm_sub_epi16( chars, _mm_set1_epi16( short( lo ) ) );
+		const __m128i over = _mm_subs_epu16( shifted, _mm_set1_epi16( short( hi - lo ) ) );
+		return _mm_cmpeq_epi16( over, _mm_setzero_si128() );
+	}
+	static Vector Not( Vector mask ) {
+		return _mm_xor_si128( mask, _mm_cmpeq_epi16( mask, mask ) );
+	}
+	static Vector Or( Vector a, Vector b ) {
+		return _mm_or_si128( a, b );
+	}
+	static Vector LowerCase( Vector chars ) {
+		return _mm_or_si128( chars, _mm_set1_epi16( 0x20 ) );
+	}
+};
+#endif
+
+const LexerScan::KernelTable ScalarKernels = KernelsOf< ScalarOps >();
+#ifdef LEXER_SCAN_SSE2
+const LexerScan::KernelTable Sse2Kernels = KernelsOf< Sse2Ops >();
+#endif
+
+LexerScan::InstructionSet DetectInstructionSet()
+{
+#if defined( LEXER_SCAN_AVX2 ) && defined( _MSC_VER ) && !defined( __clang__ )
+	// AVX2 bit of leaf 7 and YMM state saved by the OS
+	int info[ 4 ];
+	__cpuid( info, 0 );
+	if( info[ 0 ] >= 7 ) {
+		__cpuid( info, 1 );
+		const bool saved = ( info[ 2 ] & ( 1 << 27 ) ) && ( _xgetbv( 0 ) & 6 ) == 6;
+		__cpuidex( info, 7, 0 );
+		if( saved && ( info[ 1 ] & ( 1 << 5 ) ) )
+			return LexerScan::Avx2;
+	}
+#elif defined( LEXER_SCAN_AVX2 )
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports( "avx2" ) )
+		return LexerScan::Avx2;
+#endif
+
+#ifdef LEXER_SCAN_SSE2
+	return LexerScan::Sse2;
+#else
+	return LexerScan::Scalar;
+#endif
+}
+
+const LexerScan::KernelTable* KernelsFor( LexerScan::InstructionSet set )
+{
+	switch( set ) {
+#ifdef LEXER_SCAN_AVX2
+	case LexerScan::Avx2 :
+		return &LexerScan::Avx2Kernels;
+#endif
+#ifdef LEXER_SCAN_SSE2
+	case LexerScan::Sse2 :
+		return &Sse2Kernels;
+#endif
+	default:
+		return &ScalarKernels;
+	}
+}
+
+// scalar kernels until static initialization of this file picks the best
+LexerScan::InstructionSet current = LexerScan::Scalar;
+const LexerScan::KernelTable* kernels = &ScalarKernels;
+
+LexerScan::InstructionSet UseBest()
+{
+	const LexerScan::InstructionSet best = DetectInstructionSet();
+	current = best;
+	kernels = KernelsFor( best );
+	return best;
+}
+
+const LexerScan::InstructionSet supported = UseBest();
+
+} // namespace
+
+LexerScan::InstructionSet LexerScan::Supported()
+{
+	return supported;
+}
+
+LexerScan::InstructionSet LexerScan::Current()
+{
+	return current;
+}
+
+bool LexerScan::Use( InstructionSet set )
+{
+	if( set > supported )
+		return false;
+
+	current = set;
+	kernels = KernelsFor( set );
+	return true;
+}
+
+const QChar* LexerScan::SkipSpaces( const QChar* begin, const QChar* end )
+{
+	return kernels->SkipSpaces( begin, end );
+}
+
+const QChar* LexerScan::SkipIdentifier( const QChar* begin, const QChar* end )
+{
+	return kernels->SkipIdentifier( begin, end );
+}
+
+const QChar* LexerScan::FindLineEnd( const QChar* begin, const QChar* end )
+{
+	return kernels->FindLineEnd( begin, end );
+}
+
+const QChar* LexerScan::FindLongBracketStop( const QChar* begin, const QChar* end )
+{
+	return kernels->FindLongBracketStop( begin, end );
+}
+
+const QChar* LexerScan::FindStringStop( const QChar* begin, const QChar* end, ushort quote )
+{
+	return kernels->FindStringStop( begin, end, quote );
+}
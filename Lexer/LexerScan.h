@@ -0,0 +1,59 @@
+#ifndef LEXER_SCAN_H
+#define LEXER_SCAN_H
+
+#include <QChar>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || defined( _M_AMD64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#	define LEXER_SCAN_SSE2 1
+// AVX2 kernels are built anyway and chosen when the CPU has them
+#	define LEXER_SCAN_AVX2 1
+#endif
+
+/*
+** Bulk scanning kernels used by Lexer2 over the UTF-16 source buffer.
+** Every kernel returns a pointer to the first character in [begin, end)
+** that stops the scan, or end. With SSE2 the buffer is examined 8
+** characters at a time, with AVX2 16, otherwise a plain loop is used.
+** The instruction set is picked at run time, the best one the CPU has,
+** so a build for plain x86-64 still uses AVX2 where it can.
+**
+** Kernels that classify characters (spaces, identifier bodies) treat every
+** non-ASCII character as a stop, the caller continues with the QChar based
+** scalar path from there. Kernels that search for ASCII delimiters do not
+** care about non-ASCII text, UTF-16 code units of other characters never
+** compare equal to them.
+*/
+namespace LexerScan {
+
+enum InstructionSet {
+	Scalar,
+	Sse2,
+	Avx2
+};
+
+// best set of the CPU and the one kernels use now
+InstructionSet	Supported			();
+InstructionSet	Current				();
+
+// for benchmarks and tests, not while another thread lexes; false for a
+// set the CPU does not have
+bool			Use					( InstructionSet set );
+
+// ' ', '\t', '\f', '\v'
+const QChar* SkipSpaces			( const QChar* begin, const QChar* end );
+
+// [A-Za-z0-9_]
+const QChar* SkipIdentifier		( const QChar* begin, const QChar* end );
+
+// '\n' or '\r'
+const QChar* FindLineEnd		( const QChar* begin, const QChar* end );
+
+// ']', '\n' or '\r'
+const QChar* FindLongBracketStop( const QChar* begin, const QChar* end );
+
+// quote, '\\', '\n' or '\r'
+const QChar* FindStringStop		( const QChar* begin, const QChar* end, ushort quote );
+
+} // namespace LexerScan
+
+#endif // LEXER_SCAN_H
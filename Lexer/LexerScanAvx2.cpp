@@ -0,0 +1,65 @@
+#include "LexerScan.h"
+
+#ifdef LEXER_SCAN_AVX2
+
+/*
+** Everything defined from here on may use AVX2, whatever the build
+** targets; LexerScan.cpp calls it only on a CPU that has it. Headers of
+** other code are included above, so no inline function shared with other
+** files is compiled for AVX2.
+*/
+#if defined( __clang__ )
+#	pragma clang attribute push( __attribute__(( target( "avx2" ) )), apply_to = function )
+#elif defined( __GNUC__ )
+#	pragma GCC push_options
+#	pragma GCC target( "avx2" )
+#endif
+
+#include <immintrin.h>
+
+#include "LexerScanKernels.h"
+
+namespace {
+
+struct Avx2Ops {
+	typedef __m256i Vector;
+	enum { VectorSize = 16 };
+
+	static Vector Load( const ushort* chars ) {
+		return _mm256_loadu_si256( reinterpret_cast< const __m256i* >( chars ) );
+	}
+	static uint StopMask( Vector stops ) {
+		return uint( _mm256_movemask_epi8( stops ) );
+	}
+
+	static Vector Eq( Vector chars, ushort c ) {
+		return _mm256_cmpeq_epi16( chars, _mm256_set1_epi16( short( c ) ) );
+	}
+	/* lo <= chars <= hi as unsigned 16 bit values */
+	static Vector InRange( Vector chars, ushort lo, ushort hi ) {
+		const __m256i shifted = _mm256_sub_epi16( chars, _mm256_set1_epi16( short( lo ) ) );
+		const __m256i over = _mm256_subs_epu16( shifted, _mm256_set1_epi16( short( hi - lo ) ) );
+		return _mm256_cmpeq_epi16( over, _mm256_setzero_si256() );
+	}
+	static Vector Not( Vector mask ) {
+		return _mm256_xor_si256( mask, _mm256_cmpeq_epi16( mask, mask ) );
+	}
+	static Vector Or( Vector a, Vector b ) {
+		return _mm256_or_si256( a, b );
+	}
+	static Vector LowerCase( Vector chars ) {
+		return _mm256_or_si256( chars, _mm256_set1_epi16( 0x20 ) );
+	}
+};
+
+} // namespace
+
+const LexerScan::KernelTable LexerScan::Avx2Kernels = KernelsOf< Avx2Ops >();
+
+#if defined( __clang__ )
+#	pragma clang attribute pop
+#elif defined( __GNUC__ )
+#	pragma GCC pop_options
+#endif
+
+#endif // LEXER_SCAN_AVX2
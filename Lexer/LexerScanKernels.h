@@ -0,0 +1,198 @@
+#ifndef LEXER_SCAN_KERNELS_H
+#define LEXER_SCAN_KERNELS_H
+
+#include <QChar>
+
+#if defined( _MSC_VER ) && !defined( __clang__ )
+#	include <intrin.h>
+#endif
+
+namespace LexerScan {
+
+// kernels of one instruction set
+struct KernelTable {
+	const QChar* ( *SkipSpaces )			( const QChar* begin, const QChar* end );
+	const QChar* ( *SkipIdentifier )		( const QChar* begin, const QChar* end );
+	const QChar* ( *FindLineEnd )			( const QChar* begin, const QChar* end );
+	const QChar* ( *FindLongBracketStop )	( const QChar* begin, const QChar* end );
+	const QChar* ( *FindStringStop )		( const QChar* begin, const QChar* end, ushort quote );
+};
+
+#ifdef LEXER_SCAN_AVX2
+// LexerScanAvx2.cpp, compiled for AVX2 whatever the build targets
+extern const KernelTable Avx2Kernels;
+#endif
+
+} // namespace LexerScan
+
+/*
+** Kernels for an instruction set Isa, a class with static functions over
+** its vector type:
+**
+**   Vector, VectorSize       register and UTF-16 code units in it
+**   Load, StopMask           unaligned load, one bit per byte of stops
+**   Eq, InRange, Not, Or, LowerCase
+**
+** ScalarOps stands for no vectors. Everything is in an anonymous namespace,
+** so each translation unit compiles its own copy for the instructions it
+** targets, a copy built for AVX2 never stands in for another one.
+*/
+namespace {
+
+struct ScalarOps {
+};
+
+/*
+** Each kernel describes its stop characters twice: as a vector mask
+** (Stops) and as a scalar predicate (IsStop) for the unaligned tail.
+*/
+struct SpacesKernel {
+	template< class Isa >
+	typename Isa::Vector Stops( typename Isa::Vector chars ) const {
+		return Isa::Not( Isa::Or( Isa::Or( Isa::Eq( chars, L' ' ), Isa::Eq( chars, L'\t' ) ),
+								  Isa::Or( Isa::Eq( chars, L'\f' ), Isa::Eq( chars, L'\v' ) ) ) );
+	}
+	bool IsStop( ushort c ) const {
+		return c != L' ' && c != L'\t' && c != L'\f' && c != L'\v';
+	}
+};
+
+struct IdentifierKernel {
+	template< class Isa >
+	typename Isa::Vector Stops( typename Isa::Vector chars ) const {
+		return Isa::Not( Isa::Or( Isa::Or( Isa::InRange( Isa::LowerCase( chars ), L'a', L'z' ),
+										   Isa::InRange( chars, L'0', L'9' ) ),
+								  Isa::Eq( chars, L'_' ) ) );
+	}
+	bool IsStop( ushort c ) const {
+		const ushort lower = c | 0x20;
+		return !( ( lower >= L'a' && lower <= L'z' ) || ( c >= L'0' && c <= L'9' ) || c == L'_' );
+	}
+};
+
+struct LineEndKernel {
+	template< class Isa >
+	typename Isa::Vector Stops( typename Isa::Vector chars ) const {
+		return Isa::Or( Isa::Eq( chars, L'\n' ), Isa::Eq( chars, L'\r' ) );
+	}
+	bool IsStop( ushort c ) const {
+		return c == L'\n' || c == L'\r';
+	}
+};
+
+struct LongBracketKernel {
+	template< class Isa >
+	typename Isa::Vector Stops( typename Isa::Vector chars ) const {
+		return Isa::Or( Isa::Eq( chars, L']' ), Isa::Or( Isa::Eq( chars, L'\n' ), Isa::Eq( chars, L'\r' ) ) );
+	}
+	bool IsStop( ushort c ) const {
+		return c == L']' || c == L'\n' || c == L'\r';
+	}
+};
+
+struct StringKernel {
+	ushort Quote;
+
+	template< class Isa >
+	typename Isa::Vector Stops( typename Isa::Vector chars ) const {
+		return Isa::Or( Isa::Or( Isa::Eq( chars, Quote ), Isa::Eq( chars, L'\\' ) ),
+						Isa::Or( Isa::Eq( chars, L'\n' ), Isa::Eq( chars, L'\r' ) ) );
+	}
+	bool IsStop( ushort c ) const {
+		return c == Quote || c == L'\\' || c == L'\n' || c == L'\r';
+	}
+};
+
+inline int TrailingZeros( uint mask )
+{
+#if defined( _MSC_VER ) && !defined( __clang__ )
+	unsigned long index;
+	_BitScanForward( &index, mask );
+	return int( index );
+#else
+	return __builtin_ctz( mask );
+#endif
+}
+
+/*
+** whole vectors up to the first one holding a stop, the stop is returned
+*/
+template< class Kernel >
+const ushort* SkipVectors( const ushort* current, const ushort* /*last*/, const Kernel& /*kernel*/, ScalarOps )
+{
+	return current;
+}
+
+template< class Kernel, class Isa >
+const ushort* SkipVectors( const ushort* current, const ushort* last, const Kernel& kernel, Isa )
+{
+	while( last - current >= Isa::VectorSize ) {
+		const uint mask = Isa::StopMask( kernel.template Stops< Isa >( Isa::Load( current ) ) );
+		if( mask )
+			return current + ( TrailingZeros( mask ) >> 1 );
+		current += Isa::VectorSize;
+	}
+	return current;
+}
+
+template< class Isa, class Kernel >
+const QChar* Scan( const QChar* begin, const QChar* end, const Kernel& kernel )
+{
+	const ushort* const last = reinterpret_cast< const ushort* >( end );
+	const ushort* current = SkipVectors( reinterpret_cast< const ushort* >( begin ), last, kernel, Isa() );
+
+	while( current < last && !kernel.IsStop( *current ) )
+		++current;
+
+	return reinterpret_cast< const QChar* >( current );
+}
+
+template< class Isa >
+const QChar* SkipSpaces( const QChar* begin, const QChar* end )
+{
+	return Scan< Isa >( begin, end, SpacesKernel() );
+}
+
+template< class Isa >
+const QChar* SkipIdentifier( const QChar* begin, const QChar* end )
+{
+	return Scan< Isa >( begin, end, IdentifierKernel() );
+}
+
+template< class Isa >
+const QChar* FindLineEnd( const QChar* begin, const QChar* end )
+{
+	return Scan< Isa >( begin, end, LineEndKernel() );
+}
+
+template< class Isa >
+const QChar* FindLongBracketStop( const QChar* begin, const QChar* end )
+{
+	return Scan< Isa >( begin, end, LongBracketKernel() );
+}
+
+template< class Isa >
+const QChar* FindStringStop( const QChar* begin, const QChar* end, ushort quote )
+{
+	const StringKernel kernel = { quote };
+	return Scan< Isa >( begin, end, kernel );
+}
+
+/*
+** constant, tables are ready before any dynamic initialization
+*/
+template< class Isa >
+constexpr LexerScan::KernelTable KernelsOf()
+{
+	return {
+		&SkipSpaces< Isa >,
+		&SkipIdentifier< Isa >,
+		&FindLineEnd< Isa >,
+		&FindLongBracketStop< Isa >,
+		&FindStringStop< Isa >
+	};
+}
+
+} // namespace
+
+#endif // LEXER_SCAN_KERNELS_H
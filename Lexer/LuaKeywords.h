@@ -0,0 +1,117 @@
+#ifndef LUA_KEYWORDS_H
+#define LUA_KEYWORDS_H
+
+#include <QChar>
+
+#include "Data/TokenType.h"
+
+/*
+** Reserved words of Lua, recognized with a perfect hash over the length,
+** the first and the last character of an identifier. The table is built
+** at compile time and the absence of collisions is checked by static_assert,
+** so a lookup is one hash, one table load and at most one short compare.
+*/
+namespace LuaKeywords {
+
+struct Keyword {
+	const char*	Text;
+	int			Size;
+	TokenType	Type;
+};
+
+constexpr Keyword List[] = {
+	{ "and",		3, TT_AND },
+	{ "break",		5, TT_BREAK },
+	{ "do",			2, TT_DO },
+	{ "else",		4, TT_ELSE },
+	{ "elseif",		6, TT_ELSEIF },
+	{ "end",		3, TT_END },
+	{ "false",		5, TT_FALSE },
+	{ "for",		3, TT_FOR },
+	{ "function",	8, TT_FUNCTION },
+	{ "if",			2, TT_IF },
+	{ "in",			2, TT_IN },
+	{ "local",		5, TT_LOCAL },
+	{ "nil",		3, TT_NIL },
+	{ "not",		3, TT_NOT },
+	{ "or",			2, TT_OR },
+	{ "repeat",		6, TT_REPEAT },
+	{ "return",		6, TT_RETURN },
+	{ "then",		4, TT_THEN },
+	{ "true",		4, TT_TRUE },
+	{ "until",		5, TT_UNTIL },
+	{ "while",		5, TT_WHILE },
+};
+
+enum {
+	Count		= sizeof( List ) / sizeof( List[ 0 ] ),
+	TableSize	= 64,
+	MinSize		= 2,
+	MaxSize		= 8
+};
+
+constexpr unsigned Hash( int size, ushort first, ushort last )
+{
+	return ( size + first * 3u + last * 13u ) & ( TableSize - 1 );
+}
+
+struct Table {
+	signed char Slots[ TableSize ];
+};
+
+constexpr Table BuildTable()
+{
+	Table table {};
+	for( int i = 0; i < TableSize; ++i )
+		table.Slots[ i ] = -1;
+
+	for( int i = 0; i < Count; ++i ) {
+		const Keyword& keyword = List[ i ];
+		const unsigned slot = Hash( keyword.Size, keyword.Text[ 0 ], keyword.Text[ keyword.Size - 1 ] );
+		table.Slots[ slot ] = static_cast< signed char >( i );
+	}
+	return table;
+}
+
+constexpr bool IsPerfect()
+{
+	const Table table = BuildTable();
+	int used = 0;
+	for( int i = 0; i < TableSize; ++i ) {
+		if( table.Slots[ i ] >= 0 )
+			++used;
+	}
+	return used == Count;
+}
+
+static_assert( IsPerfect(), "Lua keyword hash has collisions, choose other multipliers" );
+
+constexpr Table Slots = BuildTable();
+
+/*
+** returns token type of reserved word in [begin, begin + size) or TT_ERROR
+** if the range is an ordinary identifier
+*/
+inline TokenType Find( const QChar* begin, int size )
+{
+	if( size < MinSize || size > MaxSize )
+		return TT_ERROR;
+
+	const int index = Slots.Slots[ Hash( size, begin[ 0 ].unicode(), begin[ size - 1 ].unicode() ) ];
+	if( index < 0 )
+		return TT_ERROR;
+
+	const Keyword& keyword = List[ index ];
+	if( keyword.Size != size )
+		return TT_ERROR;
+
+	for( int i = 0; i < size; ++i ) {
+		if( begin[ i ].unicode() != static_cast< ushort >( keyword.Text[ i ] ) )
+			return TT_ERROR;
+	}
+	return keyword.Type;
+}
+
+} // namespace LuaKeywords
+
+#endif // LUA_KEYWORDS_H
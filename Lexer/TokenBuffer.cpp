@@ -0,0 +1,610 @@
+#include "TokenBuffer.h"
+
+#include "Lexer2.h"
+
+static_assert( sizeof( quint8 ) + sizeof( quint32 ) + sizeof( quint16 ) + sizeof( quint32 ) <= 12,
+			   "token should take 12 bytes or less" );
+
+namespace {
+
+/* unused slots added besides the missing ones when a gap is too small */
+enum { GapSlack = 256 };
+
+/*
+** Replace [first, first + removed) of vector by items, the gap of given
+** size must start right after the removed items. Removed slots join the
+** gap and items are written at its start; only a gap too small for them
+** moves the tail, and then it grows by a part of the vector, so that
+** happens rarely. Returns the size of the gap left behind the items.
+*/
+template< class T >
+int FillGap( QVector< T >& vector, int first, int removed, int gap, const QVector< T >& items )
+{
+	const int inserted = items.size();
+	int free = gap + removed;
+	if( inserted > free ) {
+		const int grow = inserted - free + GapSlack + vector.size() / 16;
+		vector.insert( first, grow, T() );
+		free += grow;
+	}
+
+	for( int i = 0; i < inserted; ++i )
+		vector[ first + i ] = items[ i ];
+	return free - inserted;
+}
+
+bool IsResumable( const LexerCheckpoint& checkpoint )
+{
+	return checkpoint.Context == LC_CODE || checkpoint.Context == LC_LONG_COMMENT;
+}
+
+} // namespace
+
+TokenBuffer::TokenBuffer() :
+	_shiftIndex( 0 ),
+	_shiftOffset( 0 ),
+	_shiftLine( 0 ),
+	_tokenGap( 0 ),
+
+	_lineShiftIndex( 0 ),
+	_lineShiftOffset( 0 ),
+	_lineShiftToken( 0 ),
+	_lineGap( 0 )
+{
+}
+
+TokenBuffer::TokenBuffer( const QString& source ) :
+	TokenBuffer()
+{
+	Lex( source );
+}
+
+void TokenBuffer::Lex( const QString& source )
+{
+	Clear();
+
+	// Lua sources average about five characters per token
+	const int expected = source.size() / 5 + 1;
+	_types.reserve( expected );
+	_offsets.reserve( expected );
+	_lengths.reserve( expected );
+	_lines.reserve( expected );
+
+	LexerState state = Lexer2::InitialState( &source );
+
+	LexerCheckpoint first;
+	first.Offset = 0;
+	first.Token = 0;
+	first.Context = state.Context;
+	first.Level = state.Level;
+	_checkpoints.append( first );
+
+	Lexer2 lexer( state );
+	lexer.SetCheckpoints( &_checkpoints );
+	lexer.Next();
+	forever {
+		FillCheckpointTokens();
+
+		const int start = lexer.CurrentStart();
+		Append( lexer.CurrentType(), start, lexer.CurrentPos() - start, lexer.CurrentStartLine() );
+		if( lexer.CurrentType() == TT_END_OF_FILE )
+			break;
+		lexer.Next();
+	}
+
+	_shiftIndex = _types.size();
+	_lineShiftIndex = _checkpoints.size();
+}
+
+/*
+** tokens of a source whose lines are given, the lines of
+** QTextDocument::toPlainText, so offsets come out as Lex gives them
+*/
+void TokenBuffer::Assign( const QVector< LineTokens >& lines )
+{
+	Clear();
+
+	int expected = 1;
+	for( const LineTokens& line : lines )
+		expected += line.Tokens.size();
+	_types.reserve( expected );
+	_offsets.reserve( expected );
+	_lengths.reserve( expected );
+	_lines.reserve( expected );
+	_checkpoints.reserve( lines.size() );
+
+	// the last line has no line break
+	const int end = qMax( 0, AppendLines( lines, 0, 0, 0, true ) - 1 );
+	Append( TT_END_OF_FILE, end, 0, qMax( 1, lines.size() ) );
+
+	_shiftIndex = _types.size();
+	_lineShiftIndex = _checkpoints.size();
+}
+
+/*
+** Lines are those of the text after an edit that replace removedLines
+** lines from firstLine on; the first of them and the line behind them
+** start in the same state as before, not inside a string. Their tokens
+** are taken as the highlighter lexed them, the rest is only shifted.
+** Tokens ending before position, where the edit starts, come out the
+** same and are left out of the reported change.
+*/
+TokenDelta TokenBuffer::Replace( const QVector< LineTokens >& lines, int firstLine, int removedLines, int position )
+{
+	const LexerCheckpoint start = Checkpoint( firstLine );
+	const int endLine = firstLine + removedLines;
+	const bool toEnd = endLine >= LineCount();
+
+	TokenBuffer replaced;
+	const int end = replaced.AppendLines( lines, start.Offset, firstLine, start.Token, toEnd );
+
+	const int first = start.Token;
+	const int old = toEnd ? Count() - 1 : Checkpoint( endLine ).Token;
+	const int oldEnd = toEnd ? Offset( Count() - 1 ) + 1 : Checkpoint( endLine ).Offset;
+	const int delta = end - oldEnd;
+	const int lineDelta = lines.size() - removedLines;
+	const int removedTokens = old - first;
+	const int insertedTokens = replaced.Count();
+
+	// the first line is taken whole, its tokens in front of the edit are
+	// the old ones
+	int same = 0;
+	while( same < insertedTokens && same < removedTokens
+		   && replaced.End( same ) <= position
+		   && replaced._types[ same ] == _types[ TokenSlot( first + same ) ]
+		   && replaced.Offset( same ) == Offset( first + same )
+		   && replaced._lengths[ same ] != 0xFFFF && replaced._lengths[ same ] == _lengths[ TokenSlot( first + same ) ] )
+		++same;
+	const int changeOffset = Offset( first + same );
+
+	// tokens
+	MoveTokenShift( old );
+	FillGap( _types, first, removedTokens, _tokenGap, replaced._types );
+	FillGap( _offsets, first, removedTokens, _tokenGap, replaced._offsets );
+	FillGap( _lengths, first, removedTokens, _tokenGap, replaced._lengths );
+	_tokenGap = FillGap( _lines, first, removedTokens, _tokenGap, replaced._lines );
+	_shiftIndex = first + insertedTokens;
+	_shiftOffset += delta;
+	_shiftLine += lineDelta;
+
+	if( !_longLengths.isEmpty() || !replaced._longLengths.isEmpty() ) {
+		QHash< int, int > moved;
+		for( QHash< int, int >::const_iterator i = replaced._longLengths.constBegin(); i != replaced._longLengths.constEnd(); ++i )
+			moved.insert( first + i.key(), i.value() );
+		for( QHash< int, int >::const_iterator i = _longLengths.constBegin(); i != _longLengths.constEnd(); ++i ) {
+			if( i.key() < first )
+				moved.insert( i.key(), i.value() );
+			else if( i.key() >= old )
+				moved.insert( i.key() - removedTokens + insertedTokens, i.value() );
+		}
+		_longLengths = moved;
+	}
+
+	// line checkpoints
+	MoveLineShift( endLine );
+	_lineGap = FillGap( _checkpoints, firstLine, endLine - firstLine, _lineGap, replaced._checkpoints );
+	_lineShiftIndex = firstLine + lines.size();
+	_lineShiftOffset += delta;
+	_lineShiftToken += insertedTokens - removedTokens;
+
+	TokenDelta result;
+	result.First = first + same;
+	result.Removed = removedTokens - same;
+	result.Inserted = insertedTokens - same;
+	result.Offset = changeOffset;
+	return result;
+}
+
+/*
+** source is the text after replacing removed characters at position by
+** added ones, the buffer must describe the text before that edit
+*/
+TokenDelta TokenBuffer::Update( const QString& source, int position, int removed, int added )
+{
+	const int delta = added - removed;
+
+	// an edit right at a line start may join "\r" before it with "\n"
+	const int line = ResumeLine( position - 1 );
+	const LexerCheckpoint resume = Checkpoint( line );
+
+	LexerState state = Lexer2::InitialState( &source );
+	state.Current = state.Previos = state.Begin + resume.Offset;
+	state.LineNumber = state.PreviosLine = line + 1;
+	state.Context = resume.Context;
+	state.Level = resume.Level;
+
+	QVector< LexerCheckpoint > lines;
+	Lexer2 lexer( state );
+	lexer.SetCheckpoints( &lines );
+	lexer.Next();
+
+	QVector< quint8 > types;
+	QVector< quint32 > offsets;
+	QVector< quint16 > lengths;
+	QVector< quint32 > tokenLines;
+	QHash< int, int > longLengths;
+
+	// old token the new stream may fall in step with
+	int old = FirstTokenFrom( position + removed );
+	int filledLines = 0;
+	forever {
+		for( ; filledLines < lines.size(); ++filledLines )
+			lines[ filledLines ].Token = resume.Token + types.size();
+
+		const int start = lexer.CurrentStart();
+		if( start >= position + added ) {
+			// from here on text is the same as in old source, same start means same tokens
+			const int target = start - delta;
+			while( Offset( old ) < target )
+				++old;
+			if( Offset( old ) == target && Type( old ) == lexer.CurrentType() )
+				break;
+		}
+
+		const int length = lexer.CurrentPos() - start;
+		if( length >= 0xFFFF )
+			longLengths.insert( resume.Token + types.size(), length );
+		types.append( static_cast< quint8 >( lexer.CurrentType() ) );
+		offsets.append( start );
+		lengths.append( static_cast< quint16 >( qMin( length, 0xFFFF ) ) );
+		tokenLines.append( lexer.CurrentStartLine() );
+
+		if( lexer.CurrentType() == TT_END_OF_FILE ) {
+			// can not get here, end of file tokens are always in step
+			old = Count();
+			break;
+		}
+		lexer.Next();
+	}
+
+	const int first = resume.Token;
+	const int removedTokens = old - first;
+	const int insertedTokens = types.size();
+	const int syncOffset = old < Count() ? Offset( old ) : Offset( Count() - 1 ) + delta;
+	const int lineDelta = old < Count() ? lexer.CurrentStartLine() - Line( old ) : 0;
+
+	// lexing resumes at a line start, tokens ending before the edit come out
+	// the same and are left out of the reported change
+	int same = 0;
+	while( same < insertedTokens && same < removedTokens
+		   && int( offsets[ same ] + lengths[ same ] ) <= position
+		   && types[ same ] == _types[ TokenSlot( first + same ) ]
+		   && int( offsets[ same ] ) == Offset( first + same )
+		   && lengths[ same ] != 0xFFFF && lengths[ same ] == _lengths[ TokenSlot( first + same ) ] )
+		++same;
+	const int changeOffset = Offset( first + same );
+
+	// tokens
+	MoveTokenShift( old );
+	FillGap( _types, first, removedTokens, _tokenGap, types );
+	FillGap( _offsets, first, removedTokens, _tokenGap, offsets );
+	FillGap( _lengths, first, removedTokens, _tokenGap, lengths );
+	_tokenGap = FillGap( _lines, first, removedTokens, _tokenGap, tokenLines );
+	_shiftIndex = first + insertedTokens;
+	_shiftOffset += delta;
+	_shiftLine += lineDelta;
+
+	if( !_longLengths.isEmpty() || !longLengths.isEmpty() ) {
+		QHash< int, int > moved = longLengths;
+		for( QHash< int, int >::const_iterator i = _longLengths.constBegin(); i != _longLengths.constEnd(); ++i ) {
+			if( i.key() < first )
+				moved.insert( i.key(), i.value() );
+			else if( i.key() >= old )
+				moved.insert( i.key() - removedTokens + insertedTokens, i.value() );
+		}
+		_longLengths = moved;
+	}
+
+	// line checkpoints, only lines starting before the synchronized token are new
+	int newLines = 0;
+	while( newLines < lines.size() && lines[ newLines ].Offset <= syncOffset + delta )
+		++newLines;
+	lines.resize( newLines );
+
+	int oldLines = line + 1;
+	while( oldLines < LineCount() && Checkpoint( oldLines ).Offset <= syncOffset )
+		++oldLines;
+
+	MoveLineShift( oldLines );
+	_lineGap = FillGap( _checkpoints, line + 1, oldLines - line - 1, _lineGap, lines );
+	_lineShiftIndex = line + 1 + newLines;
+	_lineShiftOffset += delta;
+	_lineShiftToken += insertedTokens - removedTokens;
+
+	TokenDelta result;
+	result.First = first + same;
+	result.Removed = removedTokens - same;
+	result.Inserted = insertedTokens - same;
+	result.Offset = changeOffset;
+	return result;
+}
+
+void TokenBuffer::Clear()
+{
+	_types.clear();
+	_offsets.clear();
+	_lengths.clear();
+	_lines.clear();
+	_longLengths.clear();
+	_checkpoints.clear();
+
+	_shiftIndex = _shiftOffset = _shiftLine = _tokenGap = 0;
+	_lineShiftIndex = _lineShiftOffset = _lineShiftToken = _lineGap = 0;
+}
+
+int TokenBuffer::LineCount() const
+{
+	return _checkpoints.size() - _lineGap;
+}
+
+/*
+** lexer state at start of line, lines are counted from 0 here
+*/
+LexerCheckpoint TokenBuffer::Checkpoint( int line ) const
+{
+	LexerCheckpoint checkpoint = _checkpoints[ LineSlot( line ) ];
+	if( line >= _lineShiftIndex ) {
+		checkpoint.Offset += _lineShiftOffset;
+		checkpoint.Token += _lineShiftToken;
+	}
+	return checkpoint;
+}
+
+/*
+** line holding source offset, counted from 0 like checkpoints, line
+** break belongs to the line it ends
+*/
+int TokenBuffer::LineAt( int offset ) const
+{
+	int low = 0;
+	int high = LineCount() - 1;
+	while( low < high ) {
+		const int middle = ( low + high + 1 ) / 2;
+		if( Checkpoint( middle ).Offset <= offset )
+			low = middle;
+		else
+			high = middle - 1;
+	}
+	return low;
+}
+
+int TokenBuffer::LineStart( int line ) const
+{
+	return Checkpoint( line ).Offset;
+}
+
+/*
+** characters between line start and source offset
+*/
+int TokenBuffer::Column( int offset ) const
+{
+	return offset - LineStart( LineAt( offset ) );
+}
+
+int TokenBuffer::MemoryUsage() const
+{
+	return _types.capacity() * sizeof( quint8 )
+			+ _offsets.capacity() * sizeof( quint32 )
+			+ _lengths.capacity() * sizeof( quint16 )
+			+ _lines.capacity() * sizeof( quint32 )
+			+ _longLengths.size() * 2 * sizeof( int )
+			+ _checkpoints.capacity() * sizeof( LexerCheckpoint );
+}
+
+int TokenBuffer::BytesPerToken()
+{
+	return sizeof( quint8 ) + sizeof( quint32 ) + sizeof( quint16 ) + sizeof( quint32 );
+}
+
+/*
+** only while a buffer is built, there is no gap then
+*/
+void TokenBuffer::Append( TokenType type, int offset, int length, int line )
+{
+	if( length >= 0xFFFF )
+		_longLengths.insert( _types.size(), length );
+
+	_types.append( static_cast< quint8 >( type ) );
+	_offsets.append( offset );
+	_lengths.append( static_cast< quint16 >( qMin( length, 0xFFFF ) ) );
+	_lines.append( line );
+}
+
+void TokenBuffer::SetLength( int index, int length )
+{
+	if( length >= 0xFFFF )
+		_longLengths.insert( index, length );
+	else
+		_longLengths.remove( index );
+	_lengths[ index ] = static_cast< quint16 >( qMin( length, 0xFFFF ) );
+}
+
+/*
+** Tokens of lines starting at source offset, numbered from line + 1 and
+** counted in checkpoints from token on. A long string open through the
+** last line runs up to the end of text if the lines are the last ones,
+** otherwise none may be open there. Returns where the lines end.
+*/
+int TokenBuffer::AppendLines( const QVector< LineTokens >& lines, int offset, int line, int token, bool last )
+{
+	// long string token going on from an earlier line, -1 if none
+	int open = -1;
+	for( int i = 0; i < lines.size(); ++i ) {
+		const LineTokens& tokens = lines[ i ];
+
+		LexerCheckpoint checkpoint;
+		checkpoint.Offset = offset;
+		checkpoint.Token = token + ( open >= 0 ? open : Count() );
+		checkpoint.Context = tokens.Context;
+		checkpoint.Level = tokens.Level;
+		_checkpoints.append( checkpoint );
+
+		int first = 0;
+		if( open >= 0 && !tokens.Tokens.isEmpty() ) {
+			// the piece the line starts with ends the token or goes on
+			const LineToken& piece = tokens.Tokens.first();
+			_types[ open ] = static_cast< quint8 >( piece.Type );
+			SetLength( open, offset + piece.Offset + piece.Length - Offset( open ) );
+			first = 1;
+		}
+
+		for( int j = first; j < tokens.Tokens.size(); ++j ) {
+			const LineToken& piece = tokens.Tokens[ j ];
+			Append( static_cast< TokenType >( piece.Type ), offset + piece.Offset, piece.Length, line + i + 1 );
+		}
+
+		// a string going on is the last token so far, opened here or before;
+		// one open through the last line runs up to the end of text
+		bool goesOn = false;
+		if( i + 1 < lines.size() )
+			goesOn = lines[ i + 1 ].Context == LC_LONG_STRING;
+		else if( last && open >= 0 )
+			goesOn = tokens.Tokens.isEmpty() || tokens.Tokens.first().Type == TT_ERROR;
+		open = goesOn ? Count() - 1 : -1;
+		offset += tokens.Length;
+	}
+
+	if( open >= 0 )
+		SetLength( open, qMax( 0, offset - 1 ) - Offset( open ) );
+	return offset;
+}
+
+/*
+** lines passed by the lexer while reading a token start before it ends
+*/
+void TokenBuffer::FillCheckpointTokens()
+{
+	for( int i = _checkpoints.size() - 1; i >= 0 && _checkpoints[ i ].Token < 0; --i )
+		_checkpoints[ i ].Token = _types.size();
+}
+
+/*
+** last line starting at or before position whose start is not inside a token
+*/
+int TokenBuffer::ResumeLine( int position ) const
+{
+	int low = LineAt( position );
+	while( low > 0 && !IsResumable( Checkpoint( low ) ) )
+		--low;
+	return low;
+}
+
+/*
+** first token with offset not less than given one, end of file token at most
+*/
+int TokenBuffer::FirstTokenFrom( int offset ) const
+{
+	int low = 0;
+	int high = Count() - 1;
+	while( low < high ) {
+		const int middle = ( low + high ) / 2;
+		if( Offset( middle ) < offset )
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+/*
+** moves the shift border and the gap to index, values passing the border
+** take the pending shift on or drop it
+*/
+void TokenBuffer::MoveTokenShift( int index )
+{
+	if( _tokenGap == 0 && _shiftOffset == 0 && _shiftLine == 0 ) {
+		_shiftIndex = index;
+		return;
+	}
+
+	const int gap = _tokenGap;
+	for( int i = _shiftIndex; i < index; ++i ) {
+		_types[ i ] = _types[ i + gap ];
+		_offsets[ i ] = _offsets[ i + gap ] + _shiftOffset;
+		_lengths[ i ] = _lengths[ i + gap ];
+		_lines[ i ] = _lines[ i + gap ] + _shiftLine;
+	}
+	for( int i = _shiftIndex - 1; i >= index; --i ) {
+		_types[ i + gap ] = _types[ i ];
+		_offsets[ i + gap ] = _offsets[ i ] - _shiftOffset;
+		_lengths[ i + gap ] = _lengths[ i ];
+		_lines[ i + gap ] = _lines[ i ] - _shiftLine;
+	}
+	_shiftIndex = index;
+}
+
+void TokenBuffer::MoveLineShift( int index )
+{
+	if( _lineGap == 0 && _lineShiftOffset == 0 && _lineShiftToken == 0 ) {
+		_lineShiftIndex = index;
+		return;
+	}
+
+	const int gap = _lineGap;
+	for( int i = _lineShiftIndex; i < index; ++i ) {
+		_checkpoints[ i ] = _checkpoints[ i + gap ];
+		_checkpoints[ i ].Offset += _lineShiftOffset;
+		_checkpoints[ i ].Token += _lineShiftToken;
+	}
+	for( int i = _lineShiftIndex - 1; i >= index; --i ) {
+		_checkpoints[ i + gap ] = _checkpoints[ i ];
+		_checkpoints[ i + gap ].Offset -= _lineShiftOffset;
+		_checkpoints[ i + gap ].Token -= _lineShiftToken;
+	}
+	_lineShiftIndex = index;
+}
+
+TokenCursor::TokenCursor() :
+	_tokens( nullptr ),
+	_source( nullptr ),
+
+	_index( 0 ),
+	_type( TT_END_OF_FILE )
+{
+}
+
+TokenCursor::TokenCursor( const TokenBuffer* tokens, const QString* source ) :
+	_tokens( tokens ),
+	_source( source ),
+
+	_index( 0 ),
+	_type( tokens->Count() ? tokens->Type( 0 ) : TT_END_OF_FILE )
+{
+}
+
+TokenType TokenCursor::Peek( int ahead ) const
+{
+	const int index = qMin( _index + ahead, _tokens->Count() - 1 );
+	return _tokens->Type( index );
+}
+
+const QString TokenCursor::CurrentString() const
+{
+	return QString::fromRawData( _source->constData() + _tokens->Offset( _index ), _tokens->Length( _index ) );
+}
+
+int TokenCursor::CurrentLine() const
+{
+	return _tokens->Line( _index );
+}
+
+int TokenCursor::CurrentPos() const
+{
+	return _tokens->Offset( _index );
+}
+
+int TokenCursor::CurrentIndex() const
+{
+	return _index;
+}
+
+int TokenCursor::Mark() const
+{
+	return _index;
+}
+
+void TokenCursor::Rewind( int mark )
+{
+	_index = mark;
+	_type = _tokens->Type( _index );
+}
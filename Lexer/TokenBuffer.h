@@ -0,0 +1,216 @@
+#ifndef TOKEN_BUFFER_H
+#define TOKEN_BUFFER_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include "Data/LexerState.h"
+#include "Data/LineTokens.h"
+
+/*
+** Replacement of old tokens [First, First + Removed) by new tokens
+** [First, First + Inserted), tokens after the range are only shifted.
+** Offset is where old token First started in the old text.
+*/
+struct TokenDelta
+{
+	int First;
+	int Removed;
+	int Inserted;
+	int Offset;
+};
+
+/*
+** Tokens of a whole source produced in one lexing pass and stored as
+** structure of arrays: type, offset, length and line of token i live at
+** index i of separate vectors. The last token is always TT_END_OF_FILE.
+**
+** Lengths are kept in 16 bits, the rare longer tokens (huge long strings)
+** keep their real length in a side table.
+**
+** A lexer checkpoint is kept for every line start, so after an edit only
+** the tokens from the nearest checkpoint up to the point where the new
+** token stream falls in step with the old one are lexed again. The same
+** checkpoints turn source positions into lines and columns. Offsets and
+** lines of the tokens behind an edit are shifted lazily: values from
+** _shiftIndex on are stored without the pending shift, moving that border
+** costs the distance between two consecutive edits. The vectors keep a gap
+** of unused slots at the same border, tokens behind it are stored
+** _tokenGap slots further on, so an edit does not move the tail of the
+** file either. Checkpoints have their own border and gap.
+**
+** Assign builds the same buffer from tokens the highlighter has lexed line
+** by line, pieces of long strings are joined back into one token. Replace
+** takes such lines for an edit in place of lexing them once more.
+*/
+class TokenBuffer
+{
+public:
+	TokenBuffer();
+	explicit TokenBuffer( const QString& source );
+
+	void		Lex( const QString& source );
+	void		Assign( const QVector< LineTokens >& lines );
+	TokenDelta	Update( const QString& source, int position, int removed, int added );
+	TokenDelta	Replace( const QVector< LineTokens >& lines, int firstLine, int removedLines, int position );
+	void		Clear();
+
+	int			Count() const;
+
+	TokenType	Type( int index ) const;
+	int			Offset( int index ) const;
+	int			Length( int index ) const;
+	int			End( int index ) const;
+	int			Line( int index ) const;
+
+	int			LineCount() const;
+	LexerCheckpoint	Checkpoint( int line ) const;
+
+	int			LineAt( int offset ) const;
+	int			LineStart( int line ) const;
+	int			Column( int offset ) const;
+
+	int			MemoryUsage() const;
+	static int	BytesPerToken();
+
+private:
+	void		Append( TokenType type, int offset, int length, int line );
+	int			AppendLines( const QVector< LineTokens >& lines, int offset, int line, int token, bool last );
+	void		SetLength( int index, int length );
+	void		FillCheckpointTokens();
+
+	int			ResumeLine( int position ) const;
+	int			FirstTokenFrom( int offset ) const;
+
+	void		MoveTokenShift( int index );
+	void		MoveLineShift( int index );
+
+	int			TokenSlot( int index ) const;
+	int			LineSlot( int line ) const;
+
+private:
+	QVector< quint8 >	_types;
+	QVector< quint32 >	_offsets;
+	QVector< quint16 >	_lengths;
+	QVector< quint32 >	_lines;
+
+	QHash< int, int >	_longLengths;
+
+	int					_shiftIndex;
+	int					_shiftOffset;
+	int					_shiftLine;
+	int					_tokenGap;
+
+	QVector< LexerCheckpoint >	_checkpoints;
+
+	int					_lineShiftIndex;
+	int					_lineShiftOffset;
+	int					_lineShiftToken;
+	int					_lineGap;
+};
+
+/*
+** Read position in a TokenBuffer with the same interface the parser used
+** on Lexer2, plus lookahead and rollback by index.
+*/
+class TokenCursor
+{
+public:
+	TokenCursor();
+	TokenCursor( const TokenBuffer* tokens, const QString* source );
+
+	TokenType		Next();
+	bool			NextIf( TokenType type );
+
+	bool			Is( TokenType type ) const;
+	TokenType		Peek( int ahead = 1 ) const;
+
+	const QString	CurrentString() const;
+	TokenType		CurrentType() const;
+	int				CurrentLine() const;
+	int				CurrentPos() const;
+	int				CurrentIndex() const;
+
+	int				Mark() const;
+	void			Rewind( int mark );
+
+private:
+	const TokenBuffer*	_tokens;
+	const QString*		_source;
+
+	int					_index;
+	TokenType			_type;
+};
+
+inline int TokenBuffer::Count() const
+{
+	return _types.size() - _tokenGap;
+}
+
+inline TokenType TokenBuffer::Type( int index ) const
+{
+	return static_cast< TokenType >( static_cast< qint8 >( _types[ TokenSlot( index ) ] ) );
+}
+
+inline int TokenBuffer::Offset( int index ) const
+{
+	return index < _shiftIndex ? _offsets[ index ] : _offsets[ index + _tokenGap ] + _shiftOffset;
+}
+
+inline int TokenBuffer::Length( int index ) const
+{
+	const int length = _lengths[ TokenSlot( index ) ];
+	return length == 0xFFFF ? _longLengths.value( index ) : length;
+}
+
+inline int TokenBuffer::End( int index ) const
+{
+	return Offset( index ) + Length( index );
+}
+
+inline int TokenBuffer::Line( int index ) const
+{
+	return index < _shiftIndex ? _lines[ index ] : _lines[ index + _tokenGap ] + _shiftLine;
+}
+
+/*
+** where token index is stored, behind the gap from _shiftIndex on
+*/
+inline int TokenBuffer::TokenSlot( int index ) const
+{
+	return index < _shiftIndex ? index : index + _tokenGap;
+}
+
+inline int TokenBuffer::LineSlot( int line ) const
+{
+	return line < _lineShiftIndex ? line : line + _lineGap;
+}
+
+inline TokenType TokenCursor::Next()
+{
+	if( _index + 1 < _tokens->Count() )
+		++_index;
+	return _type = _tokens->Type( _index );
+}
+
+inline bool TokenCursor::NextIf( TokenType type )
+{
+	if( _type == type ) {
+		Next();
+		return true;
+	}
+	return false;
+}
+
+inline bool TokenCursor::Is( TokenType type ) const
+{
+	return _type == type;
+}
+
+inline TokenType TokenCursor::CurrentType() const
+{
+	return _type;
+}
+
+#endif // TOKEN_BUFFER_H
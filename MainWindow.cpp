@@ -1,4 +1,4 @@
-#include "mainwindow.h"
+#include "MainWindow.h"
 
 #include <QApplication>
 #include <QDebug>
@@ -7,19 +7,24 @@
 #include <QMenu>
 #include <QMenuBar>
 #include <QMessageBox>
+#include <QTextCursor>
 #include <QTextLayout>
 #include <QTreeView>
 #include <QVBoxLayout>
 
 #include "Editor.h"
 
+#include "Data/AstTree.h"
+#include "Data/StringInterner.h"
 #include "Model/CodeModel2.h"
-#include "Parser/AstParser2.h"
+#include "Model/ParseScheduler.h"
+#include "Parser/ScopeResolver.h"
 
 MainWindow::MainWindow( QWidget* parent )
 	: QMainWindow( parent )
 {
 	setupFileMenu();
+	setupNavigateMenu();
 	setupHelpMenu();
 	setupEditor();
 	setupOutline();
@@ -49,14 +54,56 @@ void MainWindow::openFile(const QString &path)
 	if( !fileName.isEmpty() ) {
 		QFile file( fileName );
 		if( file.open( QFile::ReadOnly | QFile::Text ) ) {
+			// outline is updated by ParseScheduler
 			editor->setPlainText( file.readAll() );
-
-			CodeModel2* model = qobject_cast< CodeModel2* >( treeView->model() );
-			model->RebuildModel( editor->toPlainText() );
 		}
 	}
 }
 
+/*
+** moves the cursor to the local the name under it refers to
+*/
+void MainWindow::goToDefinition()
+{
+	if( !tree )
+		return;
+
+	// cursor right behind a name is on it too
+	const int position = editor->textCursor().position();
+	int node = tree->NodeAt( position );
+	if( node == AstTree::NoNode || tree->Node( node ).Info.AstType != AstInfo::Name )
+		node = tree->NodeAt( position - 1 );
+	if( node == AstTree::NoNode || tree->Node( node ).Info.AstType != AstInfo::Name )
+		return;
+
+	// text may have been edited since the parse
+	const AstInfo& name = tree->Node( node ).Info;
+	if( name.Pos + name.Size >= editor->document()->characterCount() )
+		return;
+	QTextCursor span( editor->document() );
+	span.setPosition( name.Pos );
+	span.setPosition( name.Pos + name.Size, QTextCursor::KeepAnchor );
+	if( span.selectedText() != symbols->Text( name.Symbol ) )
+		return;
+
+	const int declaration = scopes->DeclarationOf( node );
+	if( declaration == ScopeResolver::NoDeclaration )
+		return;
+
+	// implicit 'self' is declared by the function body
+	QTextCursor cursor = editor->textCursor();
+	cursor.setPosition( tree->Node( scopes->DeclarationAt( declaration ).Node ).Info.Pos );
+	editor->setTextCursor( cursor );
+}
+
+void MainWindow::setScopes( const QSharedPointer< const AstTree >& newTree, const QSharedPointer< const ScopeResolver >& newScopes,
+							const QSharedPointer< const StringInterner >& newSymbols )
+{
+	tree = newTree;
+	scopes = newScopes;
+	symbols = newSymbols;
+}
+
 void MainWindow::setupEditor()
 {
 	QFont font;
@@ -69,6 +116,8 @@ void MainWindow::setupEditor()
 	editor->setStyleSheet( "QPlainTextEdit { color: #E0E2E4; background: #293134 }" );
 
 	highlighter = new Highlighter( editor->document() );
+	connect( editor, SIGNAL( visibleBlocksChanged(int,int) ),
+			 highlighter, SLOT( SetVisibleBlocks(int,int) ) );
 
 	QFile file("mainwindow.h");
 	if( file.open(QFile::ReadOnly | QFile::Text) )
@@ -99,6 +148,14 @@ void MainWindow::setupFileMenu()
 	fileMenu->addAction( tr( "E&xit" ), qApp, SLOT( quit() ),			QKeySequence::Quit );
 }
 
+void MainWindow::setupNavigateMenu()
+{
+	QMenu* navigateMenu = new QMenu( tr( "&Navigate" ), this );
+	menuBar()->addMenu( navigateMenu );
+
+	navigateMenu->addAction( tr( "Go to &Definition" ), this, SLOT( goToDefinition() ), QKeySequence( Qt::Key_F12 ) );
+}
+
 void MainWindow::setupHelpMenu()
 {
 	QMenu* helpMenu = new QMenu( tr( "&Help" ), this);
@@ -115,8 +172,16 @@ void MainWindow::setupOutline()
 
 	treeView = new QTreeView( this );
 	treeView->setHeaderHidden( true );
-	CodeModel2* model = new CodeModel2();
+	CodeModel2* model = new CodeModel2( this );
 	treeView->setModel( model );
 
 	dock->setWidget( treeView );
+
+	ParseScheduler* scheduler = new ParseScheduler( editor->document(), this );
+	scheduler->SetHighlighter( highlighter );
+	connect( scheduler, SIGNAL( TreeReady(QSharedPointer<const AstTree>) ),
+			 model, SLOT( SetTree(QSharedPointer<const AstTree>) ) );
+	connect( scheduler, SIGNAL( ScopesReady(QSharedPointer<const AstTree>,QSharedPointer<const ScopeResolver>,QSharedPointer<const StringInterner>) ),
+			 this, SLOT( setScopes(QSharedPointer<const AstTree>,QSharedPointer<const ScopeResolver>,QSharedPointer<const StringInterner>) ) );
+	scheduler->Schedule();
 }
@@ -1,12 +1,16 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
-#include "highlighter.h"
+#include "Highlighter.h"
 
 #include <QMainWindow>
+#include <QSharedPointer>
 
+class AstTree;
 class Editor;
 class QTreeView;
+class ScopeResolver;
+class StringInterner;
 
 class MainWindow : public QMainWindow
 {
@@ -19,16 +23,27 @@ public slots:
 	void about();
 	void newFile();
 	void openFile( const QString& path = QString() );
+	void goToDefinition();
+
+private slots:
+	void setScopes( const QSharedPointer< const AstTree >& newTree, const QSharedPointer< const ScopeResolver >& newScopes,
+					const QSharedPointer< const StringInterner >& newSymbols );
 
 private:
 	void setupEditor();
 	void setupFileMenu();
+	void setupNavigateMenu();
 	void setupHelpMenu();
     void setupOutline();
 
 	Editor*				editor;
 	Highlighter*		highlighter;
     QTreeView*          treeView;
+
+	// names of the last parse bound to their declarations
+	QSharedPointer< const AstTree >			tree;
+	QSharedPointer< const ScopeResolver >	scopes;
+	QSharedPointer< const StringInterner >	symbols;
 };
 
 
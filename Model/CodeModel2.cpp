@@ -2,79 +2,263 @@
 
 #include <QDebug>
 
-#include "Parser/AstParser2.h"
-
 CodeModel2::CodeModel2( QObject* parent ) :
 	QAbstractItemModel( parent )
 {
-	_root = new AstItem( AstInfo::Global );
-	_parser = nullptr;
+	const AstTree empty;
+	NewNode( NoNode, 0, empty.Node( AstTree::RootNode ) );
+	AppendChildren( RootNode, empty, AstTree::RootNode );
 }
 
-CodeModel2::~CodeModel2()
+/*
+** Merges new tree into the model nodes top down. Children lists are
+** matched by common head and tail (same type, span and subtree hash; tail
+** spans moved by the shift of text behind the edit), the rest is paired by
+** position, left over rows are removed or inserted. Matched subtrees are
+** not walked, a shifted one only takes new position for its top node, so a
+** small edit in a big file visits and reports a handful of rows. Rows go
+** in and out of the children of one node, nothing else moves.
+*/
+void CodeModel2::SetTree( const QSharedPointer< const AstTree >& tree )
 {
-//	delete _root;
-	delete _parser;
+	QVector< Match > pending;
+
+	const Match root = { RootNode, AstTree::RootNode, 0 };
+	pending.append( root );
+	while( !pending.isEmpty() ) {
+		const Match match = pending.takeLast();
+		PushShift( match.Item );
+
+		// end of the node moves with text behind the edit
+		const AstNode& source = tree->Node( match.Index );
+		Node& node = _nodes[ match.Item ];
+		int delta = match.Delta;
+		if( node.Pos >= 0 && source.Info.Pos >= 0 )
+			delta = source.Info.Pos + source.Info.Size - node.Pos - node.Size;
+
+		CopyNode( node, source );
+		MergeChildren( match.Item, *tree, match.Index, delta, pending );
+	}
 }
 
-void CodeModel2::RebuildModel( const QString& source )
+void CodeModel2::MergeChildren( int item, const AstTree& tree, int index, int delta, QVector< Match >& pending )
 {
-	beginResetModel();
-//	delete _root;
-//	_root = new AstItem( "Global" );
-	if( _parser )
-		delete _parser;
-	_parser = new AstParser2( source );
-	_parser->Parse();
-	_root = _parser->Result();
+	const int oldCount = _nodes[ item ].Children.size();
+	const int newCount = tree.ChildrenCount( index );
+	const int first = tree.Node( index ).FirstChild;
 
-//    qDebug() << _root->DebugString();
+	int head = 0;
+	while( head < oldCount && head < newCount ) {
+		if( !IsSame( _nodes[ _nodes[ item ].Children[ head ] ], tree.Node( first + head ), 0 ) )
+			break;
+		++head;
+	}
+
+	int tail = 0;
+	while( tail < oldCount - head && tail < newCount - head ) {
+		const int child = _nodes[ item ].Children[ oldCount - 1 - tail ];
+		if( !IsSame( _nodes[ child ], tree.Node( first + newCount - 1 - tail ), delta ) )
+			break;
+		ShiftNode( child, delta );
+		++tail;
+	}
 
-//	_root = Parse( source );
-	endResetModel();
+	const int oldMiddle = oldCount - head - tail;
+	const int newMiddle = newCount - head - tail;
+	const int paired = qMin( oldMiddle, newMiddle );
+	for( int row = head; row < head + paired; ++row ) {
+		const int child = _nodes[ item ].Children[ row ];
+		const AstInfo::Type type = tree.Node( first + row ).Info.AstType;
+		if( _nodes[ child ].Type != type ) {
+			_nodes[ child ].Type = type;
+			const QModelIndex changed = IndexOf( child );
+			emit dataChanged( changed, changed );
+		}
+	}
+
+	if( oldMiddle > paired )
+		RemoveRows( item, head + paired, oldMiddle - paired );
+	else if( newMiddle > paired )
+		InsertRows( item, tree, head + paired, first + head + paired, newMiddle - paired );
+
+	for( int row = head; row < head + paired; ++row ) {
+		const Match match = { _nodes[ item ].Children[ row ], first + row, delta };
+		pending.append( match );
+	}
 }
 
+/*
+** new rows go into the children of item, their descendants are copied
+*/
+void CodeModel2::InsertRows( int item, const AstTree& tree, int row, int first, int count )
+{
+	beginInsertRows( IndexOf( item ), row, row + count - 1 );
+
+	QVector< int > rows;
+	rows.reserve( count );
+	for( int i = 0; i < count; ++i ) {
+		const int child = NewNode( item, row + i, tree.Node( first + i ) );
+		AppendChildren( child, tree, first + i );
+		rows.append( child );
+	}
 
-QModelIndex CodeModel2::index( int row, int column, const QModelIndex& parent ) const
+	QVector< int >& children = _nodes[ item ].Children;
+	children.insert( row, count, NoNode );
+	for( int i = 0; i < count; ++i )
+		children[ row + i ] = rows[ i ];
+	Renumber( item, row + count );
+	endInsertRows();
+}
+
+/*
+** rows of item are removed, indexes of their subtrees are free then
+*/
+void CodeModel2::RemoveRows( int item, int row, int count )
 {
-	if( !hasIndex( row, column, parent ) )
-		return QModelIndex();
+	beginRemoveRows( IndexOf( item ), row, row + count - 1 );
 
-	AstItem* ancestor = parent.isValid()
-			? static_cast< AstItem* >( parent.internalPointer() )
-			: _root;
+	QVector< int > removed = _nodes[ item ].Children.mid( row, count );
+	for( int i = 0; i < removed.size(); ++i ) {
+		Node& node = _nodes[ removed[ i ] ];
+		removed += node.Children;
+		node.Children = QVector< int >();
+	}
+	_free += removed;
 
-	AstItem* astItem = const_cast< AstItem* >( ancestor->Child( row ) );
-	if( !astItem )
+	_nodes[ item ].Children.remove( row, count );
+	Renumber( item, row );
+	endRemoveRows();
+}
+
+/*
+** node with type, span and hash of source and no children yet, a free
+** index is taken first
+*/
+int CodeModel2::NewNode( int parent, int row, const AstNode& source )
+{
+	int item = _nodes.size();
+	if( _free.isEmpty() )
+		_nodes.resize( item + 1 );
+	else
+		item = _free.takeLast();
+
+	Node& node = _nodes[ item ];
+	CopyNode( node, source );
+	node.Parent = parent;
+	node.Row = row;
+	return item;
+}
+
+/*
+** copy of tree descendants of index, item gets its children
+*/
+void CodeModel2::AppendChildren( int item, const AstTree& tree, int index )
+{
+	QVector< Match > pending;
+	const Match top = { item, index, 0 };
+	pending.append( top );
+	while( !pending.isEmpty() ) {
+		const Match match = pending.takeLast();
+		const AstNode& source = tree.Node( match.Index );
+
+		QVector< int > children;
+		children.reserve( source.ChildrenCount );
+		for( int row = 0; row < source.ChildrenCount; ++row ) {
+			const int child = NewNode( match.Item, row, tree.Node( source.FirstChild + row ) );
+			children.append( child );
+
+			const Match next = { child, source.FirstChild + row, 0 };
+			pending.append( next );
+		}
+		_nodes[ match.Item ].Children = children;
+	}
+}
+
+/*
+** children take the shift left for them
+*/
+void CodeModel2::PushShift( int item )
+{
+	const Node& node = _nodes[ item ];
+	for( int row = 0; row < node.Children.size(); ++row )
+		ShiftNode( node.Children[ row ], node.Shift );
+	_nodes[ item ].Shift = 0;
+}
+
+void CodeModel2::ShiftNode( int item, int shift )
+{
+	Node& node = _nodes[ item ];
+	if( node.Pos >= 0 )
+		node.Pos += shift;
+	node.Shift += shift;
+}
+
+void CodeModel2::Renumber( int item, int from )
+{
+	const Node& node = _nodes[ item ];
+	for( int row = from; row < node.Children.size(); ++row )
+		_nodes[ node.Children[ row ] ].Row = row;
+}
+
+/*
+** type, span and hash of source node, links are left to the caller
+*/
+void CodeModel2::CopyNode( Node& node, const AstNode& source )
+{
+	node.Type = source.Info.AstType;
+	node.Pos = source.Info.Pos;
+	node.Size = source.Info.Size;
+	node.Hash = source.Hash;
+	node.Shift = 0;
+}
+
+/*
+** same type, span moved by shift and subtree hash
+*/
+bool CodeModel2::IsSame( const Node& node, const AstNode& source, int shift )
+{
+	const int pos = node.Pos >= 0 ? node.Pos + shift : node.Pos;
+	return node.Type == source.Info.AstType && node.Hash == source.Hash
+			&& pos == source.Info.Pos && node.Size == source.Info.Size;
+}
+
+QModelIndex CodeModel2::IndexOf( int item ) const
+{
+	if( item == RootNode )
 		return QModelIndex();
-	return createIndex( row, column, astItem );
+	return createIndex( _nodes[ item ].Row, 0, quintptr( item ) );
 }
 
-QModelIndex CodeModel2::parent( const QModelIndex& child ) const
+int CodeModel2::ItemOf( const QModelIndex& index ) const
 {
-	if( !child.isValid() )
+	return index.isValid() ? int( index.internalId() ) : RootNode;
+}
+
+QModelIndex CodeModel2::index( int row, int column, const QModelIndex& parent ) const
+{
+	if( !hasIndex( row, column, parent ) )
 		return QModelIndex();
 
-	AstItem* astItem = static_cast< AstItem* >( child.internalPointer() );
-	if( !astItem )
+	const Node& ancestor = _nodes[ ItemOf( parent ) ];
+	if( row >= ancestor.Children.size() )
 		return QModelIndex();
+	return createIndex( row, column, quintptr( ancestor.Children[ row ] ) );
+}
 
-	AstItem* parent = astItem->Parent();
-	if( !parent || parent == _root )
+QModelIndex CodeModel2::parent( const QModelIndex& child ) const
+{
+	if( !child.isValid() )
 		return QModelIndex();
 
-	return createIndex( parent->SiblingPos(), 0, parent );
+	return IndexOf( _nodes[ ItemOf( child ) ].Parent );
 }
 
 int CodeModel2::rowCount( const QModelIndex& parent ) const
 {
-	if( parent.isValid() ) {
-		AstItem* astItem = static_cast< AstItem* >( parent.internalPointer() );
-		return astItem->ChildrenCount();
-	}
-	else {
-		return _root->ChildrenCount();
-	}
+	if( parent.column() > 0 )
+		return 0;
+
+	return _nodes[ ItemOf( parent ) ].Children.size();
 }
 
 int CodeModel2::columnCount( const QModelIndex& /*parent*/ ) const
@@ -82,24 +266,15 @@ int CodeModel2::columnCount( const QModelIndex& /*parent*/ ) const
 	return 1;
 }
 
-//bool CodeModel::hasChildren( const QModelIndex& parent ) const
-//{
-//	if( parent.isValid() ) {
-//		AstItem* AstItem = static_cast< AstItem* >( parent.internalPointer() );
-//		return AstItem->ChildrenCount() > 0;
-//	}
-//	return _root->ChildrenCount() > 0;
-//}
-
 QVariant CodeModel2::data( const QModelIndex& index, int role ) const
 {
-	AstItem* astItem = static_cast< AstItem* >( index.internalPointer() );
-
 	QVariant result;
+	if( !index.isValid() )
+		return result;
+
 	switch ( role ) {
 	case Qt::DisplayRole :
-		if( astItem )
-			result = astItem->TypeText();
+		result = AstTypeText( _nodes[ ItemOf( index ) ].Type );
 		break;
 	default:
 		break;
@@ -2,23 +2,28 @@
 #define CODE_MODEL_2_H
 
 #include <QAbstractItemModel>
+#include <QSharedPointer>
+#include <QVector>
 
-class AstItem;
-class AstParser2;
+#include "Data/AstTree.h"
 
+/*
+** Outline of the syntax tree. The model keeps its own flat copy of the
+** nodes, so views can hold persistent indexes. A new tree is merged in by
+** a diff and only changed rows are reported, expansion, selection and
+** scroll position in views survive a reparse.
+*/
 class CodeModel2 : public QAbstractItemModel
 {
 	Q_OBJECT
 
 public:
 	explicit CodeModel2( QObject* parent = 0 );
-	~CodeModel2();
-
-	void RebuildModel( const QString& source );
 
 signals:
 
 public slots:
+	void SetTree( const QSharedPointer< const AstTree >& tree );
 
 	// QAbstractItemModel interface
 public:
@@ -26,13 +31,58 @@ public:
 	virtual QModelIndex parent  ( const QModelIndex& child ) const;
 	virtual int rowCount        ( const QModelIndex& parent ) const;
 	virtual int columnCount     ( const QModelIndex& parent ) const;
-//	virtual bool hasChildren    ( const QModelIndex& parent ) const;
 	virtual QVariant data       ( const QModelIndex& index, int role ) const;
 	virtual Qt::ItemFlags flags ( const QModelIndex& index) const;
 
 private:
-	AstItem* _root;
-	AstParser2* _parser;
+	enum {
+		NoNode		= -1,
+		RootNode	= 0
+	};
+
+	// nodes are addressed by index, which stays the same while the node is
+	// in the model, each keeps its rows in its own Children; indexes of
+	// removed nodes are reused; Shift is added to positions of the
+	// descendants once they are merged
+	struct Node {
+		AstInfo::Type	Type;
+		int				Pos;
+		int				Size;
+		quint32			Hash;
+		int				Shift;
+
+		int				Parent;
+		int				Row;
+		QVector< int >	Children;
+	};
+
+	// model node, index of the new tree node it is merged with and shift of
+	// text behind the edit inside of it
+	struct Match {
+		int		Item;
+		int		Index;
+		int		Delta;
+	};
+
+	void		MergeChildren	( int item, const AstTree& tree, int index, int delta, QVector< Match >& pending );
+	void		InsertRows		( int item, const AstTree& tree, int row, int first, int count );
+	void		RemoveRows		( int item, int row, int count );
+
+	int			NewNode			( int parent, int row, const AstNode& source );
+	void		AppendChildren	( int item, const AstTree& tree, int index );
+	void		PushShift		( int item );
+	void		ShiftNode		( int item, int shift );
+	void		Renumber		( int item, int from );
+
+	static void	CopyNode		( Node& node, const AstNode& source );
+	static bool	IsSame			( const Node& node, const AstNode& source, int shift );
+
+	QModelIndex	IndexOf			( int item ) const;
+	int			ItemOf			( const QModelIndex& index ) const;
+
+private:
+	QVector< Node > _nodes;
+	QVector< int >	_free;
 };
 
 #endif // CODE_MODEL_H
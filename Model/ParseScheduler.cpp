@@ -0,0 +1,258 @@
+#include "ParseScheduler.h"
+
+#include <QTextBlock>
+#include <QTextDocument>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include "Highlighter.h"
+#include "Lexer/TokenBuffer.h"
+#include "Parser/AstParser2.h"
+
+namespace {
+
+/*
+** line starts in the state of the checkpoint, outside of any string
+*/
+bool IsSameStart( const LineTokens& line, const LexerCheckpoint& checkpoint )
+{
+	if( line.Context != checkpoint.Context )
+		return false;
+	return line.Context == LC_CODE || ( line.Context == LC_LONG_COMMENT && line.Level == checkpoint.Level );
+}
+
+} // namespace
+
+ParseScheduler::ParseScheduler( QTextDocument* document, QObject* parent ) :
+	QObject( parent ),
+	_document( document ),
+	_highlighter( nullptr ),
+
+	_parser( new AstParser2( QString() ) ),
+	_edited( false ),
+
+	_generation( 0 ),
+	_runningGeneration( -1 ),
+	_pending( false ),
+	_waitingForChain( false )
+{
+	_timer.setSingleShot( true );
+	_timer.setInterval( 250 );
+	_parser->SetParallel( true );
+
+	connect( _document, SIGNAL( contentsChange(int,int,int) ), this, SLOT( ContentsChanged(int,int,int) ) );
+	connect( &_timer, SIGNAL( timeout() ), this, SLOT( StartParse() ) );
+	connect( &_watcher, SIGNAL( finished() ), this, SLOT( ParseFinished() ) );
+}
+
+ParseScheduler::~ParseScheduler()
+{
+	// the worker does not touch this object, only its result is waited for
+	if( _cancelToken )
+		_cancelToken->Cancel();
+	_watcher.waitForFinished();
+}
+
+void ParseScheduler::SetDelay( int milliseconds )
+{
+	_timer.setInterval( milliseconds );
+}
+
+/*
+** highlighter of the same document, its tokens are used in place of
+** lexing
+*/
+void ParseScheduler::SetHighlighter( const Highlighter* highlighter )
+{
+	_highlighter = highlighter;
+	if( _highlighter )
+		connect( _highlighter, SIGNAL( ChainDone() ), this, SLOT( ChainDone() ) );
+}
+
+/*
+** runs on a worker thread, the parser is not touched by GUI thread while
+** the parse runs, nulls are returned for a cancelled parse; previous tree
+** of the job is null when there was none
+*/
+ParseScheduler::Result ParseScheduler::Parse( AstParser2* parser, const Job& job,
+											  const QSharedPointer< CancelToken >& token )
+{
+	Result result;
+
+	// parser has to see every text to follow edits, a parse cancelled
+	// before it starts still goes through lexing, then stops at once
+	parser->SetCancelToken( token.data() );
+	parser->Reparse( job.Source, job.Changed.Position, job.Changed.Removed, job.Changed.Added,
+					 job.Lines, job.FirstLine, job.RemovedLines );
+	parser->SetCancelToken( 0 );
+	if( parser->IsCancelled() || token->IsCancelled() )
+		return result;
+
+	// flattening and resolving are not interrupted, the tree of the
+	// previous text may be held by GUI thread, so a copy of it is patched
+	AstTree* tree = nullptr;
+	if( job.Previous && !parser->Splice().Path.isEmpty() ) {
+		tree = new AstTree( *job.Previous );
+		tree->Patch( parser->Result(), parser->Tokens(), parser->Splice() );
+	}
+	else {
+		tree = new AstTree( parser->Result(), parser->Tokens() );
+	}
+	result.Tree = QSharedPointer< const AstTree >( tree );
+
+	// interner copy is implicitly shared until the next parse interns, the
+	// parser starts it anew before names of old text outgrow the live ones
+	StringInterner* symbols = new StringInterner( parser->Interner() );
+	ScopeResolver* scopes = new ScopeResolver;
+	scopes->Resolve( *tree, *symbols );
+	result.Symbols = QSharedPointer< const StringInterner >( symbols );
+	result.Scopes = QSharedPointer< const ScopeResolver >( scopes );
+	return result;
+}
+
+/*
+** parses current text after the delay, parse of older text is stopped
+*/
+void ParseScheduler::Schedule()
+{
+	++_generation;
+	if( _cancelToken )
+		_cancelToken->Cancel();
+	_timer.start();
+}
+
+/*
+** edit is merged with the ones not parsed yet, all in one range of the
+** text the parser has seen
+*/
+void ParseScheduler::ContentsChanged( int position, int removed, int added )
+{
+	if( !_edited ) {
+		_edit.Position = position;
+		_edit.Removed = removed;
+		_edit.Added = added;
+		_edited = true;
+	}
+	else {
+		const int start = qMin( _edit.Position, position );
+		const int end = qMax( _edit.Position + _edit.Added, position + removed );
+		_edit.Removed = end - ( _edit.Added - _edit.Removed ) - start;
+		_edit.Added = end + added - removed - start;
+		_edit.Position = start;
+	}
+	Schedule();
+}
+
+void ParseScheduler::StartParse()
+{
+	if( _watcher.isRunning() ) {
+		// started again when running parse finishes
+		_pending = true;
+		return;
+	}
+
+	// a full parse takes tokens of all blocks, on file open the debounce
+	// runs out long before the chain has lexed a large text; the worker
+	// does not run, so the parser can be asked
+	_pending = false;
+	_waitingForChain = _highlighter && !_parser->IsParsed() && !_highlighter->IsChainDone();
+	if( _waitingForChain )
+		return;
+
+	_runningGeneration = _generation;
+	_cancelToken = QSharedPointer< CancelToken >( new CancelToken );
+
+	// edits from now on are against the text handed over; QString, token
+	// arrays and the tree are implicitly shared, the worker gets a snapshot
+	Job job;
+	job.Source = _document->toPlainText();
+	job.Changed = _edited ? _edit : Edit();
+	job.FirstLine = 0;
+	job.RemovedLines = -1;
+	job.Previous = _tree;
+
+	// a full parse reads tokens of all blocks, a parse of an edit those of
+	// the blocks around it; without them the parser lexes
+	if( _highlighter && !_parser->IsParsed() )
+		_highlighter->CachedTokens( job.Lines );
+	else if( _highlighter && _edited )
+		EditedLines( _document, _highlighter, _parser->Tokens(), job );
+	_edited = false;
+
+	_watcher.setFuture( QtConcurrent::run( &ParseScheduler::Parse, _parser.data(), job, _cancelToken ) );
+}
+
+void ParseScheduler::ParseFinished()
+{
+	// tree matches the parser even when its text is outdated already
+	const Result result = _watcher.result();
+	_tree = result.Tree;
+	if( _runningGeneration == _generation && result.Tree ) {
+		emit TreeReady( result.Tree );
+		emit ScopesReady( result.Tree, result.Scopes, result.Symbols );
+	}
+
+	if( _pending )
+		StartParse();
+}
+
+/*
+** full parse waiting for tokens of all blocks starts, unless an edit
+** restarted the delay
+*/
+void ParseScheduler::ChainDone()
+{
+	if( _waitingForChain && !_timer.isActive() )
+		StartParse();
+}
+
+/*
+** Lines the highlighter lexed for the edit of the job, from the block the
+** edit starts in up to the first block behind it that starts where and in
+** the state tokens of the text before the edit have it start, or up to
+** the end of text. False if a block on the way has no tokens or blocks do
+** not match lines of the tokens; the parser lexes the edit then.
+*/
+bool ParseScheduler::EditedLines( const QTextDocument* document, const Highlighter* highlighter,
+								  const TokenBuffer& tokens, Job& job )
+{
+	const Edit& edit = job.Changed;
+	const int delta = edit.Added - edit.Removed;
+	const int lineDelta = document->blockCount() - tokens.LineCount();
+
+	QTextBlock block = document->findBlock( edit.Position );
+	const int first = block.blockNumber();
+	const int last = document->findBlock( edit.Position + edit.Added ).blockNumber();
+	if( first < 0 || first >= tokens.LineCount() || tokens.LineStart( first ) != block.position() )
+		return false;
+
+	int position = block.position();
+	LineTokens line;
+	for( ; block.isValid(); block = block.next() ) {
+		const int number = block.blockNumber();
+		if( !highlighter->CachedLine( block, line ) )
+			break;
+		if( number == first && !IsSameStart( line, tokens.Checkpoint( first ) ) )
+			break;
+
+		// text from here on is the old one, so are its tokens
+		const int old = number - lineDelta;
+		if( number > last && old >= first && old < tokens.LineCount()
+				&& tokens.LineStart( old ) + delta == position && IsSameStart( line, tokens.Checkpoint( old ) ) ) {
+			job.FirstLine = first;
+			job.RemovedLines = old - first;
+			return true;
+		}
+
+		job.Lines.append( line );
+		position += line.Length;
+	}
+
+	// the last line has no line break
+	if( !block.isValid() && tokens.Offset( tokens.Count() - 1 ) + delta == position - 1 ) {
+		job.FirstLine = first;
+		job.RemovedLines = tokens.LineCount() - first;
+		return true;
+	}
+	job.Lines.clear();
+	return false;
+}
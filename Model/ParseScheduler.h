@@ -0,0 +1,120 @@
+#ifndef PARSE_SCHEDULER_H
+#define PARSE_SCHEDULER_H
+
+#include <QFutureWatcher>
+#include <QObject>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QTimer>
+
+#include "Data/AstTree.h"
+#include "Data/LineTokens.h"
+#include "Data/StringInterner.h"
+#include "Parser/CancelToken.h"
+#include "Parser/ScopeResolver.h"
+
+class AstParser2;
+class Highlighter;
+class QTextDocument;
+class TokenBuffer;
+
+/*
+** Reparses the document in background. Edits restart a debounce timer,
+** when it fires the text is copied and parsed on a QThreadPool worker,
+** the flattened tree is handed back to the GUI thread by TreeReady.
+**
+** Only one parse runs at a time. Every edit starts a new generation and
+** cancels the running parse, which stops within a few statements; its
+** result is dropped and the latest text is parsed next, so GUI thread
+** never waits for a parse.
+**
+** The parser is kept between parses. Edits since the text it has seen are
+** merged into one changed range, so only statements around it are parsed
+** again; a cancelled parse leaves it empty and the next one is full.
+** Lexing is left to the highlighter: a full parse waits for its chain to
+** be done and takes the tokens it keeps for blocks, a parse of an edit
+** takes those of the blocks around the edit; the parser lexes only what
+** the highlighter has no tokens for. The tree of the last parse is kept
+** too; after a parse of an edit a copy of it is patched with the
+** statements parsed again instead of flattened anew.
+**
+** Names of the tree are resolved on the worker as well. ScopesReady hands
+** the resolver over with a copy of the parser interner its symbols are
+** from, the parser keeps interning into its own on later parses.
+*/
+class ParseScheduler : public QObject
+{
+	Q_OBJECT
+
+public:
+	explicit ParseScheduler( QTextDocument* document, QObject* parent = 0 );
+	~ParseScheduler();
+
+	// characters at Position, Removed of the text seen last replaced by Added
+	struct Edit {
+		int Position;
+		int Removed;
+		int Added;
+	};
+
+	// what GUI thread hands over to a parse: the text, edits since the
+	// last one, lines the highlighter lexed and the tree of the last parse;
+	// lines of an edit replace RemovedLines lines from FirstLine on, all
+	// lines are given for RemovedLines -1
+	struct Job {
+		QString			Source;
+		Edit			Changed;
+		QVector< LineTokens > Lines;
+		int				FirstLine;
+		int				RemovedLines;
+		QSharedPointer< const AstTree > Previous;
+	};
+
+	// what a parse hands back, all null for a cancelled one
+	struct Result {
+		QSharedPointer< const AstTree >			Tree;
+		QSharedPointer< const ScopeResolver >	Scopes;
+		QSharedPointer< const StringInterner >	Symbols;
+	};
+
+	void SetDelay( int milliseconds );
+	void SetHighlighter( const Highlighter* highlighter );
+
+	static Result Parse( AstParser2* parser, const Job& job, const QSharedPointer< CancelToken >& token );
+	static bool EditedLines( const QTextDocument* document, const Highlighter* highlighter,
+							 const TokenBuffer& tokens, Job& job );
+
+signals:
+	void TreeReady( const QSharedPointer< const AstTree >& tree );
+	void ScopesReady( const QSharedPointer< const AstTree >& tree, const QSharedPointer< const ScopeResolver >& scopes,
+					  const QSharedPointer< const StringInterner >& symbols );
+
+public slots:
+	void Schedule();
+
+private slots:
+	void ContentsChanged( int position, int removed, int added );
+	void StartParse();
+	void ParseFinished();
+	void ChainDone();
+
+private:
+	QTextDocument*	_document;
+	const Highlighter*	_highlighter;
+	QTimer			_timer;
+
+	QScopedPointer< AstParser2 > _parser;
+	Edit			_edit;
+	bool			_edited;
+	QSharedPointer< const AstTree > _tree;
+
+	QFutureWatcher< Result > _watcher;
+	QSharedPointer< CancelToken > _cancelToken;
+
+	int				_generation;
+	int				_runningGeneration;
+	bool			_pending;
+	bool			_waitingForChain;
+};
+
+#endif // PARSE_SCHEDULER_H
@@ -0,0 +1,25 @@
+#ifndef AST_LISTENER_H
+#define AST_LISTENER_H
+
+#include "Data/AstInfo.h"
+#include "Data/TokenType.h"
+
+/*
+** Receives the syntax tree as events from AstParser2, one main chunk
+** statement at a time: a statement is sent once it is parsed whole, node
+** by node in depth first order, not token by token while it is parsed.
+** Positions are source offsets, nodes without span get -1. Tokens come
+** inside the innermost node with span holding them, before its next
+** child with span.
+*/
+class AstListener
+{
+public:
+	virtual ~AstListener() {}
+
+	virtual void EnterNode( AstInfo::Type type, int pos ) = 0;
+	virtual void LeaveNode( AstInfo::Type type, int pos, int size ) = 0;
+	virtual void Token( TokenType /*type*/, int /*pos*/, int /*length*/ ) {}
+};
+
+#endif // AST_LISTENER_H
@@ -1,152 +1,1480 @@
 #include "AstParser2.h"
 
-#include <QScopedPointer>
 #include <QString>
+#include <QThread>
+#include <QVarLengthArray>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <algorithm>
+
+namespace {
+
+bool IsBlockEnd( TokenType type ) {
+	return type == TT_END || type == TT_ELSE || type == TT_ELSEIF || type == TT_UNTIL
+			|| type == TT_END_OF_FILE;
+}
+
+// tokens panic mode recovery stops at
+bool IsSyncPoint( TokenType type ) {
+	switch( type ) {
+	case TT_LOCAL : case TT_FUNCTION : case TT_IF : case TT_WHILE : case TT_DO :
+	case TT_FOR : case TT_REPEAT : case TT_RETURN : case TT_BREAK :
+		return true;
+	default:
+		return IsBlockEnd( type );
+	}
+}
+
+} // namespace
 
 AstParser2::AstParser2( const QString& source ) :
 	_source ( source ),
-	_current(),
+	_tokens( _source ),
+	_current( &_tokens, &_source ),
+
+	_failed( false ),
+	_suspended( false ),
+	_maxDepth( 0 ),
+	_expressionDepth( 0 ),
+	_bodyDepth( 0 ),
+
+	_cancelToken( nullptr ),
+	_timeBudget( 0 ),
+	_checkCountdown( CheckInterval ),
+	_cancelled( false ),
+
+	_parallel( false ),
+	_stopIndex( -1 ),
+	_statementMark( -1 ),
+	_stopAtProblem( false ),
+	_emitted( nullptr ),
+	_emittedToken( 0 ),
+	_interner( &_ownInterner ),
+	_parsedSymbols( 0 ),
+
+	_global( _arena.Create( AstInfo::Global ) ),
+	_parsed( false )
+{
+}
 
-	_global( AstInfo::Global )
+AstParser2::AstParser2( const QString& source, const TokenBuffer& tokens ) :
+	_source ( source ),
+	_tokens( tokens ),
+	_current( &_tokens, &_source ),
+
+	_failed( false ),
+	_suspended( false ),
+	_maxDepth( 0 ),
+	_expressionDepth( 0 ),
+	_bodyDepth( 0 ),
+
+	_cancelToken( nullptr ),
+	_timeBudget( 0 ),
+	_checkCountdown( CheckInterval ),
+	_cancelled( false ),
+
+	_parallel( false ),
+	_stopIndex( -1 ),
+	_statementMark( -1 ),
+	_stopAtProblem( false ),
+	_emitted( nullptr ),
+	_emittedToken( 0 ),
+	_interner( &_ownInterner ),
+	_parsedSymbols( 0 ),
+
+	_global( _arena.Create( AstInfo::Global ) ),
+	_parsed( false )
 {
-    _current = Lexer2( &_source );
 }
 
+/*
+** Always builds a tree, statements broken by syntax errors are dropped
+** and problems are collected in Diagnostics. A cancelled parse returns
+** false and leaves an empty tree.
+*/
 bool AstParser2::Parse()
 {
-	if( !TryBlock( &_global ) )
-		return false;
-
-	// No lua statements, invalid source
-	if( !_global.HasChildren() ) {
-		GenerateError( "Empty source" );
+	_splice.Path.clear();
+	if( _timeBudget > 0 )
+		_timer.start();
+	_cancelled = false;
+	_checkCountdown = CheckInterval;
+
+	if( OpenBlock( _global, false ) ) {
+		_frames.last().Start = 0;
+		BeginEvents();
+		if( _parallel )
+			ParseSegments();
+		ParseBlocks( 0 );
+	}
+
+	if( _cancelled ) {
+		// nodes are forgotten at once, chunks go with the parser
+		ResetTree();
 		return false;
 	}
 
-    if( !_current.Is( TT_END_OF_FILE ) ) {
-		GenerateError( "Expected end of file" );
+	EndEvents();
+	MakeRelative( _global, 0 );
+	_parsed = true;
+	_parsedSymbols = _interner->Count();
+	return !HasError();
+}
+
+/*
+** Syntax check only, for saves and batch checks. Stops at the first
+** problem, the only one in Diagnostics then, and leaves an empty tree.
+** Nodes of a main chunk statement are forgotten once it is done, so the
+** arena stays as large as the largest statement and in cache; spans are
+** not made relative and no segments are parsed.
+*/
+bool AstParser2::Validate()
+{
+	_stopAtProblem = true;
+	const bool valid = Stream();
+	_stopAtProblem = false;
+
+	// first problem stops the parse as a cancel does
+	if( HasError() )
+		_cancelled = false;
+	return valid;
+}
+
+/*
+** Parse for listeners only: each main chunk statement is sent to them
+** when it is done and forgotten, the tree is left empty. Problems are
+** collected as by Parse, events stop with a cancel.
+**
+** The statement is built whole before it is sent, its nodes are read back
+** while it is parsed. Memory therefore follows the largest main chunk
+** statement, not the nesting depth: a file that is one "return { ... }"
+** or one "do ... end" is held whole, as by Parse.
+*/
+bool AstParser2::Stream()
+{
+	ResetTree();
+	if( _timeBudget > 0 )
+		_timer.start();
+	_cancelled = false;
+	_checkCountdown = CheckInterval;
+
+	if( OpenBlock( _global, false ) ) {
+		_frames.last().Start = 0;
+		_statementMark = _arena.Watermark();
+		BeginEvents();
+		ParseBlocks( 0 );
+		EndEvents();
+		_statementMark = -1;
+	}
+
+	const QVector< Diagnostic > diagnostics = _diagnostics;
+	const bool cancelled = _cancelled;
+	ResetTree();
+	_diagnostics = diagnostics;
+	_cancelled = cancelled;
+	return !cancelled && !HasError();
+}
+
+/*
+** Brings the tree up to date with source, the parsed text with removed
+** characters at position replaced by added ones. Only statements around
+** the changed tokens in the innermost block holding them are parsed again,
+** the rest of the tree is kept and moved by span shifts. Falls back to a
+** full parse when the change reaches outside of one statement list.
+**
+** Replaced nodes stay in the arena until the next full parse.
+**
+** Lines lexed by the highlighter are taken instead of lexing if given:
+** all lines of source for a full parse, or, with removedLines not
+** negative, the lines of an edit replacing removedLines lines of the
+** parsed text from firstLine on (see TokenBuffer::Replace).
+*/
+bool AstParser2::Reparse( const QString& source, int position, int removed, int added,
+						  const QVector< LineTokens >& lexed, int firstLine, int removedLines )
+{
+	_splice.Path.clear();
+	if( _timeBudget > 0 )
+		_timer.start();
+	_cancelled = false;
+	_checkCountdown = CheckInterval;
+
+	if( !_parsed || position < 0 || position + removed > _source.size() || position + added > source.size() ) {
+		// tree of cancelled or no parse has nothing to keep, a change out
+		// of the text could not be followed
+		_source = source;
+		if( lexed.isEmpty() || removedLines >= 0 )
+			_tokens.Lex( _source );
+		else
+			_tokens.Assign( lexed );
+		ResetTree();
+		ResetSymbols();
+		return Parse();
+	}
+
+	const int lines = _tokens.LineCount();
+	_source = source;
+	const TokenDelta delta = removedLines >= 0 ? _tokens.Replace( lexed, firstLine, removedLines, position )
+											   : _tokens.Update( _source, position, removed, added );
+
+	// names of old text stay interned, every prefix of a name typed too;
+	// once they pile up the text is parsed anew into a new interner
+	_parsed = false;
+	if( !HasStaleSymbols() && ReparseBlock( delta, position, added - removed, _tokens.LineCount() - lines ) ) {
+		_splice.Position = position;
+		_splice.RemovedChars = removed;
+		_splice.AddedChars = added;
+		_splice.LineDelta = _tokens.LineCount() - lines;
+		_parsed = true;
+		return !HasError();
+	}
+	if( _cancelled ) {
+		ResetTree();
 		return false;
 	}
 
-	return true;
+	ResetTree();
+	ResetSymbols();
+	return Parse();
 }
 
 bool AstParser2::HasError() const
 {
-	return _error.size() > 0;
+	return !_diagnostics.isEmpty();
 }
 
+/*
+** first problem as text
+*/
 QString AstParser2::Error() const
 {
-	return _error;
+	if( _diagnostics.isEmpty() )
+		return QString();
+
+	const Diagnostic& first = _diagnostics.first();
+	return QString( "Error: %1\nat line: %2, column: %3" )
+			.arg( first.Description ).arg( first.Line ).arg( first.Column );
+}
+
+const QVector< Diagnostic >& AstParser2::Diagnostics() const
+{
+	return _diagnostics;
 }
 
 AstItem* AstParser2::Result()
 {
-	return &_global;
+	return _global;
+}
+
+/*
+** statements the last Reparse replaced, Path is empty when the tree was
+** parsed as a whole
+*/
+const AstSplice& AstParser2::Splice() const
+{
+	return _splice;
+}
+
+const TokenBuffer& AstParser2::Tokens() const
+{
+	return _tokens;
+}
+
+/*
+** symbols of Name nodes, they stay the same across reparses of edits; a
+** full parse of Reparse starts the own interner anew
+*/
+const StringInterner& AstParser2::Interner() const
+{
+	return *_interner;
 }
 
 QString AstParser2::Debug()
 {
-	return _global.DebugString();
+	return _global->DebugString();
+}
+
+/*
+** 0 means no limit
+*/
+void AstParser2::SetMaxDepth( int depth )
+{
+	_maxDepth = depth;
+}
+
+/*
+** token is polled during Parse, it must outlive the parser
+*/
+void AstParser2::SetCancelToken( const CancelToken* token )
+{
+	_cancelToken = token;
+}
+
+/*
+** Parse gives up as cancelled after given time, 0 means no limit
+*/
+void AstParser2::SetTimeBudget( int milliseconds )
+{
+	_timeBudget = milliseconds;
+}
+
+/*
+** Parse splits a large file into top level segments parsed on the global
+** thread pool, the tree is the same as the one of a serial parse
+*/
+void AstParser2::SetParallel( bool parallel )
+{
+	_parallel = parallel;
+}
+
+/*
+** Parse and Stream send events, Reparse does not. Listener is called from
+** the thread that parses, it must outlive the parser.
+*/
+void AstParser2::AddListener( AstListener* listener )
+{
+	_listeners.append( listener );
 }
 
-bool AstParser2::TryBlock( AstItem* item )
+/*
+** interner shared with other documents, no other thread may use it while
+** this parser runs; nullptr goes back to the own one
+*/
+void AstParser2::SetInterner( StringInterner* interner )
 {
-	QScopedPointer< AstItem > block( new AstItem( AstInfo::Block ) );
-	while( TryStatement( block.data() ) ) {
-		// Skip ending ';'
-        _current.NextIf( TT_SEMICOLON );
+	_interner = interner ? interner : &_ownInterner;
+}
+
+bool AstParser2::IsCancelled() const
+{
+	return _cancelled;
+}
+
+/*
+** false until a parse is done, then the next Reparse is a full one
+*/
+bool AstParser2::IsParsed() const
+{
+	return _parsed;
+}
+
+/*
+** Statements with blocks do not parse them by recursion. They open a frame
+** on _frames and return, this loop fills the block of the top frame and
+** closes it on 'end', 'until', 'elseif' or 'else'. So nesting of blocks
+** costs heap memory only. Runs until frames above base are closed.
+**
+** A broken statement is reported and tokens are skipped up to the next
+** statement keyword (panic mode), the block goes on from there. A block
+** closed by a wrong keyword or end of file is closed right there and the
+** keyword is left for the enclosing block. Every token is skipped and
+** every frame is closed once, so recovery stays linear.
+**
+** Function bodies deep inside expressions are not parsed by recursion
+** either: the statement holding one fails when the body is opened, the
+** body is parsed here and once it is closed the statement is parsed again,
+** taking the body ready. Lists, constructors, operator runs and suffix
+** chains around the body keep what they had built, the parse again goes
+** on from the element holding the body, so only the few tokens in front
+** of them are read twice and many bodies in one statement cost linear
+** time.
+*/
+bool AstParser2::ParseBlocks( int base )
+{
+	while( _frames.size() > base ) {
+		if( IsInterrupted() )
+			return false;
+
+		// segment of a parallel parse stops between statements of main chunk
+		if( _stopIndex >= 0 && _frames.size() == 1 && _current.CurrentIndex() >= _stopIndex )
+			return true;
+
+		// bodies are kept until statements at this depth are done with them,
+		// the later ones are deeper or later in the same statement
+		while( !_bodies.isEmpty() && _bodies.last().Depth >= _frames.size() && _bodies.last().Next <= _current.CurrentIndex() )
+			_bodies.removeLast();
+		while( !_parts.isEmpty() && _parts.last().Depth >= _frames.size() && _parts.last().Resume <= _current.CurrentIndex() )
+			_parts.removeLast();
+
+		// main chunk statements done so far go to listeners, not while closed
+		// bodies or parts wait in the arena for their statement
+		if( _frames.size() == 1 && _bodies.isEmpty() && _parts.isEmpty() && ( _statementMark >= 0 || !_listeners.isEmpty() ) )
+			FlushStatements();
+
+		const int depth = _frames.size();
+		const int start = _current.CurrentIndex();
+
+		if( TryStatement( _frames.last().Block ) ) {
+			// Skip ending ';', statements opening a block get it after close
+			if( _frames.size() == depth )
+				_current.NextIf( TT_SEMICOLON );
+			continue;
+		}
+		if( Resumes( start ) )
+			continue;
+		if( _failed ) {
+			Synchronize( start );
+			continue;
+		}
+
+		if( TryLastStatement( _frames.last().Block ) ) {
+			// Skip ending ';'
+			_current.NextIf( TT_SEMICOLON );
+		}
+		if( Resumes( start ) )
+			continue;
+		if( _failed ) {
+			Synchronize( start );
+			continue;
+		}
+
+		if( !IsBlockEnd( _current.CurrentType() ) ) {
+			GenerateError( QString( "Unexpected '%1'" ).arg( _current.CurrentString() ) );
+			Synchronize( start );
+			continue;
+		}
+
+		if( CloseBlock() ) {
+			// 'until' or 'elseif' expression could fail after block was closed
+			if( !Resumes( start ) && _failed )
+				Synchronize( start );
+			continue;
+		}
+
+		if( _frames.size() == 1 ) {
+			// stray keyword in main chunk
+			_failed = false;
+			_current.Next();
+			continue;
+		}
+
+		const bool body = _frames.last().Resume >= 0;
+		CloseFrame( _current.CurrentIndex() - 1, _current.CurrentIndex() - 1 );
+		if( !body && _frames.size() == base ) {
+			// function body of an expression parsed by its own loop, the
+			// statement fails
+			return false;
+		}
+		_failed = false;
 	}
-	if( HasError() )
+	return true;
+}
+
+/*
+** statement says whether closing the block ends a statement
+*/
+bool AstParser2::OpenBlock( AstItem* owner, bool statement )
+{
+	if( _maxDepth > 0 && _frames.size() >= _maxDepth ) {
+		GenerateError( QString( "Blocks nested deeper than %1 levels" ).arg( _maxDepth ) );
 		return false;
+	}
 
-    if( TryLastStatement( block.data() ) ) {
-        // Skip ending ';'
-        _current.NextIf( TT_SEMICOLON );
-    }
+	BlockFrame frame;
+	frame.Owner = owner;
+	frame.Block = _arena.Create( AstInfo::Block, owner );
+	frame.Statement = statement;
+	frame.Else = false;
+	frame.Start = -1;
+	frame.OwnerStart = -1;
+	frame.BlockStart = _current.CurrentIndex();
+	frame.Resume = -1;
+	_frames.append( frame );
+	return true;
+}
 
-	if( HasError() )
+/*
+** false if current keyword does not close the top block
+*/
+bool AstParser2::CloseBlock()
+{
+	BlockFrame& frame = _frames.last();
+	AstItem* owner = frame.Owner;
+	const int blockEnd = _current.CurrentIndex() - 1;
+
+	switch( owner->Info.AstType ) {
+	case AstInfo::Global : {
+		if( !_current.Is( TT_END_OF_FILE ) ) {
+			GenerateError( QString( "Unexpected '%1'" ).arg( _current.CurrentString() ) );
+			return false;
+		}
+		CloseFrame( blockEnd, blockEnd );
+		return true;
+	}
+	case AstInfo::RepeatStatement : {
+		if( !_current.NextIf( TT_UNTIL ) ) {
+			GenerateError( "Expected 'until' statement to close 'repeat'" );
+			return false;
+		}
+		// frame stays while the expression is parsed, a function body in it
+		// is parsed on top and 'until' is read again then
+		const int start = frame.Start;
+		const bool expression = TryExpression( owner );
+		if( _suspended )
+			return true;
+		CloseFrame( blockEnd, blockEnd + 1 );
+
+		SetSpan( owner, start, _current.CurrentIndex() - 1 );
+		if( !expression ) {
+			if( !_failed )
+				GenerateError( "Expected expression after 'until' keyword" );
+			return true;
+		}
+		_current.NextIf( TT_SEMICOLON );
+		return true;
+	}
+	case AstInfo::IfStatement : {
+		if( frame.Else )
+			break;
+
+		if( _current.NextIf( TT_ELSEIF ) ) {
+			SetSpan( frame.Block, frame.BlockStart, blockEnd );
+			if( !TryExpression( owner ) ) {
+				// function body of the expression is on top, 'elseif' is
+				// read again once it is closed
+				if( _suspended )
+					return true;
+				if( !_failed )
+					ReportError( "Expected expression after 'elseif' keyword" );
+			}
+			else if( !_current.NextIf( TT_THEN ) ) {
+				ReportError( "Expected 'then' statement after 'elseif' expression" );
+			}
+
+			// frames could grow while the expression was parsed, take top
+			// frame again
+			_frames.last().Block = _arena.Create( AstInfo::Block, owner );
+			_frames.last().BlockStart = _current.CurrentIndex();
+			return true;
+		}
+
+		if( _current.NextIf( TT_ELSE ) ) {
+			SetSpan( frame.Block, frame.BlockStart, blockEnd );
+			frame.Else = true;
+			frame.Block = _arena.Create( AstInfo::Block, owner );
+			frame.BlockStart = _current.CurrentIndex();
+			return true;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	if( !_current.NextIf( TT_END ) ) {
+		switch( owner->Info.AstType ) {
+		case AstInfo::DoStatement :
+			GenerateError( "Expected 'end' statement to close 'do'" );
+			break;
+		case AstInfo::WhileStatement :
+			GenerateError( "Expected 'end' statement to close 'while'" );
+			break;
+		case AstInfo::ForIndexStatement : case AstInfo::ForIteratorStatement :
+			GenerateError( "Expected 'end' statement to close 'for' statement" );
+			break;
+		case AstInfo::IfStatement :
+			GenerateError( "Expected 'end' statement to close 'if' statement" );
+			break;
+		default:
+			GenerateError( "Expected 'end' statement to close function body" );
+			break;
+		}
 		return false;
+	}
+
+	const bool statement = frame.Statement;
+	CloseFrame( blockEnd, blockEnd + 1 );
+
+	// Skip ending ';'
+	if( statement )
+		_current.NextIf( TT_SEMICOLON );
+	return true;
+}
+
+/*
+** Pops the top frame and sets spans of its block, of its owner and of the
+** statement a function body belongs to
+*/
+void AstParser2::CloseFrame( int blockEnd, int ownerEnd )
+{
+	const BlockFrame frame = _frames.takeLast();
+	SetSpan( frame.Block, frame.BlockStart, blockEnd );
+
+	if( frame.Owner->Is( AstInfo::FunctionBody ) ) {
+		SetSpan( frame.Owner, frame.OwnerStart, ownerEnd );
+		if( frame.Statement && frame.Start >= 0 )
+			SetSpan( frame.Owner->Parent(), frame.Start, ownerEnd );
+	}
+	else if( frame.Start >= 0 ) {
+		SetSpan( frame.Owner, frame.Start, ownerEnd );
+	}
+
+	// statements of the block are done
+	while( !_bodies.isEmpty() && _bodies.last().Depth > _frames.size() )
+		_bodies.removeLast();
+	while( !_parts.isEmpty() && _parts.last().Depth > _frames.size() )
+		_parts.removeLast();
+
+	if( frame.Owner->Is( AstInfo::FunctionBody ) && !frame.Statement ) {
+		// body of an expression is kept for its statement, closed by 'end'
+		// unless the close failed; bodies parsed by their own loop too, the
+		// statement may be parsed again for a deeper body behind them
+		const ParsedBody body = { frame.Owner, frame.OwnerStart, _current.CurrentIndex(), _frames.size(), !_failed };
+		_bodies.append( body );
+		if( frame.Resume >= 0 )
+			_current.Rewind( frame.Resume );
+	}
+}
+
+/*
+** skips tokens up to a keyword a statement or block end can start from,
+** at least one token when nothing was read since start
+*/
+void AstParser2::Synchronize( int start )
+{
+	if( _cancelled )
+		return;
+	_failed = false;
+
+	if( _current.CurrentIndex() == start )
+		_current.Next();
+
+	while( !IsSyncPoint( _current.CurrentType() ) )
+		_current.Next();
+}
+
+/*
+** true when the statement started at start failed for a function body
+** of an expression, now on top of frames, it is parsed again from start
+** once the body is closed
+*/
+bool AstParser2::Resumes( int start )
+{
+	if( !_suspended )
+		return false;
+
+	_suspended = false;
+	_failed = false;
+	_frames.last().Resume = start;
+	return true;
+}
+
+/*
+** bodies are kept in token order, closed ones of statements around the
+** current one come first
+*/
+bool AstParser2::BodyBefore( const ParsedBody& body, int token )
+{
+	return body.Token < token;
+}
+
+/*
+** part the construct starting at the current token saved when its
+** statement was suspended, nullptr if none; parts of the statement being
+** parsed are the last ones, as many as constructs around its last body
+*/
+const AstParser2::ParsedPart* AstParser2::FindPart( PartKind kind ) const
+{
+	const int token = _current.CurrentIndex();
+	for( int i = _parts.size() - 1; i >= 0 && _parts[ i ].Depth == _frames.size(); --i ) {
+		if( _parts[ i ].Token == token && _parts[ i ].Kind == kind )
+			return &_parts[ i ];
+	}
+	return nullptr;
+}
+
+/*
+** called while a suspended statement fails, the frame of its body is on
+** top then
+*/
+AstParser2::ParsedPart& AstParser2::SavePart( PartKind kind, int token, int resume, AstItem* node )
+{
+	ParsedPart part;
+	part.Token = token;
+	part.Kind = kind;
+	part.Resume = resume;
+	part.Depth = _frames.size() - 1;
+	part.Node = node;
+	part.Link = nullptr;
+	part.Operands = 0;
+	part.Operators = 0;
+	_parts.append( part );
+	return _parts.last();
+}
+
+/*
+** Called for every statement, the token and the clock are looked at once
+** per CheckInterval calls only. A cancelled parse fails every statement,
+** so all ParseBlocks loops return.
+*/
+bool AstParser2::IsInterrupted()
+{
+	if( _cancelled )
+		return true;
+
+	if( --_checkCountdown > 0 )
+		return false;
+	_checkCountdown = CheckInterval;
+
+	if( ( _cancelToken && _cancelToken->IsCancelled() )
+			|| ( _timeBudget > 0 && _timer.hasExpired( _timeBudget ) ) ) {
+		_cancelled = true;
+		_failed = true;
+	}
+	return _cancelled;
+}
+
+void AstParser2::BeginEvents()
+{
+	_emitted = nullptr;
+	_emittedToken = _current.CurrentIndex();
+	for( AstListener* listener : _listeners ) {
+		listener->EnterNode( AstInfo::Global, 0 );
+		listener->EnterNode( AstInfo::Block, 0 );
+	}
+}
+
+/*
+** Sends main chunk statements appended since the last call, spans are
+** still token indexes then. Forgets them when no tree is kept.
+*/
+void AstParser2::FlushStatements()
+{
+	AstItem* block = _frames.first().Block;
+	const AstItem* statement = _emitted ? _emitted->Next() : block->FirstChild();
+	if( !_listeners.isEmpty() ) {
+		for( ; statement; statement = statement->Next() ) {
+			EmitSubtree( statement );
+			_emitted = statement;
+		}
+	}
+
+	if( _statementMark >= 0 ) {
+		block->RemoveChildren();
+		_arena.Rewind( _statementMark );
+		_emitted = nullptr;
+	}
+}
+
+/*
+** depth first walk on an explicit path, enter before children, leave after
+*/
+void AstParser2::EmitSubtree( const AstItem* root )
+{
+	QVarLengthArray< const AstItem*, 64 > path;
+	const AstItem* item = root;
+	forever {
+		int pos = -1;
+		if( item->HasSpan() ) {
+			EmitTokens( item->Info.Pos );
+			pos = _tokens.Offset( item->Info.Pos );
+		}
+		for( AstListener* listener : _listeners )
+			listener->EnterNode( item->Info.AstType, pos );
+
+		if( item->HasChildren() ) {
+			path.append( item );
+			item = item->FirstChild();
+			continue;
+		}
+
+		forever {
+			pos = -1;
+			int size = -1;
+			if( item->HasSpan() ) {
+				const int last = item->Info.Pos + item->Info.Size - 1;
+				EmitTokens( last + 1 );
+				pos = _tokens.Offset( item->Info.Pos );
+				size = item->Info.Size > 0 ? _tokens.End( last ) - pos : 0;
+			}
+			for( AstListener* listener : _listeners )
+				listener->LeaveNode( item->Info.AstType, pos, size );
+
+			if( item == root || item->Next() )
+				break;
+			item = path.last();
+			path.removeLast();
+		}
+		if( item == root )
+			return;
+		item = item->Next();
+	}
+}
+
+/*
+** tokens from the last one sent up to end, not included
+*/
+void AstParser2::EmitTokens( int end )
+{
+	for( ; _emittedToken < end; ++_emittedToken ) {
+		const TokenType type = _tokens.Type( _emittedToken );
+		const int pos = _tokens.Offset( _emittedToken );
+		const int length = _tokens.Length( _emittedToken );
+		for( AstListener* listener : _listeners )
+			listener->Token( type, pos, length );
+	}
+}
+
+/*
+** closes main chunk once it is parsed
+*/
+void AstParser2::EndEvents()
+{
+	if( _listeners.isEmpty() || _cancelled )
+		return;
+
+	const int end = _tokens.Count() - 1;
+	EmitTokens( end );
+	const int size = end > 0 ? _tokens.End( end - 1 ) : 0;
+	for( AstListener* listener : _listeners ) {
+		listener->LeaveNode( AstInfo::Block, 0, size );
+		listener->LeaveNode( AstInfo::Global, 0, size );
+	}
+}
+
+/*
+** Main chunk is cut into segments at statements found by FindCuts, each is
+** parsed by a parser of its own on the thread pool. A segment stands for
+** the serial parse only if the segments before it ended right on their
+** stops in main chunk: statements depend only on the tokens from their
+** first one on. Segments are taken up to the first one that did not, the
+** serial parse goes on from there, so a wrong cut costs time only.
+*/
+void AstParser2::ParseSegments()
+{
+	const int threads = QThread::idealThreadCount();
+	const int tokens = _tokens.Count() - _current.CurrentIndex();
+	if( threads < 2 || tokens < 2 * MinSegmentTokens )
+		return;
+
+	const QVector< int > cuts = FindCuts( qMin( threads * 4, tokens / MinSegmentTokens ) );
+	if( cuts.size() < 2 )
+		return;
+
+	const int timeBudget = _timeBudget > 0 ? qMax( 1, _timeBudget - int( _timer.elapsed() ) ) : 0;
+	QVector< Segment > segments;
+	segments.reserve( cuts.size() );
+	for( int i = 0; i < cuts.size(); ++i ) {
+		// token buffer and source are implicitly shared, not copied
+		Segment segment;
+		segment.First = cuts[ i ];
+		segment.Stop = i + 1 < cuts.size() ? cuts[ i + 1 ] : _tokens.Count() - 1;
+		segment.Parsed = false;
+		segment.Parser = QSharedPointer< AstParser2 >( new AstParser2( _source, _tokens ) );
+		segment.Parser->SetMaxDepth( _maxDepth );
+		segment.Parser->SetCancelToken( _cancelToken );
+		segment.Parser->SetTimeBudget( timeBudget );
+		segments.append( segment );
+	}
+
+	// calling thread takes segments too, so a parse on a pool thread is fine
+	QtConcurrent::blockingMap( segments, &AstParser2::ParseSegmentTask );
+
+	AstItem* block = _frames.last().Block;
+	for( int i = 0; i < segments.size(); ++i ) {
+		AstParser2& parser = *segments[ i ].Parser;
+		if( parser._cancelled ) {
+			_cancelled = true;
+			_failed = true;
+			return;
+		}
+		if( !segments[ i ].Parsed )
+			return;
+
+		block->ReplaceChildren( block->LastChild(), nullptr, parser._frames.first().Block );
+		_arena.Adopt( parser._arena );
+
+		const QVector< int > symbols = _interner->Merge( *parser._interner );
+		for( AstItem* name : parser._segmentNames )
+			name->Info.Symbol = symbols[ name->Info.Symbol ];
+
+		// same as ReportError of a serial parse
+		for( const Diagnostic& diagnostic : parser._diagnostics ) {
+			if( _diagnostics.isEmpty() || _diagnostics.last().Pos != diagnostic.Pos )
+				_diagnostics.append( diagnostic );
+		}
+		_current.Rewind( segments[ i ].Stop );
+	}
+}
+
+/*
+** First tokens of about count top level segments of equal size, the first
+** is the current token. Segments start at 'local' or at 'function' after
+** 'end' outside of any block. Block keywords are only counted, so in broken
+** code a cut can fall inside a statement, ParseSegments finds it out.
+*/
+QVector< int > AstParser2::FindCuts( int count ) const
+{
+	const int first = _current.CurrentIndex();
+	const int last = _tokens.Count() - 1;
+	const int step = ( last - first ) / count;
+
+	QVector< int > cuts;
+	cuts.append( first );
+	int next = first + step;
+	int depth = 0;
+	for( int i = first; i < last && cuts.size() < count; ++i ) {
+		switch( _tokens.Type( i ) ) {
+		case TT_FUNCTION :
+			if( depth == 0 && i >= next && i > first && _tokens.Type( i - 1 ) == TT_END ) {
+				cuts.append( i );
+				next = i + step;
+			}
+			++depth;
+			break;
+		case TT_DO : case TT_IF : case TT_REPEAT :
+			++depth;
+			break;
+		case TT_END : case TT_UNTIL :
+			depth = qMax( depth - 1, 0 );
+			break;
+		case TT_LOCAL :
+			if( depth == 0 && i >= next ) {
+				cuts.append( i );
+				next = i + step;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return cuts;
+}
+
+/*
+** parses main chunk statements from first on, true if the last one ended
+** right before stop
+*/
+bool AstParser2::ParseSegment( int first, int stop )
+{
+	if( _timeBudget > 0 )
+		_timer.start();
+	_current.Rewind( first );
+	_stopIndex = stop;
+
+	if( !OpenBlock( _global, false ) )
+		return false;
+	ParseBlocks( 0 );
+	return !_cancelled && _frames.size() == 1 && _current.CurrentIndex() == stop;
+}
+
+void AstParser2::ParseSegmentTask( Segment& segment )
+{
+	segment.Parsed = segment.Parser->ParseSegment( segment.First, segment.Stop );
+}
+
+/*
+** Finds the innermost block whose statement list holds the changed tokens
+** and parses its statements from the last one starting before the change
+** up to the first one ending after it. The new statements must end on the
+** old end token of that run, or on the block end when the run is the tail
+** of the block, then the rest of the tree is parsed as before: a statement
+** depends only on the tokens from its first one on, and ends on the token
+** after it alone.
+**
+** Statements of the run are spliced into the block, the nodes behind them
+** move with the next node with span on each level of the path. Statements
+** are looked up in block indexes, so no walk is as long as a block. False
+** leaves a broken tree, the caller parses it all again.
+*/
+bool AstParser2::ReparseBlock( const TokenDelta& delta, int position, int charDelta, int lineDelta )
+{
+	// old token indexes of the change
+	const int changeFirst = delta.First;
+	const int changeEnd = delta.First + delta.Removed;
+	const int tokenDelta = delta.Inserted - delta.Removed;
+
+	// nodes with span from global down to the block, each a child of the
+	// previous one, Row is the row of a statement in the block above
+	struct PathStep {
+		AstItem*	Item;
+		int			Row;
+	};
+	QVarLengthArray< PathStep, 32 > path;
+	const PathStep global = { _global, -1 };
+	path.append( global );
+
+	AstItem* block = _global->FirstChild();
+	int blockStart = _global->Info.Pos + block->Info.Pos;
+	const PathStep top = { block, -1 };
+	path.append( top );
+
+	// rows of the path below global for the flat tree
+	QVector< int > rows;
+	rows.append( 0 );
+
+	// last statement starting before the change
+	int row = -1;
+	forever {
+		const BlockIndex& index = IndexOf( block );
+		row = int( std::lower_bound( index.Starts.constBegin(), index.Starts.constEnd(), changeFirst - blockStart )
+				   - index.Starts.constBegin() ) - 1;
+		if( row < 0 )
+			break;
+
+		AstItem* statement = index.Items[ row ];
+		const int statementStart = blockStart + index.Starts[ row ];
+		if( changeEnd >= statementStart + statement->Info.Size )
+			break;
+
+		// change inside of one statement, go down into its block holding it
+		AstItem* inner = nullptr;
+		AstItem* body = nullptr;
+		int innerStart = 0;
+		int innerRow = -1;
+		int anchor = statementStart;
+		for( AstItem* child = statement->FirstChild(); child && !inner; child = child->Next() ) {
+			++innerRow;
+			if( !child->HasSpan() )
+				continue;
+			anchor += child->Info.Pos;
+
+			AstItem* candidate = child;
+			int start = anchor;
+			if( child->Is( AstInfo::FunctionBody ) ) {
+				// block comes after the parameters, each relative to the one before
+				candidate = child->LastChild();
+				if( !candidate || !candidate->Is( AstInfo::Block ) )
+					continue;
+				for( const AstItem* part = child->FirstChild(); part; part = part->Next() )
+					if( part->HasSpan() )
+						start += part->Info.Pos;
+			}
+			else if( !child->Is( AstInfo::Block ) ) {
+				continue;
+			}
+
+			if( start <= changeFirst && changeEnd <= start + candidate->Info.Size ) {
+				inner = candidate;
+				innerStart = start;
+				if( candidate != child )
+					body = child;
+			}
+		}
+		if( !inner )
+			break;
+
+		const PathStep statementStep = { statement, row };
+		path.append( statementStep );
+		rows.append( row );
+		rows.append( innerRow );
+		if( body ) {
+			const PathStep bodyStep = { body, -1 };
+			path.append( bodyStep );
+			rows.append( body->ChildrenCount() - 1 );
+		}
+		const PathStep blockStep = { inner, -1 };
+		path.append( blockStep );
+		block = inner;
+		blockStart = innerStart;
+	}
+
+	// old run ends on the first statement ending behind the change, or on
+	// the block end
+	const BlockIndex& index = IndexOf( block );
+	const int count = index.Items.size();
+	const int firstRow = qMax( row, 0 );
+	int lastRow = firstRow;
+	while( lastRow < count && blockStart + index.Starts[ lastRow ] + index.Items[ lastRow ]->Info.Size - 1 < changeEnd )
+		++lastRow;
+
+	AstItem* before = firstRow > 0 ? index.Items[ firstRow - 1 ] : nullptr;
+	AstItem* after = lastRow + 1 < count ? index.Items[ lastRow + 1 ] : nullptr;
+	const int afterStart = after ? blockStart + index.Starts[ lastRow + 1 ] + tokenDelta : 0;
+
+	const int start = row >= 0 ? blockStart + index.Starts[ row ] : blockStart;
+	const int target = lastRow < count
+			? blockStart + index.Starts[ lastRow ] + index.Items[ lastRow ]->Info.Size - 1 + tokenDelta : -1;
+	const int closer = blockStart + block->Info.Size + tokenDelta;
+	int anchor = before ? blockStart + index.Starts[ firstRow - 1 ] : blockStart;
+
+	// new statements go to holder, bottom frame stands for the enclosing
+	// block, so errors can not close it
+	AstItem* holder = _arena.Create( AstInfo::Block );
+	BlockFrame bottom;
+	bottom.Owner = bottom.Block = holder;
+	bottom.Statement = bottom.Else = false;
+	bottom.Start = bottom.OwnerStart = -1;
+	bottom.BlockStart = start;
+	bottom.Resume = -1;
+
+	// old problems are kept aside while the run is parsed
+	QVector< Diagnostic > diagnostics;
+	diagnostics.swap( _diagnostics );
+	_frames.clear();
+	_frames.append( bottom );
+	_bodies.clear();
+	_parts.clear();
+	_operands.clear();
+	_operators.clear();
+	_failed = false;
+	_suspended = false;
+	_expressionDepth = 0;
+	_bodyDepth = 0;
+	_current.Rewind( start );
+
+	// same loop as ParseBlocks for the bottom frame, up to the target
+	bool lastStatement = false;
+	forever {
+		if( target >= 0 && holder->HasChildren()
+				&& holder->LastChild()->Info.Pos + holder->LastChild()->Info.Size - 1 >= target )
+			break;
+		if( ( target >= 0 && _current.CurrentIndex() > target + 1 ) || IsInterrupted() )
+			break;
+
+		const int statementStart = _current.CurrentIndex();
+		if( TryStatement( holder ) ) {
+			if( _frames.size() > 1 ) {
+				if( !ParseBlocks( 1 ) )
+					break;
+			}
+			else {
+				_current.NextIf( TT_SEMICOLON );
+			}
+			continue;
+		}
+		if( !_failed && TryLastStatement( holder ) ) {
+			_current.NextIf( TT_SEMICOLON );
+			lastStatement = true;
+		}
+		if( Resumes( statementStart ) ) {
+			if( !ParseBlocks( 1 ) )
+				break;
+			continue;
+		}
+		if( _failed && !_cancelled ) {
+			Synchronize( statementStart );
+			continue;
+		}
+		if( lastStatement || IsBlockEnd( _current.CurrentType() ) )
+			break;
+
+		GenerateError( QString( "Unexpected '%1'" ).arg( _current.CurrentString() ) );
+		Synchronize( statementStart );
+	}
+	_frames.clear();
+
+	QVector< Diagnostic > problems;
+	problems.swap( _diagnostics );
+	_diagnostics.swap( diagnostics );
+	if( _failed || _cancelled )
+		return false;
+	if( target >= 0 ) {
+		if( !holder->HasChildren()
+				|| holder->LastChild()->Info.Pos + holder->LastChild()->Info.Size - 1 != target
+				|| ( lastStatement && after ) )
+			return false;
+		// recovery could skip tokens behind the run
+		if( _current.CurrentIndex() != target + 1
+				&& ( _current.CurrentIndex() != target + 2 || _tokens.Type( target + 1 ) != TT_SEMICOLON ) )
+			return false;
+	}
+	else if( _current.CurrentIndex() != closer ) {
+		return false;
+	}
+
+	// Old problems from the run on, in old text, could come from the run
+	// as well as from the frames around it: recovery and block closing
+	// reach past statements. So either all of them are behind the token
+	// the run stops on and the run has none, or all are in front of it and
+	// new ones of the run, again in front of it, take their place. First
+	// token of the run may be a changed one, its old offset is in delta.
+	const int startPos = start < changeFirst ? _tokens.Offset( start ) : delta.Offset;
+	const int runPos = qMin( startPos, position );
+	const int stop = _tokens.Offset( _current.CurrentIndex() );
+	int next = 0;
+	while( next < _diagnostics.size() && _diagnostics[ next ].Pos < runPos )
+		++next;
+	// a problem on the first token may come from the statement owning the
+	// block or from the one before, a last statement
+	if( next < _diagnostics.size() && _diagnostics[ next ].Pos <= startPos )
+		return false;
+	if( problems.isEmpty() && next < _diagnostics.size() && _diagnostics[ next ].Pos > stop - charDelta ) {
+		for( int i = next; i < _diagnostics.size(); ++i ) {
+			_diagnostics[ i ].Pos += charDelta;
+			_diagnostics[ i ].Line += lineDelta;
+			_diagnostics[ i ].Column = _tokens.Column( _diagnostics[ i ].Pos ) + 1;
+		}
+	}
+	else {
+		if( !_diagnostics.isEmpty() && _diagnostics.last().Pos >= stop - charDelta )
+			return false;
+		for( int i = 0; i < problems.size(); ++i ) {
+			if( problems[ i ].Pos >= stop )
+				return false;
+		}
+		_diagnostics.resize( next );
+		_diagnostics += problems;
+	}
+
+	// splice statements into block and its index
+	QVector< AstItem* > items;
+	QVector< int > starts;
+	for( AstItem* statement = holder->FirstChild(); statement; statement = statement->Next() ) {
+		const int statementStart = statement->Info.Pos;
+		MakeRelative( statement, anchor );
+		anchor = statementStart;
+		items.append( statement );
+		starts.append( statementStart - blockStart );
+	}
+	if( after )
+		after->Info.Pos = afterStart - anchor;
+	block->ReplaceChildren( before, after, holder );
+
+	BlockIndex& changed = _indexes[ block ];
+	const int removedRows = qMin( lastRow + 1, count ) - firstRow;
+	changed.Items.remove( firstRow, removedRows );
+	changed.Starts.remove( firstRow, removedRows );
+	for( int i = 0; i < items.size(); ++i ) {
+		changed.Items.insert( firstRow + i, items[ i ] );
+		changed.Starts.insert( firstRow + i, starts[ i ] );
+	}
+	for( int i = firstRow + items.size(); i < changed.Starts.size(); ++i )
+		changed.Starts[ i ] += tokenDelta;
+
+	// enclosing nodes grow, nodes behind them move
+	for( int i = path.size() - 1; i >= 0; --i ) {
+		path[ i ].Item->Info.Size += tokenDelta;
+		if( i + 1 == path.size() )
+			continue;
+
+		ShiftSpans( path[ i + 1 ].Item->Next(), tokenDelta );
+		if( path[ i + 1 ].Row >= 0 ) {
+			BlockIndex& enclosing = _indexes[ path[ i ].Item ];
+			for( int k = path[ i + 1 ].Row + 1; k < enclosing.Starts.size(); ++k )
+				enclosing.Starts[ k ] += tokenDelta;
+		}
+	}
+
+	_splice.Path = rows;
+	_splice.FirstRow = firstRow;
+	_splice.RemovedRows = removedRows;
+	_splice.InsertedRows = items.size();
+	return true;
+}
+
+/*
+** built when Reparse first goes through block, kept up to date by it
+*/
+AstParser2::BlockIndex& AstParser2::IndexOf( AstItem* block )
+{
+	if( !_indexes.contains( block ) ) {
+		BlockIndex index;
+		index.Items.reserve( block->ChildrenCount() );
+		index.Starts.reserve( block->ChildrenCount() );
+
+		// statements all have spans, each relative to the one before
+		int start = 0;
+		for( AstItem* statement = block->FirstChild(); statement; statement = statement->Next() ) {
+			start += statement->Info.Pos;
+			index.Items.append( statement );
+			index.Starts.append( start );
+		}
+		_indexes.insert( block, index );
+	}
+	return _indexes[ block ];
+}
+
+/*
+** forgets the tree, tokens are kept
+*/
+void AstParser2::ResetTree()
+{
+	_splice.Path.clear();
+	_frames.clear();
+	_bodies.clear();
+	_parts.clear();
+	_operands.clear();
+	_operators.clear();
+	_diagnostics.clear();
+	_failed = false;
+	_suspended = false;
+	_expressionDepth = 0;
+	_bodyDepth = 0;
+
+	_arena.Clear();
+	_global = _arena.Create( AstInfo::Global );
+	_parsed = false;
+	_indexes.clear();
+	_current.Rewind( 0 );
+}
+
+/*
+** own interner starts anew for a full parse, a shared one is left as it
+** is
+*/
+void AstParser2::ResetSymbols()
+{
+	if( _interner == &_ownInterner )
+		_ownInterner.Clear();
+}
+
+/*
+** own interner holds more names the tree does not use than the slack
+** allows, they are only dropped by a full parse
+*/
+bool AstParser2::HasStaleSymbols() const
+{
+	return _interner == &_ownInterner && _ownInterner.Count() > 2 * _parsedSymbols + SymbolSlack;
+}
+
+/*
+** span of tokens [first, last], empty when last is before first
+*/
+void AstParser2::SetSpan( AstItem* item, int first, int last )
+{
+	item->Info.Pos = first;
+	item->Info.Size = qMax( last - first + 1, 0 );
+}
 
-	item->AppendChild( block.take() );
-	return true;
+/*
+** spans are set with absolute token indexes while parsing, anchor is the
+** token item is relative to, see AstItem
+*/
+void AstParser2::MakeRelative( AstItem* item, int anchor )
+{
+	struct Pending {
+		AstItem*	Item;
+		int			Anchor;
+	};
+
+	QVector< Pending > stack;
+	const Pending root = { item, anchor };
+	stack.append( root );
+	while( !stack.isEmpty() ) {
+		const Pending pending = stack.takeLast();
+
+		// spans of children are still absolute here
+		int childAnchor = pending.Item->HasSpan() ? pending.Item->Info.Pos : pending.Anchor;
+		if( pending.Item->HasSpan() )
+			pending.Item->Info.Pos -= pending.Anchor;
+
+		for( AstItem* child = pending.Item->FirstChild(); child; child = child->Next() ) {
+			const Pending next = { child, childAnchor };
+			stack.append( next );
+			if( child->HasSpan() )
+				childAnchor = child->Info.Pos;
+		}
+	}
+}
+
+/*
+** Item moved by delta but the anchor it is relative to did not. A node
+** with span takes the shift, nodes behind it are relative to it. Nodes
+** without span pass it on to their first child and next sibling.
+*/
+void AstParser2::ShiftSpans( AstItem* item, int delta )
+{
+	if( !item )
+		return;
+
+	QVector< AstItem* > stack;
+	stack.append( item );
+	while( !stack.isEmpty() ) {
+		AstItem* current = stack.takeLast();
+		if( current->HasSpan() ) {
+			current->Info.Pos += delta;
+			continue;
+		}
+		if( current->Next() )
+			stack.append( current->Next() );
+		if( current->FirstChild() )
+			stack.append( current->FirstChild() );
+	}
 }
 
 bool AstParser2::TryStatement( AstItem* item )
 {
+	// nodes of a statement failed without error are never linked to item,
+	// reuse their memory
+	const int watermark = _arena.Watermark();
+	const int names = _segmentNames.size();
+	const int depth = _frames.size();
+	const int start = _current.CurrentIndex();
+	const AstItem* previous = item->LastChild();
+	bool parsed = false;
+
     switch( _current.CurrentType() ) {
 	// Try do block end | 													# DO
 	case TT_DO : {
-		if( TryDoStatement( item ) )
-			return true;
+		parsed = TryDoStatement( item );
 		break;
 	}
 	// Try while exp do block end | 										# WHILE
 	case TT_WHILE : {
-		if( TryWhileStatement( item ) )
-			return true;
+		parsed = TryWhileStatement( item );
 		break;
 	}
 	// Try repeat block until exp | 										# REPEAT
 	case TT_REPEAT : {
-		if( TryRepeatStatement( item ) )
-			return true;
+		parsed = TryRepeatStatement( item );
 		break;
 	}
 	// Try if exp then block {elseif exp then block} [else block] end |		# IF
 	case TT_IF : {
-		if( TryIfStatement( item ) )
-			return true;
+		parsed = TryIfStatement( item );
 		break;
 	}
 	// Try for Name `=´ exp `,´ exp [`,´ exp] do block end |				# FOR
 	// Try for namelist in explist do block end | 							# FOR
 	case TT_FOR : {
-		if( TryForStatement( item ) )
-			return true;
+		parsed = TryForStatement( item );
 		break;
 	}
 	// Try function funcname funcbody | 									# DEFINE GLOBAL FUNCTION
 	case TT_FUNCTION : {
-		if( TryFunctionStatement( item ) )
-			return true;
+		parsed = TryFunctionStatement( item );
 		break;
 	}
 	// Try local function Name funcbody | 									# DEFINE LOCAL FUNCTION
 	// Try local namelist [`=´ explist] 									# DEFINE LOCAL VARLIST
 	case TT_LOCAL : {
-		if( TryLocalStatement( item ) )
-			return true;
+		parsed = TryLocalStatement( item );
 		break;
 	}
 	default:
 		// Function call or global assigment
-		if( TryCallOrAssign( item ) ) {
-			return true;
-		}
+		parsed = TryCallOrAssign( item );
+	}
+
+	if( parsed ) {
+		// statement with a block gets its span when the block is closed
+		if( _frames.size() == depth )
+			SetSpan( item->LastChild(), start, _current.CurrentIndex() - 1 );
+		else
+			_frames.last().Start = start;
+		return true;
 	}
 
+	if( !_failed ) {
+		_arena.Rewind( watermark );
+		_segmentNames.resize( names );
+	}
+	else if( item->LastChild() != previous )
+		// function statements are linked before their body fails
+		SetSpan( item->LastChild(), start, _current.CurrentIndex() - 1 );
 	return false;
 }
 
 bool AstParser2::TryLastStatement( AstItem* item )
 {
+	const int start = _current.CurrentIndex();
+
     switch( _current.CurrentType() ) {
 	case TT_RETURN : {
         _current.Next(); // skip 'return' keyword
 
-		QScopedPointer< AstItem > returnStatement( new AstItem( AstInfo::ReturnStatement ) );
-		TryExpressionList( returnStatement.data() );
-		if( HasError() )
+		AstItem* returnStatement = _arena.Create( AstInfo::ReturnStatement );
+		TryExpressionList( returnStatement );
+		if( _failed )
 			return false;
-		item->AppendChild( returnStatement.take() );
+		item->AppendChild( returnStatement );
+		SetSpan( returnStatement, start, _current.CurrentIndex() - 1 );
 		return true;
 	}
 	case TT_BREAK : {
         _current.Next(); // skip 'break' keyword
 
-		new AstItem( AstInfo::BreakStatement, item );
+		SetSpan( _arena.Create( AstInfo::BreakStatement, item ), start, start );
 		return true;
 	}
 	}
@@ -155,135 +1483,68 @@ bool AstParser2::TryLastStatement( AstItem* item )
 
 bool AstParser2::TryDoStatement( AstItem* item )
 {
-	QScopedPointer< AstItem > doStatement( new AstItem( AstInfo::DoStatement ) );
+	AstItem* doStatement = _arena.Create( AstInfo::DoStatement );
     _current.Next(); // skip 'do' keyword
 
-	TryBlock( doStatement.data() );
-	if( HasError() )
-		return false;
-
-    if( !_current.NextIf( TT_END ) ) {
-		GenerateError( "Expected 'end' statement to close 'do'" );
-		return false;
-	}
-
-	item->AppendChild( doStatement.take() );
-	return true;
+	item->AppendChild( doStatement );
+	return OpenBlock( doStatement, true );
 }
 
 bool AstParser2::TryWhileStatement( AstItem* item )
 {
-	QScopedPointer< AstItem > whileStatement( new AstItem( AstInfo::WhileStatement ) );
+	AstItem* whileStatement = _arena.Create( AstInfo::WhileStatement );
     _current.Next(); // skip 'while' keyword
 
-	if( !TryExpression( whileStatement.data() ) ) {
-		if( !HasError() )
+	if( !TryExpression( whileStatement ) ) {
+		if( !_failed )
 			GenerateError( "Expected expression after 'while' keyword" );
 		return false;
 	}
 
-    if( !_current.NextIf( TT_DO ) ) {
-		GenerateError( "Expected 'do' statement before 'while' block body" );
-		return false;
-	}
-
-	TryBlock( whileStatement.data() );
-	if( HasError() )
-		return false;
-
-    if( !_current.NextIf( TT_END ) ) {
-		GenerateError( "Expected 'end' statement to close 'while'" );
-		return false;
-	}
+	// block is opened anyway, so its 'end' still closes it
+    if( !_current.NextIf( TT_DO ) )
+		ReportError( "Expected 'do' statement before 'while' block body" );
 
-	item->AppendChild( whileStatement.take() );
-	return true;
+	item->AppendChild( whileStatement );
+	return OpenBlock( whileStatement, true );
 }
 
 bool AstParser2::TryRepeatStatement( AstItem* item )
 {
-	QScopedPointer< AstItem > repeatStatement( new AstItem( AstInfo::RepeatStatement ) );
+	AstItem* repeatStatement = _arena.Create( AstInfo::RepeatStatement );
     _current.Next(); // skip 'repeat' keyword
 
-	TryBlock( repeatStatement.data() );
-	if( HasError() )
-		return false;
-
-    if( !_current.NextIf( TT_UNTIL ) ) {
-		GenerateError( "Expected 'until' statement to close 'repeat'" );
-		return false;
-    }
-
-	if( !TryExpression( repeatStatement.data() ) ) {
-		if( !HasError() )
-			GenerateError( "Expected expression after 'until' keyword" );
-		return false;
-	}
-
-	item->AppendChild( repeatStatement.take() );
-	return true;
+	// 'until' expression is parsed by CloseBlock
+	item->AppendChild( repeatStatement );
+	return OpenBlock( repeatStatement, true );
 }
 
 bool AstParser2::TryIfStatement( AstItem* item )
 {
-	QScopedPointer< AstItem > ifStatement( new AstItem( AstInfo::IfStatement ) );
+	AstItem* ifStatement = _arena.Create( AstInfo::IfStatement );
     _current.Next(); // skip 'if' keyword
 
-	if( !TryExpression( ifStatement.data() ) ) {
-		if( !HasError() )
+	if( !TryExpression( ifStatement ) ) {
+		if( !_failed )
 			GenerateError( "Expected expression after 'if' keyword" );
 		return false;
 	}
 
-    if( !_current.NextIf( TT_THEN ) ) {
-		GenerateError( "Expected 'then' statement after 'if' expression" );
-		return false;
-    }
-
-	TryBlock( ifStatement.data() );
-	if( HasError() )
-		return false;
-
-    while( _current.NextIf( TT_ELSEIF ) ) {
-
-		if( !TryExpression( ifStatement.data() ) ) {
-			if( !HasError() )
-				GenerateError( "Expected expression after 'elseif' keyword" );
-			return false;
-		}
-
-        if( !_current.NextIf( TT_THEN ) ) {
-			GenerateError( "Expected 'then' statement after 'elseif' expression" );
-			return false;
-		}
-
-		TryBlock( ifStatement.data() );
-		if( HasError() )
-			return false;
-	}
-
-    if( _current.NextIf( TT_ELSE ) ) {
-
-		TryBlock( ifStatement.data() );
-		if( HasError() )
-			return false;
-	}
-
-    if( !_current.NextIf( TT_END ) ) {
-		GenerateError( "Expected 'end' statement to close 'if' statement" );
-		return false;
-	}
+	// block is opened anyway, so its 'end' still closes it
+    if( !_current.NextIf( TT_THEN ) )
+		ReportError( "Expected 'then' statement after 'if' expression" );
 
-	item->AppendChild( ifStatement.take() );
-	return true;
+	// 'elseif' and 'else' parts are opened by CloseBlock
+	item->AppendChild( ifStatement );
+	return OpenBlock( ifStatement, true );
 }
 
 bool AstParser2::TryForStatement( AstItem* item )
 {
-	QScopedPointer< AstItem > forStatement( new AstItem( AstInfo::ForIndexStatement ) );
+	AstItem* forStatement = _arena.Create( AstInfo::ForIndexStatement );
     _current.Next(); // skip 'for' keyword
 
-	if( !ShouldNameList( forStatement.data() ) )
+	if( !ShouldNameList( forStatement ) )
 		return false;
 
     if( _current.NextIf( TT_ASSIGN ) ) {
@@ -293,8 +1554,8 @@ bool AstParser2::TryForStatement( AstItem* item )
             return false;
         }
 
-        if( !TryExpression( forStatement.data() ) ) {
-            if( !HasError() )
+        if( !TryExpression( forStatement ) ) {
+            if( !_failed )
                 GenerateError( "Expected expression after '=' in for statement" );
             return false;
         }
@@ -304,16 +1565,16 @@ bool AstParser2::TryForStatement( AstItem* item )
             return false;
         }
 
-        if( !TryExpression( forStatement.data() ) ) {
-            if( !HasError() )
+        if( !TryExpression( forStatement ) ) {
+            if( !_failed )
                 GenerateError( "Expected expression after ',' in for statement" );
             return false;
         }
 
         // last expression - step
         if( _current.NextIf( TT_COMMA ) ) {
-            if( !TryExpression( forStatement.data() ) ) {
-                if( !HasError() )
+            if( !TryExpression( forStatement ) ) {
+                if( !_failed )
                     GenerateError( "Expected expression after ',' in for statement" );
                 return false;
             }
@@ -328,42 +1589,31 @@ bool AstParser2::TryForStatement( AstItem* item )
 			return false;
 		}
 
-		if( !TryExpressionList( forStatement.data() ) ) {
-			if( !HasError() )
+		if( !TryExpressionList( forStatement ) ) {
+			if( !_failed )
 				GenerateError( "Expected expressionlist after 'in'' keyword in 'for' statement" );
 			return false;
 		}
 	}
 
 	// for body
-    if( !_current.NextIf( TT_DO ) ) {
-		GenerateError( "Expected 'do' statement before 'for' block body" );
-		return false;
-	}
-
-	TryBlock( forStatement.data() );
-	if( HasError() )
-		return false;
-
-    if( !_current.NextIf( TT_END ) ) {
-		GenerateError( "Expected 'end' statement to close 'for' statement" );
-		return false;
-	}
+    if( !_current.NextIf( TT_DO ) )
+		ReportError( "Expected 'do' statement before 'for' block body" );
 
-	item->AppendChild( forStatement.take() );
-	return true;
+	item->AppendChild( forStatement );
+	return OpenBlock( forStatement, true );
 }
 
 bool AstParser2::TryFunctionStatement( AstItem* item )
 {
-	QScopedPointer< AstItem > functionStatement( new AstItem( AstInfo::FunctionStatement ) );
+	AstItem* functionStatement = _arena.Create( AstInfo::FunctionStatement );
     _current.Next(); // skip 'function' keyword
 
     if( _current.CurrentType() != TT_NAME ) {
 		GenerateError( "Expected name after 'function' keyword" );
 		return false;
 	}
-	functionStatement->AppendChild( new AstItem( AstInfo::Name ) );
+	functionStatement->AppendChild( CreateLeaf( AstInfo::Name ) );
     _current.Next(); // skip name
 
     while( _current.NextIf( TT_POINT ) ) {
@@ -372,7 +1622,7 @@ bool AstParser2::TryFunctionStatement( AstItem* item )
 			GenerateError( "Expected name after '.' in 'function' statement" );
 			return false;
 		}
-		functionStatement->AppendChild( new AstItem( AstInfo::Name ) );
+		functionStatement->AppendChild( CreateLeaf( AstInfo::Name ) );
         _current.Next(); // skip name
 	}
 
@@ -382,20 +1632,18 @@ bool AstParser2::TryFunctionStatement( AstItem* item )
 			GenerateError( "Expected name after ':' in 'function' statement" );
 			return false;
 		}
-		functionStatement->AppendChild( new AstItem( AstInfo::Name ) );
+		functionStatement->Info.Flags |= AstInfo::MethodFlag;
+		functionStatement->AppendChild( CreateLeaf( AstInfo::Name ) );
         _current.Next(); // skip name
 	}
 
-	if( !ShouldFunctionBody( functionStatement.data() ) )
-		return false;
-
-	item->AppendChild( functionStatement.take() );
-	return true;
+	item->AppendChild( functionStatement );
+	return ShouldFunctionBody( functionStatement );
 }
 
 bool AstParser2::TryLocalStatement( AstItem* item )
 {
-	QScopedPointer< AstItem > localStatement( new AstItem( AstInfo::LocalStatement ) );
+	AstItem* localStatement = _arena.Create( AstInfo::LocalStatement );
     _current.Next(); // skip 'local' keyword
 
     if( _current.NextIf( TT_FUNCTION ) ) {
@@ -405,34 +1653,61 @@ bool AstParser2::TryLocalStatement( AstItem* item )
 			GenerateError( "Expected name after ':' in 'function' statement" );
 			return false;
 		}
-		localStatement->AppendChild( new AstItem( AstInfo::Name ) );
+		localStatement->AppendChild( CreateLeaf( AstInfo::Name ) );
         _current.Next(); // skip name
 
-		if( !ShouldFunctionBody( localStatement.data() ) )
-			return false;
+		item->AppendChild( localStatement );
+		return ShouldFunctionBody( localStatement );
 	}
 	else {
 		// local assignment or define
-		if( !ShouldNameList( localStatement.data() ) )
+		if( !ShouldNameList( localStatement ) )
 			return false;
 
         if( _current.NextIf( TT_ASSIGN ) ) {
-			if( !TryExpressionList( localStatement.data() ) ) {
-				if( !HasError() )
+			if( !TryExpressionList( localStatement ) ) {
+				if( !_failed )
 					GenerateError( "Expected expression list after '=' in local assignment" );
 				return false;
 			}
 		}
 	}
 
-	item->AppendChild( localStatement.take() );
+	item->AppendChild( localStatement );
 	return true;
 }
 
+bool CanStartPrefix( TokenType type ) {
+	return type == TT_NAME || type == TT_LEFT_BRACKET;
+}
+
+bool CanStartArgs( TokenType type ) {
+	return type == TT_LEFT_BRACKET || type == TT_LEFT_CURLY || type == TT_STRING;
+}
+
+bool CanStartSuffix( TokenType type ) {
+	return type == TT_POINT || type == TT_LEFT_SQUARE || type == TT_COLON || CanStartArgs( type );
+}
+
+bool CanStartExpression( TokenType type ) {
+	switch( type ) {
+	case TT_NOT : case TT_MINUS : case TT_NUMBER_SIGN :
+	case TT_NIL : case TT_TRUE : case TT_FALSE : case TT_DOTS :
+	case TT_NUMBER : case TT_STRING :
+	case TT_FUNCTION : case TT_LEFT_CURLY :
+		return true;
+	default:
+		return CanStartPrefix( type );
+	}
+}
+
 bool IsCall( const AstItem* item ) {
+	// go to the last suffix
 	const AstItem* suffix = item->Child( 1 );
-	if( suffix && suffix->Is( AstInfo::Prefix ) )
-		return IsCall( suffix );
+	while( suffix && suffix->Is( AstInfo::Prefix ) ) {
+		item = suffix;
+		suffix = item->Child( 1 );
+	}
 
 	const AstItem* args = item->Child( 0 );
 	return args && args->Is( AstInfo::Args );
@@ -440,20 +1715,24 @@ bool IsCall( const AstItem* item ) {
 
 bool AstParser2::TryCallOrAssign( AstItem* item )
 {
-	QScopedPointer< AstItem > callOrAssign( new AstItem() );
-	if( !TryPrefixExpression( callOrAssign.data() ) )
+	// Statement can start only from Name or '(', no need to build anything
+	if( !CanStartPrefix( _current.CurrentType() ) )
+		return false;
+
+	AstItem* callOrAssign = _arena.Create( AstInfo::CallStatement );
+	if( !TryPrefixExpression( callOrAssign ) )
 		return false;
 
 	if( IsCall( callOrAssign->Child( 0 ) ) ) {
 		callOrAssign->Info.AstType = AstInfo::CallStatement;
-		item->AppendChild( callOrAssign.take() );
+		item->AppendChild( callOrAssign );
 		return true;
 	}
 
 	// else var list
     while( _current.NextIf( TT_COMMA ) )
 	{
-		if( !TryPrefixExpression( callOrAssign.data() ) )
+		if( !TryPrefixExpression( callOrAssign ) )
 			return false;
         if( callOrAssign->LastChild()->Is( AstInfo::CallStatement ) ) {
 			GenerateError( "Wrong call" );
@@ -469,31 +1748,61 @@ bool AstParser2::TryCallOrAssign( AstItem* item )
 
 	//
 	// expression list
-	if( !TryExpressionList( callOrAssign.data() ) ) {
-		if( !HasError() ) {
+	if( !TryExpressionList( callOrAssign ) ) {
+		if( !_failed ) {
 			GenerateError( "Expected expression list" );
 		}
 		return false;
 	}
 
 	callOrAssign->Info.AstType = AstInfo::AssignStatement;
-	item->AppendChild( callOrAssign.take() );
+	item->AppendChild( callOrAssign );
 	return true;
 }
 
 bool AstParser2::TryPrefixExpression( AstItem* item )
 {
-	QScopedPointer< AstItem > prefix( new AstItem( AstInfo::Prefix ) );
-	// Can be started from Name or '('
+	if( !CanStartPrefix( _current.CurrentType() ) )
+		return false;
+
+	const int start = _current.CurrentIndex();
+	AstItem* prefix = nullptr;
+	if( const ParsedPart* part = FindPart( PrefixPart ) ) {
+		// statement parsed again goes on from the suffixes
+		prefix = part->Node;
+		_current.Rewind( part->Resume );
+	}
+	else {
+		prefix = _arena.Create( AstInfo::Prefix );
+		if( !TryPrefixStart( prefix ) )
+			return false;
+	}
+
+	const int suffixes = _current.CurrentIndex();
+	TryPrefixSubExpression( prefix );
+	if( _failed ) {
+		if( _suspended )
+			SavePart( PrefixPart, start, suffixes, prefix );
+		return false;
+	}
+
+	item->AppendChild( prefix );
+	SetSpan( prefix, start, _current.CurrentIndex() - 1 );
+	return true;
+}
+
+// Can be started from Name or '('
+bool AstParser2::TryPrefixStart( AstItem* prefix )
+{
     switch( _current.CurrentType() ) {
 	case TT_NAME : {
-		new AstItem( AstInfo::Name, prefix.data() );
+		prefix->AppendChild( CreateLeaf( AstInfo::Name ) );
         _current.Next();
 		break;
 	}
 	case TT_LEFT_BRACKET : {
         _current.Next();
-		if( !TryExpression( prefix.data() ) ) {
+		if( !TryExpression( prefix ) ) {
 			GenerateError( "Wrong bracket" );
 			return false;
 		}
@@ -508,92 +1817,120 @@ bool AstParser2::TryPrefixExpression( AstItem* item )
 	default :
 		return false;
 	}
-
-	TryPrefixSubExpression( prefix.data() );
-	if( HasError() )
-		return false;
-
-	item->AppendChild( prefix.take() );
 	return true;
 }
 
+/*
+** Every suffix is nested into the previous one, the chain is built by loop
+** so long a.b.c... chains do not use native stack. A suffix spans up to
+** the end of the chain, so its first token waits in Pos until the end.
+*/
 bool AstParser2::TryPrefixSubExpression( AstItem* item )
 {
-	QScopedPointer< AstItem > prefix( new AstItem( AstInfo::Prefix ) );
-    switch( _current.CurrentType() ) {
-	case TT_POINT : {
-        if( _current.Next() != TT_NAME ) {
-			GenerateError( "Name expected" );
-			return false;
-		}
-
-		new AstItem( AstInfo::Name, prefix.data() );
-        _current.Next();
+	// Most of prefix expressions end here, check before allocation
+	if( !CanStartSuffix( _current.CurrentType() ) )
+		return false;
 
-		TryPrefixSubExpression( prefix.data() );
-		break;
+	const int start = _current.CurrentIndex();
+	AstItem* chain = nullptr;
+	if( const ParsedPart* part = FindPart( SuffixesPart ) ) {
+		// statement parsed again goes on from the suffix of the body
+		item = part->Node;
+		chain = part->Link;
+		_current.Rewind( part->Resume );
 	}
-	case TT_LEFT_SQUARE : {
-        _current.Next();
 
-		if( !TryExpression( prefix.data() ) ) {
-			if( !HasError() )
-				GenerateError( "Expected expression" );
-			return false;
-		}
+	while( CanStartSuffix( _current.CurrentType() ) ) {
+		AstItem* prefix = _arena.Create( AstInfo::Prefix );
+		AstItem* next = prefix;
+		prefix->Info.Pos = _current.CurrentIndex();
 
-        if( !_current.NextIf( TT_RIGHT_SQUARE ) ) {
-			GenerateError( "Expected ']'" );
-			return false;
+		switch( _current.CurrentType() ) {
+		case TT_POINT : {
+			if( _current.Next() != TT_NAME ) {
+				GenerateError( "Name expected" );
+				return false;
+			}
+
+			prefix->AppendChild( CreateLeaf( AstInfo::Name ) );
+			_current.Next();
+			break;
 		}
+		case TT_LEFT_SQUARE : {
+			_current.Next();
+
+			if( !TryExpression( prefix ) ) {
+				if( _suspended )
+					SavePart( SuffixesPart, start, prefix->Info.Pos, item ).Link = chain;
+				else if( !_failed )
+					GenerateError( "Expected expression" );
+				return false;
+			}
 
-		TryPrefixSubExpression( prefix.data() );
-		break;
-	}
-	case TT_COLON : {
-		// Call with self
-        if( _current.Next() != TT_NAME ) {
-			GenerateError( "Name expected" );
-			return false;
+			if( !_current.NextIf( TT_RIGHT_SQUARE ) ) {
+				GenerateError( "Expected ']'" );
+				return false;
+			}
+			break;
 		}
+		case TT_COLON : {
+			// Call with self
+			if( _current.Next() != TT_NAME ) {
+				GenerateError( "Name expected" );
+				return false;
+			}
 
-		new AstItem( AstInfo::Name, prefix.data() );
-        _current.Next();
+			prefix->AppendChild( CreateLeaf( AstInfo::Name ) );
+			_current.Next();
 
-		AstItem* args = new AstItem( AstInfo::Prefix, prefix.data() );
-		if( !TryArgs( args ) ) {
-			if( !HasError() )
-				GenerateError( "Expected function call" );
-			return false;
+			next = _arena.Create( AstInfo::Prefix, prefix );
+			next->Info.Pos = _current.CurrentIndex();
+			if( !TryArgs( next ) ) {
+				if( _suspended )
+					SavePart( SuffixesPart, start, prefix->Info.Pos, item ).Link = chain;
+				else if( !_failed )
+					GenerateError( "Expected function call" );
+				return false;
+			}
+			break;
+		}
+		default:
+			if( !TryArgs( prefix ) ) {
+				if( _suspended )
+					SavePart( SuffixesPart, start, prefix->Info.Pos, item ).Link = chain;
+				return false;
+			}
 		}
 
-		TryPrefixSubExpression( args );
-		break;
-	}
-	default:
-		if( TryArgs( prefix.data() ) )
-			TryPrefixSubExpression( prefix.data() );
-		else
-			return false;
+		item->AppendChild( prefix );
+		item = next;
+		if( !chain )
+			chain = prefix;
 	}
 
-	if( HasError() )
-		return false;
-
-	item->AppendChild( prefix.take() );
+	const int last = _current.CurrentIndex() - 1;
+	for( AstItem* link = chain; link; ) {
+		SetSpan( link, link->Info.Pos, last );
+		AstItem* child = link->LastChild();
+		link = child->Is( AstInfo::Prefix ) ? child : nullptr;
+	}
 	return true;
 }
 
 bool AstParser2::TryArgs( AstItem* item )
 {
-	QScopedPointer< AstItem > args( new AstItem( AstInfo::Args ) );
+	if( !CanStartArgs( _current.CurrentType() ) )
+		return false;
+
+	const int start = _current.CurrentIndex();
+	AstItem* args = _arena.Create( AstInfo::Args );
 
     switch( _current.CurrentType() ) {
 	case TT_LEFT_BRACKET : {
         _current.Next();
 
-		TryExpressionList( args.data() );
-		if( HasError() )
+		TryExpressionList( args );
+		if( _failed )
 			return false;
 
         if( !_current.NextIf( TT_RIGHT_BRACKET ) ) {
@@ -605,17 +1942,18 @@ bool AstParser2::TryArgs( AstItem* item )
 	case TT_LEFT_CURLY : {
         _current.Next();
 
-		if( !TryConstructor( args.data() ) && HasError() )
+		if( !TryConstructor( args ) && _failed )
 			return false;
 
         if( !_current.NextIf( TT_RIGHT_CURLY ) ) {
 			GenerateError( "Expected '}'" );
 			return false;
 		}
+		SetSpan( args->LastChild(), start, _current.CurrentIndex() - 1 );
 		break;
 	}
 	case TT_STRING : {
-		new AstItem( AstInfo::Literal, args.data() );
+		args->AppendChild( CreateLeaf( AstInfo::Literal ) );
         _current.Next();
 		break;
 	}
@@ -623,36 +1961,56 @@ bool AstParser2::TryArgs( AstItem* item )
 		return false;
 	}
 
-	item->AppendChild( args.take() );
+	item->AppendChild( args );
+	SetSpan( args, start, _current.CurrentIndex() - 1 );
 	return true;
 }
 
 bool AstParser2::TryConstructor( AstItem* item )
 {
-	QScopedPointer< AstItem > constructor( new AstItem( AstInfo::Constructor ) );
+	const int start = _current.CurrentIndex();
+	AstItem* constructor = nullptr;
+	if( const ParsedPart* part = FindPart( FieldsPart ) ) {
+		// statement parsed again goes on from the field of the body
+		constructor = part->Node;
+		_current.Rewind( part->Resume );
+	}
+	else {
+		constructor = _arena.Create( AstInfo::Constructor );
+	}
 
-	while( TryField( constructor.data() ) ) {
+	int field = _current.CurrentIndex();
+	while( TryField( constructor ) ) {
         if( _current.CurrentType() == TT_COMMA
             || _current.CurrentType() == TT_SEMICOLON ) {
             _current.Next();
 		}
+		field = _current.CurrentIndex();
 	}
 
-	if( HasError() )
+	if( _failed ) {
+		if( _suspended && constructor->HasChildren() )
+			SavePart( FieldsPart, start, field, constructor );
 		return false;
+	}
 
-	item->AppendChild( constructor.take() );
+	item->AppendChild( constructor );
 
 	return true;
 }
 
 bool AstParser2::TryField( AstItem* item )
 {
-	QScopedPointer< AstItem > field( new AstItem( AstInfo::Field ) );
+	if( !_current.Is( TT_LEFT_SQUARE ) && !CanStartExpression( _current.CurrentType() ) )
+		return false;
+
+	const int start = _current.CurrentIndex();
+	AstItem* field = _arena.Create( AstInfo::Field );
     if( _current.CurrentType() == TT_LEFT_SQUARE ) {
         _current.Next();
-		if( !TryExpression( field.data() ) ) {
-			if( !HasError() )
+		field->Info.Flags |= AstInfo::BracketKeyFlag;
+		if( !TryExpression( field ) ) {
+			if( !_failed )
 				GenerateError( "Expected expression" );
 			return false;
 		}
@@ -667,16 +2025,16 @@ bool AstParser2::TryField( AstItem* item )
 			return false;
 		}
 
-		if( !TryExpression( field.data() ) ) {
-			if( !HasError() )
+		if( !TryExpression( field ) ) {
+			if( !_failed )
                 GenerateError( "Expected expression after '='" );
 			return false;
 		}
 	}
-    else if( TryExpression( field.data() ) ) {
+    else if( TryExpression( field ) ) {
         if( _current.NextIf( TT_ASSIGN ) ) {
-            if( !TryExpression( field.data() ) ) {
-                if( !HasError() )
+            if( !TryExpression( field ) ) {
+                if( !_failed )
                     GenerateError( "Expected expression after '='" );
                 return false;
             }
@@ -686,121 +2044,266 @@ bool AstParser2::TryField( AstItem* item )
         return false;
     }
 
-	item->AppendChild( field.take() );
+	item->AppendChild( field );
+	SetSpan( field, start, _current.CurrentIndex() - 1 );
 	return true;
 }
 
 bool AstParser2::TryExpressionList( AstItem* item )
 {
-	QScopedPointer< AstItem > list( new AstItem( AstInfo::ExpressionList ) );
-
-	if( !TryExpression( list.data() ) )
+	if( !CanStartExpression( _current.CurrentType() ) )
 		return false;
 
-    while( _current.NextIf( TT_COMMA ) ) {
-		if( !TryExpression( list.data() ) ) {
-			if( !HasError() )
+	const int start = _current.CurrentIndex();
+	AstItem* list = nullptr;
+	if( const ParsedPart* part = FindPart( ListPart ) ) {
+		// statement parsed again goes on from the expression of the body
+		list = part->Node;
+		_current.Rewind( part->Resume );
+	}
+	else {
+		list = _arena.Create( AstInfo::ExpressionList );
+	}
+
+	forever {
+		const int element = _current.CurrentIndex();
+		if( !TryExpression( list ) ) {
+			if( !list->HasChildren() )
+				return false;
+			if( _suspended )
+				SavePart( ListPart, start, element, list );
+			else if( !_failed )
                 GenerateError( "Expected Expression in expression list" );
 			return false;
 		}
+		if( !_current.NextIf( TT_COMMA ) )
+			break;
 	}
 
-	item->AppendChild( list.take() );
+	item->AppendChild( list );
+	SetSpan( list, start, _current.CurrentIndex() - 1 );
 	return true;
 }
 
 
-bool IsBinaryOperator( TokenType type ) {
+struct NestingGuard {
+	explicit NestingGuard( int& depth ) : Depth( depth ) { ++Depth; }
+	~NestingGuard() { --Depth; }
+
+	int& Depth;
+};
+
+struct OperatorPriority {
+	int Left;
+	int Right;
+};
+
+// Lua 5.1 priorities (lparser.c), right priority lower than left one means
+// right associative operator, zero means not a binary operator
+OperatorPriority BinaryPriority( TokenType type ) {
 	switch( type ) {
-	case TT_PLUS : case TT_MINUS : case TT_MAGNIFY : case TT_SLASH : case TT_CARET : case TT_PERCENT :
-	case TT_LESS : case TT_GREAT : case TT_LESS_OR_EQUAL : case TT_GREAT_OR_EQUAL : case TT_EQUAL : case TT_NOT_EQUAL :
-	case TT_AND : case TT_OR: case TT_CONCAT :
-		return true;
+	case TT_OR :
+		return { 1, 1 };
+	case TT_AND :
+		return { 2, 2 };
+	case TT_LESS : case TT_GREAT : case TT_LESS_OR_EQUAL : case TT_GREAT_OR_EQUAL :
+	case TT_EQUAL : case TT_NOT_EQUAL :
+		return { 3, 3 };
+	case TT_CONCAT :
+		return { 5, 4 };
+	case TT_PLUS : case TT_MINUS :
+		return { 6, 6 };
+	case TT_MAGNIFY : case TT_SLASH : case TT_PERCENT :
+		return { 7, 7 };
+	case TT_CARET :
+		return { 10, 9 };
+	default:
+		return { 0, 0 };
 	}
+}
 
-	return false;
+const int UnaryPriority = 8;
+
+bool IsUnaryOperator( TokenType type ) {
+	return type == TT_NOT || type == TT_MINUS || type == TT_NUMBER_SIGN;
+}
+
+// apply the topmost operator to its operands, operator spans from its
+// first operand or from its own token for unary one to its last operand
+void AstParser2::Reduce( QVector< AstItem* >& operands, QVector< PendingOperator >& operators )
+{
+	AstItem* op = operators.last().Item;
+	operators.removeLast();
+
+	AstItem* last = operands.last();
+	if( op->Is( AstInfo::BinaryOperator ) ) {
+		operands.removeLast();
+		op->AppendChild( operands.last() );
+		op->AppendChild( last );
+		op->Info.Pos = operands.last()->Info.Pos;
+	}
+	else {
+		op->AppendChild( last );
+	}
+	op->Info.Size = last->Info.Pos + last->Info.Size - op->Info.Pos;
+	operands.last() = op;
 }
 
+/*
+** Precedence climbing without recursion: operands and operators wait on
+** explicit stacks until an operator with lower priority arrives. Every
+** operator gives one node, the whole expression is wrapped once.
+*/
 bool AstParser2::TryExpression( AstItem* item )
 {
-	QScopedPointer< AstItem > expression( new AstItem( AstInfo::Expression ) );
+	if( !CanStartExpression( _current.CurrentType() ) )
+		return false;
 
-    switch( _current.CurrentType() ) {
-	case TT_NOT : case TT_MINUS : case TT_NUMBER_SIGN : {
-		QScopedPointer< AstItem > unary( new AstItem( AstInfo::UnaryOperator ) );
-        _current.Next();
+	// brackets, constructors and function bodies not nested too deep nest
+	// expressions natively, deeper bodies are parsed on frames
+	const NestingGuard guard( _expressionDepth );
+	if( _expressionDepth > MaxExpressionDepth ) {
+		GenerateError( QString( "Expressions nested deeper than %1 levels" ).arg( int( MaxExpressionDepth ) ) );
+		return false;
+	}
+
+	// also holds each operand while it is parsed
+	const int start = _current.CurrentIndex();
+	AstItem* expression = _arena.Create( AstInfo::Expression );
+
+	// own entries of the parser stacks are above these
+	int operands = _operands.size();
+	int operators = _operators.size();
+	if( const ParsedPart* part = FindPart( OperandsPart ) ) {
+		// statement parsed again goes on from the operand of the body, the
+		// entries it left are still there
+		operands = part->Operands;
+		operators = part->Operators;
+		_current.Rewind( part->Resume );
+	}
+
+	forever {
+		while( IsUnaryOperator( _current.CurrentType() ) ) {
+			const PendingOperator unary = { CreateLeaf( AstInfo::UnaryOperator ), UnaryPriority };
+			_operators.append( unary );
+			_current.Next();
+		}
 
-		if( !TryExpression( unary.data() ) ) {
-			if( !HasError() )
+		const int operand = _current.CurrentIndex();
+		if( !TryOperand( expression ) ) {
+			if( _suspended ) {
+				// entries stay for the statement parsed again
+				ParsedPart& part = SavePart( OperandsPart, start, operand, nullptr );
+				part.Operands = operands;
+				part.Operators = operators;
+				return false;
+			}
+			_operands.resize( operands );
+			_operators.resize( operators );
+			if( !_failed )
 				GenerateError( "Expected expression" );
 			return false;
 		}
-		expression->AppendChild( unary.take() );
+		_operands.append( expression->TakeOnlyChild() );
 
-		break;
+		const OperatorPriority priority = BinaryPriority( _current.CurrentType() );
+		if( !priority.Left )
+			break;
+		_current.Next();
+
+		while( _operators.size() > operators && _operators.last().Right >= priority.Left )
+			Reduce( _operands, _operators );
+
+		const PendingOperator binary = { _arena.Create( AstInfo::BinaryOperator ), priority.Right };
+		_operators.append( binary );
 	}
+
+	while( _operators.size() > operators )
+		Reduce( _operands, _operators );
+
+	expression->AppendChild( _operands.takeLast() );
+	item->AppendChild( expression );
+	SetSpan( expression, start, _current.CurrentIndex() - 1 );
+	return true;
+}
+
+bool AstParser2::TryOperand( AstItem* item )
+{
+    switch( _current.CurrentType() ) {
 	case TT_NIL : case TT_TRUE : case TT_FALSE : case TT_DOTS :
 	case TT_NUMBER : case TT_STRING : {
-		expression->AppendChild( new AstItem( AstInfo::Literal ) );
+		item->AppendChild( CreateLeaf( AstInfo::Literal ) );
         _current.Next();
-		break;
+		return true;
 	}
 	case TT_FUNCTION : {
         _current.Next();
 
-		if( !ShouldFunctionBody( expression.data() ) )
+		// statement parsed again takes bodies closed before
+		const QVector< ParsedBody >::const_iterator parsed
+				= std::lower_bound( _bodies.constBegin(), _bodies.constEnd(), _current.CurrentIndex(), BodyBefore );
+		if( parsed != _bodies.constEnd() && parsed->Token == _current.CurrentIndex() ) {
+			_current.Rewind( parsed->Next );
+			if( !parsed->Closed ) {
+				_failed = true;
+				return false;
+			}
+			item->AppendChild( parsed->Body );
+			return true;
+		}
+
+		// shallow body inside of expression is parsed right here by own loop
+		if( _bodyDepth < NativeBodyDepth ) {
+			const NestingGuard guard( _bodyDepth );
+			const int base = _frames.size();
+			return ShouldFunctionBody( item ) && ParseBlocks( base );
+		}
+
+		// deeper body goes on a frame of its own for the nearest ParseBlocks,
+		// the statement fails quietly up to there; parts saved for its last
+		// body are used up, constructs around this one save theirs anew
+		while( !_parts.isEmpty() && _parts.last().Depth >= _frames.size() )
+			_parts.removeLast();
+		if( !ShouldFunctionBody( item ) )
 			return false;
-		break;
+		_suspended = true;
+		_failed = true;
+		return false;
 	}
 	case TT_LEFT_CURLY : {
+		const int start = _current.CurrentIndex();
         _current.Next(); // skip '{'
 
-		if( !TryConstructor( expression.data() ) && HasError() )
+		if( !TryConstructor( item ) && _failed )
 			return false;
 
         if( !_current.NextIf( TT_RIGHT_CURLY ) ) {
             GenerateError( "Expected '}' to close constructor" );
 			return false;
 		}
-		break;
+		SetSpan( item->LastChild(), start, _current.CurrentIndex() - 1 );
+		return true;
 	}
 	default:
-		if( !TryPrefixExpression( expression.data() ) )
-			return false;
-	}
-
-    if( IsBinaryOperator( _current.CurrentType() ) ) {
-        _current.Next();
-
-		QScopedPointer< AstItem > newBinaryExpression( new AstItem( AstInfo::Expression ) );
-		AstItem* binary = new AstItem( AstInfo::BinaryOperator, newBinaryExpression.data() );
-		if( !TryExpression( binary ) ) {
-			if( !HasError() )
-				GenerateError( "Expected expression" );
-			return false;
-		}
-
-		binary->AppendChild( expression.take() );
-		item->AppendChild( newBinaryExpression.take() );
-		return true;
+		return TryPrefixExpression( item );
 	}
-
-	item->AppendChild( expression.take() );
-
-	return true;
 }
 
+/*
+** parses parameters and opens frame for the body block
+*/
 bool AstParser2::ShouldFunctionBody( AstItem* item )
 {
-	QScopedPointer< AstItem > functionBody( new AstItem( AstInfo::FunctionBody ) );
+	AstItem* functionBody = _arena.Create( AstInfo::FunctionBody );
+	const int start = _current.CurrentIndex();
 
     if( !_current.NextIf( TT_LEFT_BRACKET ) ) {
 		GenerateError( "Expected '(' to define arguments in function body" );
 		return false;
 	}
 
-	TryFunctionParams( functionBody.data() );
-	if( HasError() )
+	TryFunctionParams( functionBody );
+	if( _failed )
 		return false;
 
     if( !_current.NextIf( TT_RIGHT_BRACKET ) ) {
@@ -808,16 +2311,10 @@ bool AstParser2::ShouldFunctionBody( AstItem* item )
 		return false;
 	}
 
-	TryBlock( functionBody.data() );
-	if( HasError() )
-		return false;
-
-    if( !_current.NextIf( TT_END ) ) {
-		GenerateError( "Expected 'end' statement to close function body" );
+	item->AppendChild( functionBody );
+	if( !OpenBlock( functionBody, !item->Is( AstInfo::Expression ) ) )
 		return false;
-	}
-
-	item->AppendChild( functionBody.take() );
+	_frames.last().OwnerStart = start;
 	return true;
 }
 
@@ -842,12 +2339,12 @@ bool AstParser2::TryFunctionParams( AstItem* item )
 bool AstParser2::TryFunctionParam( AstItem* item )
 {
     if( _current.CurrentType() == TT_NAME )	 {
-		new AstItem( AstInfo::Name, item );
+		item->AppendChild( CreateLeaf( AstInfo::Name ) );
         _current.Next();
 		return true;
 	}
     else if( _current.CurrentType() == TT_DOTS ) {
-		new AstItem( AstInfo::Dots, item );
+		item->AppendChild( CreateLeaf( AstInfo::Dots ) );
         _current.Next();
 		return true;
 	}
@@ -861,7 +2358,7 @@ bool AstParser2::ShouldNameList( AstItem* item )
 		GenerateError( "Expected name after 'for/local' keyword" );
 		return false;
 	}
-	item->AppendChild( new AstItem( AstInfo::Name ) );
+	item->AppendChild( CreateLeaf( AstInfo::Name ) );
     _current.Next(); // skip name
 
     while( _current.NextIf( TT_COMMA ) ) {
@@ -869,24 +2366,64 @@ bool AstParser2::ShouldNameList( AstItem* item )
 			GenerateError( "Expected name after ',' in 'for/local' statement" );
 			return false;
 		}
-		item->AppendChild( new AstItem( AstInfo::Name ) );
+		item->AppendChild( CreateLeaf( AstInfo::Name ) );
         _current.Next(); // skip name
 	}
 
 	return true;
 }
 
-void AstParser2::GenerateError( const QString& description )
+/*
+** node spanning the current token only, names get their symbol unless
+** nobody sees them, as in a syntax check without listeners
+*/
+AstItem* AstParser2::CreateLeaf( AstInfo::Type type )
 {
-	if( _error.size() > 0 )
-		qFatal( "error rethrow" );
+	AstItem* item = _arena.Create( type );
+	SetSpan( item, _current.CurrentIndex(), _current.CurrentIndex() );
 
-	QString error( "Error: " );
-	error.append( description ).append( "\n" )
-			.append( "at pos: " ).append( QString::number( _current.CurrentPos() ) )
-			.append( ", line: " ).append( QString::number( _current.CurrentLine() ) )
-			.append( "\ntext: ").append( _current.CurrentType() == TT_END_OF_FILE ? "End of file" : _current.CurrentString() );
+	if( type == AstInfo::Name && ( !_stopAtProblem || !_listeners.isEmpty() ) ) {
+		const int index = _current.CurrentIndex();
+		item->Info.Symbol = _interner->Intern( _source.constData() + _tokens.Offset( index ), _tokens.Length( index ) );
+		if( _stopIndex >= 0 )
+			_segmentNames.append( item );
+	}
+	return item;
+}
+
+/*
+** reports problem and fails the statement being parsed
+*/
+void AstParser2::GenerateError( const QString& description )
+{
+	ReportError( description );
+	_failed = true;
+}
 
-	_error = error;
-	qDebug( qPrintable( error ) );
+/*
+** reports problem the parser can go on after
+*/
+void AstParser2::ReportError( const QString& description )
+{
+	// statement failing for a function body is not wrong
+	if( _suspended )
+		return;
+
+	// closing of several blocks at end of file fails at the same token
+	if( !_diagnostics.isEmpty() && _diagnostics.last().Pos == _current.CurrentPos() )
+		return;
+
+	Diagnostic diagnostic;
+	diagnostic.Description = description;
+	diagnostic.Pos = _current.CurrentPos();
+	diagnostic.Size = _tokens.Length( _current.CurrentIndex() );
+	diagnostic.Line = _current.CurrentLine();
+	diagnostic.Column = _tokens.Column( diagnostic.Pos ) + 1;
+	_diagnostics.append( diagnostic );
+
+	// validation needs the first problem only
+	if( _stopAtProblem ) {
+		_cancelled = true;
+		_failed = true;
+	}
 }
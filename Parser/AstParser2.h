@@ -1,26 +1,176 @@
 #ifndef ASTPARSER_2_H
 #define ASTPARSER_2_H
 
-#include "Lexer/Lexer2.h"
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSharedPointer>
 
-#include "Data/AstItem.h"
+#include "Lexer/TokenBuffer.h"
+#include "Parser/AstListener.h"
+#include "Parser/CancelToken.h"
+
+#include "Data/AstArena.h"
+#include "Data/AstTree.h"
+#include "Data/Diagnostic.h"
+#include "Data/StringInterner.h"
 
 class AstParser2
 {
 public:
 	AstParser2( const QString& source );
+	AstParser2( const QString& source, const TokenBuffer& tokens );
 
 	bool Parse();
+	bool Validate();
+	bool Stream();
+	bool Reparse( const QString& source, int position, int removed, int added,
+				  const QVector< LineTokens >& lexed = QVector< LineTokens >(),
+				  int firstLine = 0, int removedLines = -1 );
 
 	bool HasError() const;
 	QString Error() const;
+	const QVector< Diagnostic >& Diagnostics() const;
 
 	AstItem* Result();
+	const AstSplice& Splice() const;
+	const TokenBuffer& Tokens() const;
+	const StringInterner& Interner() const;
 
 	QString Debug();
 
+	void SetMaxDepth( int depth );
+	void SetCancelToken( const CancelToken* token );
+	void SetTimeBudget( int milliseconds );
+	void SetParallel( bool parallel );
+	void AddListener( AstListener* listener );
+	void SetInterner( StringInterner* interner );
+
+	bool IsCancelled() const;
+	bool IsParsed() const;
+
+private:
+	// Lua itself does not allow more nested C calls (LUAI_MAXCCALLS)
+	enum { MaxExpressionDepth = 200 };
+
+	// function bodies of expressions inside of this many such bodies go on
+	// frames of ParseBlocks instead of native recursion
+	enum { NativeBodyDepth = 8 };
+
+	// statements between looks at cancel token and clock
+	enum { CheckInterval = 32 };
+
+	// tokens of a top level segment parsed on its own thread, at least
+	enum { MinSegmentTokens = 1 << 14 };
+
+	// symbols interned since the last full parse beyond its own count and
+	// this many make the next Reparse a full one with a new interner
+	enum { SymbolSlack = 1024 };
+
+	// token indexes the spans of a frame start at, -1 while unknown
+	struct BlockFrame {
+		AstItem*	Owner;
+		AstItem*	Block;
+		bool		Statement;
+		bool		Else;
+
+		int			Start;
+		int			OwnerStart;
+		int			BlockStart;
+
+		// function body of an expression: token its statement is parsed
+		// again from once the body is closed, -1 for other frames
+		int			Resume;
+	};
+
+	// constructs that keep what they have built when a deep body suspends
+	// their statement
+	enum PartKind {
+		ListPart,
+		FieldsPart,
+		OperandsPart,
+		PrefixPart,
+		SuffixesPart
+	};
+
+	// closed function body of an expression kept while its statement is
+	// parsed again: Token is its '(', Next the token behind it and Depth
+	// the number of frames around the statement
+	struct ParsedBody {
+		AstItem*	Body;
+		int			Token;
+		int			Next;
+		int			Depth;
+		bool		Closed;
+	};
+
+	// construct starting at Token of a statement suspended for a deep body:
+	// Node holds what it has built, it goes on from token Resume once the
+	// statement is parsed again. Depth is the number of frames around the
+	// statement. Suffix chains keep the link the next suffix goes to in
+	// Node and the first link in Link, expressions where their entries
+	// on the parser stacks start.
+	struct ParsedPart {
+		int			Token;
+		PartKind	Kind;
+		int			Resume;
+		int			Depth;
+		AstItem*	Node;
+		AstItem*	Link;
+		int			Operands;
+		int			Operators;
+	};
+
+	// operator waiting on the stack for its right operand
+	struct PendingOperator {
+		AstItem*	Item;
+		int			Right;
+	};
+
+	// statements of a block with first tokens relative to the block start,
+	// kept for blocks Reparse went through to find statements by position
+	struct BlockIndex {
+		QVector< AstItem* >	Items;
+		QVector< int >		Starts;
+	};
+
+	// top level statements from token First up to Stop, parsed by a parser
+	// of their own, Parsed when the last one ended right before Stop
+	struct Segment {
+		int			First;
+		int			Stop;
+		bool		Parsed;
+		QSharedPointer< AstParser2 > Parser;
+	};
+
 private:
-	bool TryBlock				( AstItem* item );
+	bool ParseBlocks			( int base );
+	bool OpenBlock				( AstItem* owner, bool statement );
+	bool CloseBlock				();
+	void CloseFrame				( int blockEnd, int ownerEnd );
+	void Synchronize			( int start );
+	bool Resumes				( int start );
+	static bool BodyBefore		( const ParsedBody& body, int token );
+	const ParsedPart* FindPart	( PartKind kind ) const;
+	ParsedPart& SavePart		( PartKind kind, int token, int resume, AstItem* node );
+	bool IsInterrupted			();
+
+	void ParseSegments			();
+	QVector< int > FindCuts		( int count ) const;
+	bool ParseSegment			( int first, int stop );
+	static void ParseSegmentTask( Segment& segment );
+
+	void BeginEvents			();
+	void FlushStatements		();
+	void EmitSubtree			( const AstItem* root );
+	void EmitTokens				( int end );
+	void EndEvents				();
+
+	bool ReparseBlock			( const TokenDelta& delta, int position, int charDelta, int lineDelta );
+	BlockIndex& IndexOf			( AstItem* block );
+	void ResetTree				();
+	void ResetSymbols			();
+	bool HasStaleSymbols		() const;
+
 	bool TryStatement			( AstItem* item );
 	bool TryLastStatement		( AstItem* item );
 
@@ -34,6 +184,7 @@ private:
 	bool TryCallOrAssign		( AstItem* item );
 
 	bool TryPrefixExpression	( AstItem* item );
+	bool TryPrefixStart			( AstItem* prefix );
 	bool TryPrefixSubExpression	( AstItem* item );
 	bool TryArgs				( AstItem* item );
 	bool TryConstructor			( AstItem* item );
@@ -41,6 +192,7 @@ private:
 
 	bool TryExpressionList		( AstItem* item );
 	bool TryExpression			( AstItem* item );
+	bool TryOperand				( AstItem* item );
 
 	bool ShouldFunctionBody		( AstItem* item );
 	bool TryFunctionParams		( AstItem* item );
@@ -48,17 +200,70 @@ private:
 
 	bool ShouldNameList			( AstItem* item );
 
+	AstItem* CreateLeaf			( AstInfo::Type type );
+
 private:
 	void GenerateError( const QString& description );
+	void ReportError( const QString& description );
+
+	static void SetSpan		( AstItem* item, int first, int last );
+	static void Reduce		( QVector< AstItem* >& operands, QVector< PendingOperator >& operators );
+	static void MakeRelative( AstItem* item, int anchor );
+	static void ShiftSpans	( AstItem* item, int delta );
 
 private:
-	Lexer2 _current;
+	QString _source;
+
+	TokenBuffer _tokens;
+	TokenCursor _current;
+
+	QVector< Diagnostic > _diagnostics;
+	bool _failed;
+	AstSplice _splice;
+
+	QVector< BlockFrame > _frames;
+	QVector< ParsedBody > _bodies;
+	QVector< ParsedPart > _parts;
+
+	// stacks of the expressions being parsed, entries of a suspended
+	// statement stay until it goes on
+	QVector< AstItem* > _operands;
+	QVector< PendingOperator > _operators;
+
+	bool _suspended;
+	int _maxDepth;
+	int _expressionDepth;
+	int _bodyDepth;
+
+	const CancelToken* _cancelToken;
+	int _timeBudget;
+	QElapsedTimer _timer;
+	int _checkCountdown;
+	bool _cancelled;
+
+	bool _parallel;
+	int _stopIndex;
+
+	// main chunk statements are forgotten back to this arena watermark
+	// when done, -1 keeps the tree
+	int _statementMark;
+	bool _stopAtProblem;
 
-	const QString _source;
+	QVector< AstListener* > _listeners;
+	const AstItem* _emitted;
+	int _emittedToken;
 
-	QString _error;
+	// names of a segment parse keep symbols of its own interner until
+	// the parser owning the tree merges them
+	StringInterner _ownInterner;
+	StringInterner* _interner;
+	int _parsedSymbols;
+	QVector< AstItem* > _segmentNames;
 
-	AstItem _global;
+	AstArena _arena;
+	AstItem* _global;
+	bool _parsed;
+	QHash< const AstItem*, BlockIndex > _indexes;
 };
 
 #endif // ASTPARSER_2_H
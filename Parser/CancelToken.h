@@ -0,0 +1,23 @@
+#ifndef CANCEL_TOKEN_H
+#define CANCEL_TOKEN_H
+
+#include <QAtomicInt>
+
+/*
+** Flag a parse running on another thread polls to stop early
+*/
+class CancelToken
+{
+public:
+	CancelToken() : _cancelled( 0 ) {}
+
+	void Cancel() { _cancelled.storeRelease( 1 ); }
+	bool IsCancelled() const { return _cancelled.loadAcquire() != 0; }
+
+private:
+	Q_DISABLE_COPY( CancelToken )
+
+	QAtomicInt _cancelled;
+};
+
+#endif // CANCEL_TOKEN_H
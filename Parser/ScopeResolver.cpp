@@ -0,0 +1,357 @@
+#include "ScopeResolver.h"
+
+#include "Data/AstTree.h"
+#include "Data/StringInterner.h"
+
+ScopeResolver::ScopeResolver() :
+	_tree( nullptr ),
+	_selfSymbol( StringInterner::NoSymbol ),
+	_target( AstTree::NoNode ),
+	_inside( false )
+{
+}
+
+/*
+** one pass over the whole tree
+*/
+void ScopeResolver::Resolve( const AstTree& tree, const StringInterner& symbols )
+{
+	ResolveFunction( tree, symbols, AstTree::NoNode );
+}
+
+/*
+** names inside of body only, all names for NoNode
+*/
+void ScopeResolver::ResolveFunction( const AstTree& tree, const StringInterner& symbols, int body )
+{
+	_tree = &tree;
+
+	const QString self( "self" );
+	_selfSymbol = symbols.Find( self.constData(), self.size() );
+
+	_kinds.fill( NotName, tree.Count() );
+	_declarationOf.fill( NoDeclaration, tree.Count() );
+	_declarations.clear();
+	_scopes.clear();
+	_innermost.fill( NoDeclaration, symbols.Count() );
+
+	Run( body );
+
+	_tree = nullptr;
+}
+
+void ScopeResolver::Clear()
+{
+	_kinds.clear();
+	_declarationOf.clear();
+	_declarations.clear();
+	_scopes.clear();
+	_innermost.clear();
+}
+
+int ScopeResolver::DeclarationCount() const
+{
+	return _declarations.size();
+}
+
+const ScopeResolver::Declaration& ScopeResolver::DeclarationAt( int declaration ) const
+{
+	return _declarations[ declaration ];
+}
+
+int ScopeResolver::ScopeCount() const
+{
+	return _scopes.size();
+}
+
+const ScopeResolver::Scope& ScopeResolver::ScopeAt( int scope ) const
+{
+	return _scopes[ scope ];
+}
+
+/*
+** Depth first walk over the flat tree. Children of a node are stored one
+** after another, so for every node gone into the walk keeps the range of
+** its children left; Enter tells where the range starts.
+*/
+void ScopeResolver::Run( int target )
+{
+	_path.clear();
+	for( int node = target; node != AstTree::NoNode; node = _tree->Parent( node ) )
+		_path.append( node );
+	_target = target;
+	_inside = target == AstTree::NoNode;
+
+	_shadowed.clear();
+	_visible.clear();
+	_openScopes.clear();
+	_scopeMarks.clear();
+
+	// main chunk is a function of its own
+	OpenScope( AstTree::RootNode, true );
+
+	QVarLengthArray< Range, 64 > ranges;
+	const AstNode& root = _tree->Node( AstTree::RootNode );
+	const int first = Enter( AstTree::RootNode );
+	if( first != SkipNode ) {
+		const Range range = { AstTree::RootNode, first, root.FirstChild + root.ChildrenCount };
+		ranges.append( range );
+	}
+	while( !ranges.isEmpty() ) {
+		Range& top = ranges.last();
+		if( top.Next >= top.End ) {
+			const int node = top.Node;
+			ranges.removeLast();
+			Leave( node );
+			continue;
+		}
+
+		// leaves hold no names to look at, names are looked at by parents
+		const int node = top.Next++;
+		const AstNode& item = _tree->Node( node );
+		if( item.ChildrenCount == 0 )
+			continue;
+
+		const int next = Enter( node );
+		if( next == SkipNode )
+			continue;
+		const Range range = { node, next, item.FirstChild + item.ChildrenCount };
+		ranges.append( range );
+	}
+
+	CloseScope();
+}
+
+/*
+** Opens scopes and declares what is visible in the subtree, returns the
+** first child to walk, the ones before it are passed by. SkipNode passes
+** by the whole node, it is not left either.
+*/
+int ScopeResolver::Enter( int node )
+{
+	const AstNode& item = _tree->Node( node );
+	const AstInfo::Type type = item.Info.AstType;
+	if( !_inside ) {
+		if( node == _target ) {
+			_inside = true;
+		}
+		else if( !IsOnPath( node ) ) {
+			// only locals of statements before the path are visible in it,
+			// those of a 'repeat' block in its 'until' expression too
+			if( type == AstInfo::LocalStatement )
+				DeclareNames( node );
+			else if( type == AstInfo::Block && _tree->Node( item.Parent ).Info.AstType == AstInfo::RepeatStatement
+					 && _tree->Node( item.Parent ).FirstChild == node ) {
+				OpenScope( node, false );
+				for( int child = item.FirstChild; child < item.FirstChild + item.ChildrenCount; ++child ) {
+					if( _tree->Node( child ).Info.AstType == AstInfo::LocalStatement )
+						DeclareNames( child );
+				}
+			}
+			return SkipNode;
+		}
+	}
+
+	const int count = item.ChildrenCount;
+	const int last = item.FirstChild + count - 1;
+
+	switch( type ) {
+	case AstInfo::Block : {
+		// scope of a 'for' holds its variables, the block scope is inside
+		const int parent = item.Parent;
+		const AstInfo::Type parentType = _tree->Node( parent ).Info.AstType;
+		if( parentType == AstInfo::ForIndexStatement || parentType == AstInfo::ForIteratorStatement ) {
+			OpenScope( parent, false );
+			DeclareNames( parent );
+		}
+		OpenScope( node, false );
+		return item.FirstChild;
+	}
+	case AstInfo::FunctionBody : {
+		OpenScope( node, true );
+		const int parent = item.Parent;
+		const AstNode& statement = _tree->Node( parent );
+		if( statement.Info.AstType == AstInfo::FunctionStatement && ( statement.Info.Flags & AstInfo::MethodFlag ) )
+			Declare( node, _selfSymbol );
+
+		// parameters come before the block
+		for( int child = item.FirstChild; child <= last; ++child ) {
+			const AstInfo::Type childType = _tree->Node( child ).Info.AstType;
+			if( childType == AstInfo::Name )
+				Declare( child, _tree->Node( child ).Info.Symbol );
+			else if( childType == AstInfo::Block )
+				return child;
+		}
+		return last + 1;
+	}
+	case AstInfo::LocalStatement : {
+		// 'local function' sees itself, 'local x = x' sees the outer x
+		// and declares when left
+		if( _tree->Node( last ).Info.AstType == AstInfo::FunctionBody ) {
+			DeclareNames( node );
+			return last;
+		}
+		return _tree->Node( last ).Info.AstType != AstInfo::Name ? last : last + 1;
+	}
+	case AstInfo::FunctionStatement :
+		// 'function a.b:c()' refers to a only
+		if( _inside )
+			Reference( item.FirstChild );
+		return _tree->Node( last ).Info.AstType == AstInfo::FunctionBody ? last : last + 1;
+	case AstInfo::ForIndexStatement :
+	case AstInfo::ForIteratorStatement : {
+		// variables are visible in the body only
+		int child = item.FirstChild;
+		while( child <= last && _tree->Node( child ).Info.AstType == AstInfo::Name )
+			++child;
+		return child;
+	}
+	case AstInfo::Prefix :
+		// names of suffixes are fields and methods, the first name of a
+		// whole prefix chain is a variable
+		if( _inside && _tree->Node( item.FirstChild ).Info.AstType == AstInfo::Name
+				&& _tree->Node( item.Parent ).Info.AstType != AstInfo::Prefix )
+			Reference( item.FirstChild );
+		return item.FirstChild;
+	case AstInfo::Field :
+		// key of 'name = value' field is no variable
+		if( count == 2 && !( item.Info.Flags & AstInfo::BracketKeyFlag ) )
+			return item.FirstChild + 1;
+		return item.FirstChild;
+	default:
+		return item.FirstChild;
+	}
+}
+
+/*
+** closes scopes Enter opened, 'until' expression of 'repeat' is inside
+** of the block scope
+*/
+void ScopeResolver::Leave( int node )
+{
+	const AstNode& item = _tree->Node( node );
+	switch( item.Info.AstType ) {
+	case AstInfo::Block : {
+		const AstNode& parent = _tree->Node( item.Parent );
+		if( parent.Info.AstType != AstInfo::RepeatStatement || parent.FirstChild != node )
+			CloseScope();
+		break;
+	}
+	case AstInfo::RepeatStatement :
+		// an empty block opened no scope
+		if( _scopes[ _openScopes.last() ].Node == item.FirstChild )
+			CloseScope();
+		break;
+	case AstInfo::FunctionBody :
+		CloseScope();
+		break;
+	case AstInfo::LocalStatement :
+		if( item.ChildrenCount == 0
+				|| _tree->Node( item.FirstChild + item.ChildrenCount - 1 ).Info.AstType != AstInfo::FunctionBody )
+			DeclareNames( node );
+		break;
+	case AstInfo::ForIndexStatement :
+	case AstInfo::ForIteratorStatement :
+		// the scope of variables without a block walked is opened here
+		if( _scopes[ _openScopes.last() ].Node != node ) {
+			OpenScope( node, false );
+			DeclareNames( node );
+		}
+		CloseScope();
+		break;
+	default:
+		break;
+	}
+
+	if( node == _target )
+		_inside = false;
+}
+
+void ScopeResolver::OpenScope( int node, bool function )
+{
+	Scope scope;
+	scope.Node = node;
+	scope.Parent = _openScopes.isEmpty() ? int( NoScope ) : _openScopes.last();
+	scope.Function = function ? _scopes.size() : _scopes[ scope.Parent ].Function;
+
+	_openScopes.append( _scopes.size() );
+	_scopeMarks.append( _visible.size() );
+	_scopes.append( scope );
+}
+
+/*
+** declarations of the innermost scope give their symbols back to the
+** ones they shadowed
+*/
+void ScopeResolver::CloseScope()
+{
+	const int mark = _scopeMarks.last();
+	_scopeMarks.removeLast();
+	_openScopes.removeLast();
+
+	while( _visible.size() > mark ) {
+		const int declaration = _visible.last();
+		_visible.removeLast();
+		_innermost[ _declarations[ declaration ].Symbol ] = _shadowed[ declaration ];
+	}
+}
+
+void ScopeResolver::Declare( int node, int symbol )
+{
+	if( symbol < 0 || symbol >= _innermost.size() )
+		return;
+
+	const int declaration = _declarations.size();
+	Declaration item;
+	item.Node = node;
+	item.Scope = _openScopes.last();
+	item.Symbol = symbol;
+	_declarations.append( item );
+
+	_shadowed.append( _innermost[ symbol ] );
+	_innermost[ symbol ] = declaration;
+	_visible.append( declaration );
+
+	if( _tree->Node( node ).Info.AstType == AstInfo::Name ) {
+		_kinds[ node ] = DeclarationName;
+		_declarationOf[ node ] = declaration;
+	}
+}
+
+/*
+** leading names of a statement, the variables of 'local' and 'for'
+*/
+void ScopeResolver::DeclareNames( int node )
+{
+	const AstNode& item = _tree->Node( node );
+	const int last = item.FirstChild + item.ChildrenCount - 1;
+	for( int child = item.FirstChild; child <= last; ++child ) {
+		const AstNode& name = _tree->Node( child );
+		if( name.Info.AstType != AstInfo::Name )
+			break;
+		Declare( child, name.Info.Symbol );
+	}
+}
+
+void ScopeResolver::Reference( int node )
+{
+	const int symbol = _tree->Node( node ).Info.Symbol;
+	const int declaration = symbol >= 0 && symbol < _innermost.size() ? _innermost[ symbol ] : int( NoDeclaration );
+	if( declaration == NoDeclaration ) {
+		_kinds[ node ] = GlobalName;
+		return;
+	}
+
+	const int function = _scopes[ _openScopes.last() ].Function;
+	_kinds[ node ] = _scopes[ _declarations[ declaration ].Scope ].Function == function ? LocalName : UpvalueName;
+	_declarationOf[ node ] = declaration;
+}
+
+bool ScopeResolver::IsOnPath( int node ) const
+{
+	for( int i = 0; i < _path.size(); ++i ) {
+		if( _path[ i ] == node )
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,129 @@
+#ifndef SCOPE_RESOLVER_H
+#define SCOPE_RESOLVER_H
+
+#include <QVarLengthArray>
+#include <QVector>
+
+class AstTree;
+class StringInterner;
+
+/*
+** Binds Name nodes of an AstTree to the local declarations they refer to,
+** following Lua scoping: a local is visible from the statement after its
+** declaration ('local function' from its own body on), parameters and
+** 'for' variables in their body only, and 'repeat' locals in the 'until'
+** expression too. Methods get an implicit 'self'.
+**
+** Results live in flat arrays indexed by tree node: kind and declaration
+** of every Name. Declarations and scopes are numbered in the order the
+** pass meets them, each scope knows its parent and the function scope it
+** belongs to.
+** The pass walks the tree on a stack of children ranges, deep nesting
+** uses no native stack; nodes act when entered and when left. Lookup
+** is one array access by interned symbol, shadowed declarations are
+** brought back when their scope closes. Methods and bracketed table keys
+** are told by AstInfo flags the parser sets.
+**
+** ResolveFunction handles a single function body: only the declarations
+** visible at its start are collected on the way down to it, the rest of
+** the tree is skipped.
+*/
+class ScopeResolver
+{
+public:
+	enum Kind {
+		NotName,
+		DeclarationName,
+		LocalName,
+		UpvalueName,
+		GlobalName
+	};
+
+	enum { NoScope = -1, NoDeclaration = -1 };
+
+	struct Scope {
+		int		Node;
+		int		Parent;
+		int		Function;
+	};
+
+	// implicit 'self' has the function body as node
+	struct Declaration {
+		int		Node;
+		int		Scope;
+		int		Symbol;
+	};
+
+	ScopeResolver();
+
+	void		Resolve			( const AstTree& tree, const StringInterner& symbols );
+	void		ResolveFunction	( const AstTree& tree, const StringInterner& symbols, int body );
+	void		Clear			();
+
+	Kind		KindOf			( int node ) const;
+	int			DeclarationOf	( int node ) const;
+
+	int			DeclarationCount() const;
+	const Declaration&	DeclarationAt( int declaration ) const;
+
+	int			ScopeCount		() const;
+	const Scope&	ScopeAt		( int scope ) const;
+
+private:
+	// Enter result for a subtree the walk does not go into
+	enum { SkipNode = -2 };
+
+	// children of Node left to walk
+	struct Range {
+		int		Node;
+		int		Next;
+		int		End;
+	};
+
+	void		Run				( int target );
+	int			Enter			( int node );
+	void		Leave			( int node );
+
+	void		OpenScope		( int node, bool function );
+	void		CloseScope		();
+	void		Declare			( int node, int symbol );
+	void		DeclareNames	( int node );
+	void		Reference		( int node );
+
+	bool		IsOnPath		( int node ) const;
+
+private:
+	const AstTree*	_tree;
+	int				_selfSymbol;
+
+	QVector< quint8 >	_kinds;
+	QVector< int >		_declarationOf;
+	QVector< Declaration >	_declarations;
+	QVector< Scope >	_scopes;
+
+	// state of a pass: innermost declaration by symbol, the one it
+	// shadowed by declaration, declarations of open scopes
+	QVector< int >		_innermost;
+	QVector< int >		_shadowed;
+	QVector< int >		_visible;
+	QVector< int >		_openScopes;
+	QVector< int >		_scopeMarks;
+
+	// nodes from the root down to the function ResolveFunction looks at,
+	// names are resolved inside of it only
+	QVarLengthArray< int, 64 >	_path;
+	int				_target;
+	bool			_inside;
+};
+
+inline ScopeResolver::Kind ScopeResolver::KindOf( int node ) const
+{
+	return static_cast< Kind >( _kinds[ node ] );
+}
+
+inline int ScopeResolver::DeclarationOf( int node ) const
+{
+	return _declarationOf[ node ];
+}
+
+#endif // SCOPE_RESOLVER_H
@@ -0,0 +1,117 @@
+#include <QString>
+#include <QVector>
+#include <QtTest>
+
+#include "Data/AstItem.h"
+#include "Lexer/TokenBuffer.h"
+#include "Parser/AstParser2.h"
+
+/*
+** AstParser2 over one statement with a 100k-term binary expression, the
+** way generated code builds strings and sums. 'concat' is a right
+** associative chain of '..', 'sum' a left associative one of '+' and
+** 'mixed' cycles through operators of every priority. Tokens are lexed
+** once, the benchmark measures parsing alone.
+*/
+class ConcatBench : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+
+	void Parse_data();
+	void Parse();
+
+private:
+	enum { Terms = 100000 };
+
+	static QString	Generate		( const char* const* operators, int count );
+	static int		CountOperators	( const AstItem* root );
+
+private:
+	QString			_sources[ 3 ];
+	TokenBuffer		_tokens[ 3 ];
+};
+
+namespace {
+
+const char* const Concat[] = { " .. " };
+const char* const Sum[] = { " + " };
+const char* const Mixed[] = { " .. ", " + ", " * ", " ^ ", " == ", " and ", " - ", " / ", " or ", " < " };
+
+} // namespace
+
+void ConcatBench::initTestCase()
+{
+	_sources[ 0 ] = Generate( Concat, 1 );
+	_sources[ 1 ] = Generate( Sum, 1 );
+	_sources[ 2 ] = Generate( Mixed, int( sizeof( Mixed ) / sizeof( Mixed[ 0 ] ) ) );
+
+	for( int i = 0; i < 3; ++i )
+		_tokens[ i ] = TokenBuffer( _sources[ i ] );
+}
+
+void ConcatBench::Parse_data()
+{
+	QTest::addColumn< int >( "source" );
+
+	QTest::newRow( "concat" ) << 0;
+	QTest::newRow( "sum" ) << 1;
+	QTest::newRow( "mixed" ) << 2;
+}
+
+void ConcatBench::Parse()
+{
+	QFETCH( int, source );
+
+	bool parsed = false;
+	int operators = 0;
+	QBENCHMARK {
+		AstParser2 parser( _sources[ source ], _tokens[ source ] );
+		parsed = parser.Parse();
+		operators = CountOperators( parser.Result() );
+	}
+	QVERIFY( parsed );
+	QCOMPARE( operators, Terms - 1 );
+}
+
+/*
+** "local s = x0 .. x1 .. ..." with the operators taken in turn
+*/
+QString ConcatBench::Generate( const char* const* operators, int count )
+{
+	QString source;
+	source.reserve( Terms * 10 );
+	source += QLatin1String( "local s = x0" );
+	for( int i = 1; i < Terms; ++i ) {
+		source += QLatin1String( operators[ i % count ] );
+		source += QLatin1Char( 'x' );
+		source += QString::number( i );
+	}
+	source += QLatin1Char( '\n' );
+	return source;
+}
+
+/*
+** BinaryOperator nodes, walked with an explicit stack, a right
+** associative chain is as deep as it is long
+*/
+int ConcatBench::CountOperators( const AstItem* root )
+{
+	int count = 0;
+	QVector< const AstItem* > pending;
+	pending.append( root );
+	while( !pending.isEmpty() ) {
+		const AstItem* item = pending.takeLast();
+		if( item->Is( AstInfo::BinaryOperator ) )
+			++count;
+		for( const AstItem* child = item->FirstChild(); child; child = child->Next() )
+			pending.append( child );
+	}
+	return count;
+}
+
+QTEST_APPLESS_MAIN( ConcatBench )
+
+#include "ConcatBench.moc"
@@ -0,0 +1,6 @@
+include( ../bench.pri )
+
+TARGET = ConcatBench
+
+SOURCES +=              \
+	ConcatBench.cpp     \
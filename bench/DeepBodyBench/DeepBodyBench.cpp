@@ -0,0 +1,111 @@
+#include <QString>
+#include <QVector>
+#include <QtTest>
+
+#include "Data/AstItem.h"
+#include "Lexer/TokenBuffer.h"
+#include "Parser/AstParser2.h"
+
+/*
+** AstParser2 over one statement holding thousands of sibling closures,
+** nested inside more function bodies than the parser nests natively, so
+** every closure suspends the statement. 'args' passes them to a call,
+** 'table' stores them in fields, 'concat' joins them by a right
+** associative chain and 'calls' hands each to a method call of a chain.
+** Rows of 2000 and 8000 closures show the parse time grows linearly with
+** their number. Tokens are lexed once, the benchmark measures parsing
+** alone.
+*/
+class DeepBodyBench : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void Parse_data();
+	void Parse();
+
+private:
+	// more than AstParser2 nests natively
+	enum { Depth = 9 };
+
+	static QString	Generate	( const char* head, const char* sibling, const char* tail, int count );
+	static int		CountBodies	( const AstItem* root );
+};
+
+void DeepBodyBench::Parse_data()
+{
+	QTest::addColumn< QString >( "source" );
+	QTest::addColumn< int >( "count" );
+
+	const int counts[] = { 2000, 8000 };
+	for( int count : counts ) {
+		QTest::newRow( qPrintable( QString( "args %1" ).arg( count ) ) )
+			<< Generate( "g( ", "function() end, ", "1 )", count ) << count;
+		QTest::newRow( qPrintable( QString( "table %1" ).arg( count ) ) )
+			<< Generate( "t = { ", "k = function() end, ", "}", count ) << count;
+		QTest::newRow( qPrintable( QString( "concat %1" ).arg( count ) ) )
+			<< Generate( "s = x", " .. function() end", "", count ) << count;
+		QTest::newRow( qPrintable( QString( "calls %1" ).arg( count ) ) )
+			<< Generate( "a", ":m( function() end )", "", count ) << count;
+	}
+}
+
+void DeepBodyBench::Parse()
+{
+	QFETCH( QString, source );
+	QFETCH( int, count );
+
+	const TokenBuffer tokens( source );
+	bool parsed = false;
+	int bodies = 0;
+	QBENCHMARK {
+		AstParser2 parser( source, tokens );
+		parsed = parser.Parse();
+		bodies = CountBodies( parser.Result() );
+	}
+	QVERIFY( parsed );
+	QCOMPARE( bodies, count + Depth );
+}
+
+/*
+** head, count siblings and tail as one statement inside of Depth
+** "f( function() ... end )"
+*/
+QString DeepBodyBench::Generate( const char* head, const char* sibling, const char* tail, int count )
+{
+	QString statement = QString::fromLatin1( head );
+	for( int i = 0; i < count; ++i )
+		statement += QLatin1String( sibling );
+	statement += QLatin1String( tail );
+
+	QString source;
+	for( int i = 0; i < Depth; ++i )
+		source += QLatin1String( "f( function()\n" );
+	source += statement;
+	for( int i = 0; i < Depth; ++i )
+		source += QLatin1String( "\nend )" );
+	source += QLatin1Char( '\n' );
+	return source;
+}
+
+/*
+** FunctionBody nodes, walked with an explicit stack
+*/
+int DeepBodyBench::CountBodies( const AstItem* root )
+{
+	int count = 0;
+	QVector< const AstItem* > pending;
+	pending.append( root );
+	while( !pending.isEmpty() ) {
+		const AstItem* item = pending.takeLast();
+		if( item->Is( AstInfo::FunctionBody ) )
+			++count;
+		for( const AstItem* child = item->FirstChild(); child; child = child->Next() )
+			pending.append( child );
+	}
+	return count;
+}
+
+QTEST_APPLESS_MAIN( DeepBodyBench )
+
+#include "DeepBodyBench.moc"
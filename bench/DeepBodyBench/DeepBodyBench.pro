@@ -0,0 +1,6 @@
+include( ../bench.pri )
+
+TARGET = DeepBodyBench
+
+SOURCES +=              \
+	DeepBodyBench.cpp   \
@@ -0,0 +1,113 @@
+#include <QMap>
+#include <QString>
+#include <QVector>
+#include <QtTest>
+
+#include "Lexer/Lexer2.h"
+#include "Lexer/LuaKeywords.h"
+
+/*
+** Identifier throughput of keyword recognition. 'Map' is the lookup
+** Lexer2 had before LuaKeywords: a QString of every identifier looked up
+** in a QMap. 'PerfectHash' is LuaKeywords::Find over the same characters,
+** 'Lexer' runs the whole lexer over the source for scale.
+**
+** Source is generated: words of typical Lua code, a third of them
+** keywords, separated by spaces.
+*/
+class KeywordBench : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+
+	void Map();
+	void PerfectHash();
+	void Lexer();
+
+private:
+	struct Word {
+		int	Pos;
+		int	Size;
+	};
+
+	enum { WordCount = 1 << 18 };
+
+	QString				_source;
+	QVector< Word >		_words;
+	QMap< QString, TokenType > _keywords;
+};
+
+void KeywordBench::initTestCase()
+{
+	static const char* const Sample[] = {
+		"local", "function", "end", "return", "if", "then", "else", "for", "in", "do",
+		"nil", "true", "not", "and", "or", "while", "until", "elseif",
+		"self", "value", "count", "table", "insert", "string", "format", "i", "k", "v",
+		"result", "callback", "options", "index", "setmetatable", "ipairs", "pairs", "name",
+		"x", "data", "position", "handler", "buffer", "length", "object", "endpoint",
+		"iffy", "dot", "n", "fn", "forward", "order", "andrew", "notify", "thenable", "localize"
+	};
+	const int sampleCount = int( sizeof( Sample ) / sizeof( Sample[ 0 ] ) );
+
+	// fixed sequence, so runs compare
+	quint32 seed = 12345;
+	_words.reserve( WordCount );
+	for( int i = 0; i < WordCount; ++i ) {
+		seed = seed * 1103515245u + 12345u;
+		const QString word = QString::fromLatin1( Sample[ ( seed >> 16 ) % sampleCount ] );
+
+		const Word span = { _source.size(), word.size() };
+		_words.append( span );
+		_source += word;
+		_source += QLatin1Char( ' ' );
+	}
+
+	for( int i = 0; i < LuaKeywords::Count; ++i )
+		_keywords.insert( QString::fromLatin1( LuaKeywords::List[ i ].Text ), LuaKeywords::List[ i ].Type );
+}
+
+void KeywordBench::Map()
+{
+	int keywords = 0;
+	QBENCHMARK {
+		keywords = 0;
+		for( const Word& word : _words ) {
+			if( _keywords.value( QString( _source.constData() + word.Pos, word.Size ), TT_ERROR ) != TT_ERROR )
+				++keywords;
+		}
+	}
+	QVERIFY( keywords > 0 );
+}
+
+void KeywordBench::PerfectHash()
+{
+	int keywords = 0;
+	QBENCHMARK {
+		keywords = 0;
+		for( const Word& word : _words ) {
+			if( LuaKeywords::Find( _source.constData() + word.Pos, word.Size ) != TT_ERROR )
+				++keywords;
+		}
+	}
+	QVERIFY( keywords > 0 );
+}
+
+void KeywordBench::Lexer()
+{
+	int tokens = 0;
+	QBENCHMARK {
+		tokens = 0;
+		Lexer2 lexer( &_source );
+		while( lexer.CurrentType() != TT_END_OF_FILE ) {
+			lexer.Next();
+			++tokens;
+		}
+	}
+	QCOMPARE( tokens, int( WordCount ) );
+}
+
+QTEST_APPLESS_MAIN( KeywordBench )
+
+#include "KeywordBench.moc"
@@ -0,0 +1,6 @@
+include( ../bench.pri )
+
+TARGET = KeywordBench
+
+SOURCES +=              \
+	KeywordBench.cpp    \
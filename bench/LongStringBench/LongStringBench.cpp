@@ -0,0 +1,207 @@
+#include <QString>
+#include <QVector>
+#include <QtTest>
+
+#include "Lexer/Lexer2.h"
+
+/*
+** Long strings and long comments of many levels through Lexer2, 'whole'
+** lexes the text in one go like the parser, 'lines' lexes every line on
+** its own from the state the line before ended in, like Highlighter does
+** with its blocks. 'mixed' holds levels 0 to 8 and some past 255, 'deep'
+** only level 10000. Every bracket body has near closers one '=' short and
+** one '=' over its level, which the scanner has to read through.
+**
+** Each long string closes exactly once in both modes, so the count of
+** string tokens is known from the generator.
+*/
+class LongStringBench : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+
+	void Lex_data();
+	void Lex();
+
+private:
+	enum Corpus {
+		Mixed,
+		Deep,
+		CorpusCount
+	};
+
+	enum { MixedSize = 4 << 20 };
+	enum { DeepBrackets = 40 };
+	enum { DeepLevel = 10000 };
+
+	static QString	Generate	( Corpus corpus, int& strings );
+	static int		LexWhole	( const QString& source );
+	static int		LexLines	( const QVector< QString >& lines );
+
+private:
+	QString				_sources[ CorpusCount ];
+	QVector< QString >	_lines[ CorpusCount ];
+	int					_strings[ CorpusCount ];
+};
+
+namespace {
+
+const char* const Text[] = {
+	"the", "value", "is", "kept", "until", "next", "frame", "when", "callers",
+	"ask", "for", "it", "so", "cache", "stays", "warm", "between", "updates"
+};
+
+class Random {
+public:
+	explicit Random( quint32 seed ) : _seed( seed ) {}
+	int Next( int bound ) {
+		_seed = _seed * 1103515245u + 12345u;
+		return int( ( _seed >> 8 ) % quint32( bound ) );
+	}
+private:
+	quint32 _seed;
+};
+
+QString Bracket( QChar bracket, int level )
+{
+	return QString( bracket ) + QString( level, QLatin1Char( '=' ) ) + QString( bracket );
+}
+
+void AppendText( QString& out, Random& random, int words )
+{
+	for( int i = 0; i < words; ++i ) {
+		out += QLatin1String( Text[ random.Next( int( sizeof( Text ) / sizeof( Text[ 0 ] ) ) ) ] );
+		out += QLatin1Char( ' ' );
+	}
+}
+
+/*
+** long string or long comment of level over a few lines, with closers of
+** the levels next to it inside
+*/
+void AppendLongBracket( QString& out, Random& random, int level, bool comment )
+{
+	out += comment ? QLatin1String( "--" ) : QLatin1String( "local s = " );
+	out += Bracket( QLatin1Char( '[' ), level );
+	out += QLatin1Char( '\n' );
+	for( int line = random.Next( 4 ); line >= 0; --line ) {
+		AppendText( out, random, 2 + random.Next( 6 ) );
+		if( level > 0 )
+			out += Bracket( QLatin1Char( ']' ), level - 1 );
+		out += QLatin1Char( ' ' );
+		out += Bracket( QLatin1Char( ']' ), level + 1 );
+		out += QLatin1Char( '\n' );
+	}
+	out += Bracket( QLatin1Char( ']' ), level );
+	out += QLatin1Char( '\n' );
+}
+
+} // namespace
+
+void LongStringBench::initTestCase()
+{
+	for( int i = 0; i < CorpusCount; ++i ) {
+		_sources[ i ] = Generate( Corpus( i ), _strings[ i ] );
+		_lines[ i ] = _sources[ i ].split( QLatin1Char( '\n' ) ).toVector();
+	}
+}
+
+void LongStringBench::Lex_data()
+{
+	QTest::addColumn< int >( "corpus" );
+	QTest::addColumn< bool >( "lines" );
+
+	QTest::newRow( "mixed/whole" ) << int( Mixed ) << false;
+	QTest::newRow( "mixed/lines" ) << int( Mixed ) << true;
+	QTest::newRow( "deep/whole" ) << int( Deep ) << false;
+	QTest::newRow( "deep/lines" ) << int( Deep ) << true;
+}
+
+void LongStringBench::Lex()
+{
+	QFETCH( int, corpus );
+	QFETCH( bool, lines );
+
+	int strings = 0;
+	QBENCHMARK {
+		strings = lines ? LexLines( _lines[ corpus ] ) : LexWhole( _sources[ corpus ] );
+	}
+	QCOMPARE( strings, _strings[ corpus ] );
+}
+
+/*
+** Code lines between the brackets have no strings of their own, strings
+** counts the long strings generated
+*/
+QString LongStringBench::Generate( Corpus corpus, int& strings )
+{
+	Random random( 2024 );
+	QString source;
+	strings = 0;
+
+	if( corpus == Deep ) {
+		for( int i = 0; i < DeepBrackets; ++i ) {
+			const bool comment = random.Next( 2 );
+			AppendLongBracket( source, random, DeepLevel, comment );
+			strings += comment ? 0 : 1;
+		}
+		return source;
+	}
+
+	source.reserve( MixedSize + 1024 );
+	while( source.size() < MixedSize ) {
+		const int roll = random.Next( 100 );
+		if( roll < 40 ) {
+			source += QLatin1String( "x = f( y ) + 1\n" );
+			continue;
+		}
+		const int level = roll < 95 ? random.Next( 9 ) : 256 + random.Next( 256 );
+		const bool comment = random.Next( 2 );
+		AppendLongBracket( source, random, level, comment );
+		strings += comment ? 0 : 1;
+	}
+	return source;
+}
+
+int LongStringBench::LexWhole( const QString& source )
+{
+	int strings = 0;
+	Lexer2 lexer( &source );
+	for( TokenType type = lexer.Next(); type != TT_END_OF_FILE; type = lexer.Next() ) {
+		if( type == TT_STRING )
+			++strings;
+	}
+	return strings;
+}
+
+/*
+** a line resumes inside of a long bracket the line before left open
+*/
+int LongStringBench::LexLines( const QVector< QString >& lines )
+{
+	int strings = 0;
+	LexerContext context = LC_CODE;
+	int level = -1;
+	for( int i = 0; i < lines.size(); ++i ) {
+		LexerState state = Lexer2::InitialState( &lines[ i ] );
+		if( context == LC_LONG_COMMENT || context == LC_LONG_STRING ) {
+			state.Context = context;
+			state.Level = level;
+		}
+
+		Lexer2 lexer( state );
+		for( TokenType type = lexer.Next(); type != TT_END_OF_FILE; type = lexer.Next() ) {
+			if( type == TT_STRING )
+				++strings;
+		}
+		context = lexer.State().Context;
+		level = lexer.State().Level;
+	}
+	return strings;
+}
+
+QTEST_APPLESS_MAIN( LongStringBench )
+
+#include "LongStringBench.moc"
@@ -0,0 +1,6 @@
+include( ../bench.pri )
+
+TARGET = LongStringBench
+
+SOURCES +=              \
+	LongStringBench.cpp \
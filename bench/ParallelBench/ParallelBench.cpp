@@ -0,0 +1,117 @@
+#include <QString>
+#include <QThread>
+#include <QThreadPool>
+#include <QtTest>
+
+#include "Lexer/TokenBuffer.h"
+#include "Parser/AstParser2.h"
+
+/*
+** AstParser2::Parse of a 200k line file serial and with SetParallel on
+** pools of 1, 2, 4 and all cores, the tokens lexed beforehand. Segments
+** are cut for all cores every time, the pool limit only decides how many
+** of them run at once; the calling thread takes segments too. With 'pool
+** 1' the parse runs on two threads at most, so ideal times of a row are
+** the serial one divided by the pool size plus one, as long as there are
+** that many cores.
+*/
+class ParallelBench : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+	void cleanupTestCase();
+
+	void Parse_data();
+	void Parse();
+
+private:
+	enum { Lines = 200000 };
+
+	static QString	Generate	( const char* unit, int lines );
+
+private:
+	QString			_sources[ 2 ];
+	TokenBuffer		_tokens[ 2 ];
+	int				_poolThreads;
+};
+
+namespace {
+
+// one line statements and blocks of a function
+const char Statements[] = "local v%1 = f( %1, \"s\" ) + t.x[ %1 ] * 2\n";
+const char Blocks[] =
+		"function g%1( a )\n"
+		"	if a then\n"
+		"		for i = 1, a do\n"
+		"			x = { a = function() return i end, b = %1 }\n"
+		"		end\n"
+		"	end\n"
+		"end\n";
+
+} // namespace
+
+void ParallelBench::initTestCase()
+{
+	_sources[ 0 ] = Generate( Statements, 1 );
+	_sources[ 1 ] = Generate( Blocks, 7 );
+
+	for( int i = 0; i < 2; ++i )
+		_tokens[ i ] = TokenBuffer( _sources[ i ] );
+	_poolThreads = QThreadPool::globalInstance()->maxThreadCount();
+}
+
+void ParallelBench::cleanupTestCase()
+{
+	QThreadPool::globalInstance()->setMaxThreadCount( _poolThreads );
+}
+
+void ParallelBench::Parse_data()
+{
+	QTest::addColumn< int >( "source" );
+	QTest::addColumn< int >( "threads" );
+
+	const int cores = QThread::idealThreadCount();
+	const char* const names[] = { "statements", "blocks" };
+	for( int source = 0; source < 2; ++source ) {
+		QTest::newRow( qPrintable( QString( "%1 serial" ).arg( names[ source ] ) ) ) << source << 0;
+		for( int threads = 1; threads < cores; threads *= 2 )
+			QTest::newRow( qPrintable( QString( "%1 pool %2" ).arg( names[ source ] ).arg( threads ) ) ) << source << threads;
+		QTest::newRow( qPrintable( QString( "%1 pool all" ).arg( names[ source ] ) ) ) << source << cores;
+	}
+}
+
+void ParallelBench::Parse()
+{
+	QFETCH( int, source );
+	QFETCH( int, threads );
+
+	if( threads > 0 )
+		QThreadPool::globalInstance()->setMaxThreadCount( threads );
+
+	bool parsed = false;
+	QBENCHMARK {
+		AstParser2 parser( _sources[ source ], _tokens[ source ] );
+		parser.SetParallel( threads > 0 );
+		parsed = parser.Parse();
+	}
+	QVERIFY( parsed );
+}
+
+/*
+** unit of the given lines repeated with %1 numbered up to Lines lines
+*/
+QString ParallelBench::Generate( const char* unit, int lines )
+{
+	const QString text = QString::fromLatin1( unit );
+	QString source;
+	source.reserve( Lines / lines * text.size() );
+	for( int i = 0; i < Lines / lines; ++i )
+		source += text.arg( i );
+	return source;
+}
+
+QTEST_APPLESS_MAIN( ParallelBench )
+
+#include "ParallelBench.moc"
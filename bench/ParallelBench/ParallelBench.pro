@@ -0,0 +1,6 @@
+include( ../bench.pri )
+
+TARGET = ParallelBench
+
+SOURCES +=              \
+	ParallelBench.cpp   \
@@ -0,0 +1,280 @@
+#include <QHash>
+#include <QString>
+#include <QtTest>
+
+#include "Lexer/Lexer2.h"
+#include "Lexer/LexerScan.h"
+
+Q_DECLARE_METATYPE( LexerScan::InstructionSet )
+
+/*
+** Lexer2 over generated corpora with each instruction set of LexerScan
+** the CPU has, Scalar being the plain loops. 'mixed' is the 50 MB corpus
+** of everyday code: indented statements, line comments, some comment
+** blocks and string literals. The others take one kind of text each,
+** there the kernels do all of the work.
+*/
+class ScanBench : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+	void cleanupTestCase();
+
+	void Lexer_data();
+	void Lexer();
+
+	void Kernel_data();
+	void Kernel();
+
+private:
+	enum Kind {
+		Mixed,
+		Code,
+		Comments,
+		Strings
+	};
+
+	static QString	Generate		( Kind kind, int size );
+	static int		Lex				( const QString& source );
+
+	void			AddRows			( const char* corpus );
+
+private:
+	QHash< QString, QString >	_corpora;
+	QHash< QString, int >		_tokens;
+	LexerScan::InstructionSet	_initial;
+};
+
+namespace {
+
+const char* const Names[] = {
+	"self", "value", "count", "table", "insert", "result", "callback", "options",
+	"index", "ipairs", "pairs", "name", "x", "data", "position", "handler", "buffer"
+};
+
+const char* const Text[] = {
+	"the", "value", "is", "kept", "until", "next", "frame", "when", "callers",
+	"ask", "for", "it", "so", "cache", "stays", "warm", "between", "updates"
+};
+
+const char* const SetNames[] = { "scalar", "sse2", "avx2" };
+
+class Random {
+public:
+	explicit Random( quint32 seed ) : _seed( seed ) {}
+	int Next( int bound ) {
+		_seed = _seed * 1103515245u + 12345u;
+		return int( ( _seed >> 8 ) % quint32( bound ) );
+	}
+private:
+	quint32 _seed;
+};
+
+template< int N >
+QString Pick( Random& random, const char* const ( &words )[ N ] )
+{
+	return QString::fromLatin1( words[ random.Next( N ) ] );
+}
+
+void AppendText( QString& out, Random& random, int words )
+{
+	for( int i = 0; i < words; ++i ) {
+		out += Pick( random, Text );
+		out += QLatin1Char( ' ' );
+	}
+}
+
+void AppendCode( QString& out, Random& random )
+{
+	out += QString( 4 * ( 1 + random.Next( 4 ) ), QLatin1Char( ' ' ) );
+	switch( random.Next( 4 ) ) {
+	case 0 :
+		out += QString( "local %1 = %2.field + 42" ).arg( Pick( random, Names ) ).arg( Pick( random, Names ) );
+		break;
+	case 1 :
+		out += QString( "if %1 ~= nil then %2( %3 ) end" )
+				.arg( Pick( random, Names ) ).arg( Pick( random, Names ) ).arg( Pick( random, Names ) );
+		break;
+	case 2 :
+		out += QString( "%1:%2( \"%3\", { 1, 2, 3 } )" )
+				.arg( Pick( random, Names ) ).arg( Pick( random, Names ) ).arg( Pick( random, Text ) );
+		break;
+	default:
+		out += QString( "for i, %1 in ipairs( %2 ) do" ).arg( Pick( random, Names ) ).arg( Pick( random, Names ) );
+		break;
+	}
+	out += QLatin1Char( '\n' );
+}
+
+void AppendComment( QString& out, Random& random )
+{
+	out += QLatin1String( "    -- " );
+	AppendText( out, random, 6 + random.Next( 10 ) );
+	out += QLatin1Char( '\n' );
+}
+
+void AppendCommentBlock( QString& out, Random& random )
+{
+	out += QLatin1String( "--[[\n" );
+	for( int line = random.Next( 8 ); line >= 0; --line ) {
+		out += QLatin1String( "    " );
+		AppendText( out, random, 8 + random.Next( 8 ) );
+		out += QLatin1Char( '\n' );
+	}
+	out += QLatin1String( "]]\n" );
+}
+
+void AppendStrings( QString& out, Random& random )
+{
+	out += QString( "local %1 = \"" ).arg( Pick( random, Names ) );
+	AppendText( out, random, 4 + random.Next( 10 ) );
+	out += QLatin1String( "\\n\" .. [==[\n" );
+	for( int line = random.Next( 4 ); line >= 0; --line ) {
+		AppendText( out, random, 8 + random.Next( 8 ) );
+		out += QLatin1Char( '\n' );
+	}
+	out += QLatin1String( "]==]\n" );
+}
+
+} // namespace
+
+void ScanBench::initTestCase()
+{
+	_initial = LexerScan::Current();
+
+	_corpora.insert( "mixed", Generate( Mixed, 25 << 20 ) );
+	_corpora.insert( "code", Generate( Code, 4 << 20 ) );
+	_corpora.insert( "comments", Generate( Comments, 4 << 20 ) );
+	_corpora.insert( "strings", Generate( Strings, 4 << 20 ) );
+
+	// every set gives the same tokens as the plain loops
+	LexerScan::Use( LexerScan::Scalar );
+	for( QHash< QString, QString >::const_iterator corpus = _corpora.constBegin(); corpus != _corpora.constEnd(); ++corpus )
+		_tokens.insert( corpus.key(), Lex( corpus.value() ) );
+}
+
+void ScanBench::cleanupTestCase()
+{
+	LexerScan::Use( _initial );
+}
+
+void ScanBench::Lexer_data()
+{
+	QTest::addColumn< QString >( "corpus" );
+	QTest::addColumn< LexerScan::InstructionSet >( "set" );
+
+	AddRows( "mixed" );
+	AddRows( "code" );
+	AddRows( "comments" );
+	AddRows( "strings" );
+}
+
+void ScanBench::Lexer()
+{
+	QFETCH( QString, corpus );
+	QFETCH( LexerScan::InstructionSet, set );
+
+	const QString source = _corpora.value( corpus );
+	LexerScan::Use( set );
+	int tokens = 0;
+	QBENCHMARK {
+		tokens = Lex( source );
+	}
+	QCOMPARE( tokens, _tokens.value( corpus ) );
+}
+
+void ScanBench::Kernel_data()
+{
+	QTest::addColumn< QString >( "corpus" );
+	QTest::addColumn< LexerScan::InstructionSet >( "set" );
+
+	AddRows( "comments" );
+}
+
+/*
+** FindLineEnd alone over every line of the comment corpus
+*/
+void ScanBench::Kernel()
+{
+	QFETCH( QString, corpus );
+	QFETCH( LexerScan::InstructionSet, set );
+
+	const QString source = _corpora.value( corpus );
+	const QChar* const end = source.constData() + source.size();
+	LexerScan::Use( set );
+	int lines = 0;
+	QBENCHMARK {
+		lines = 0;
+		for( const QChar* current = source.constData(); current < end; ++current ) {
+			current = LexerScan::FindLineEnd( current, end );
+			++lines;
+		}
+	}
+	QVERIFY( lines > 0 );
+}
+
+/*
+** corpus with each instruction set the CPU has
+*/
+void ScanBench::AddRows( const char* corpus )
+{
+	for( int set = LexerScan::Scalar; set <= LexerScan::Supported(); ++set ) {
+		const QString row = QString( "%1/%2" ).arg( corpus ).arg( SetNames[ set ] );
+		QTest::newRow( qPrintable( row ) ) << QString( corpus ) << LexerScan::InstructionSet( set );
+	}
+}
+
+/*
+** about size characters of one kind of text
+*/
+QString ScanBench::Generate( Kind kind, int size )
+{
+	Random random( 2024 );
+	QString source;
+	source.reserve( size + 1024 );
+	while( source.size() < size ) {
+		const int roll = random.Next( 100 );
+		switch( kind ) {
+		case Code :
+			AppendCode( source, random );
+			break;
+		case Comments :
+			if( roll < 70 )
+				AppendComment( source, random );
+			else
+				AppendCommentBlock( source, random );
+			break;
+		case Strings :
+			AppendStrings( source, random );
+			break;
+		default:
+			if( roll < 60 )
+				AppendCode( source, random );
+			else if( roll < 85 )
+				AppendComment( source, random );
+			else if( roll < 95 )
+				AppendCommentBlock( source, random );
+			else
+				AppendStrings( source, random );
+			break;
+		}
+	}
+	return source;
+}
+
+int ScanBench::Lex( const QString& source )
+{
+	int tokens = 0;
+	Lexer2 lexer( &source );
+	while( lexer.CurrentType() != TT_END_OF_FILE ) {
+		lexer.Next();
+		++tokens;
+	}
+	return tokens;
+}
+
+QTEST_APPLESS_MAIN( ScanBench )
+
+#include "ScanBench.moc"
@@ -0,0 +1,6 @@
+include( ../bench.pri )
+
+TARGET = ScanBench
+
+SOURCES +=              \
+	ScanBench.cpp       \
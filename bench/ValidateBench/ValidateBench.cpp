@@ -0,0 +1,148 @@
+#include <QString>
+#include <QtTest>
+
+#include "Lexer/TokenBuffer.h"
+#include "Parser/AstParser2.h"
+
+/*
+** AstParser2::Validate against lexing the same text, on 200k lines of
+** short statements, of nested blocks and of function bodies. 'lex' is
+** TokenBuffer alone, 'validate' and 'parse' get the tokens lexed, so a
+** syntax check of a file costs 'lex' and 'validate' together.
+**
+** Validate is Parse that forgets each main chunk statement when done,
+** gives names no symbols and stops at the first problem. It still builds
+** every node of a statement, the parser reads them back while parsing,
+** so it is no recognizer running at lexing speed; the rows show how far
+** from lexing each kind of code is.
+*/
+class ValidateBench : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+
+	void Lex_data();
+	void Lex();
+	void Validate_data();
+	void Validate();
+	void Parse_data();
+	void Parse();
+
+private:
+	enum { Lines = 200000 };
+
+	static QString	Generate	( const char* unit, int lines );
+	static void		AddSources	();
+
+private:
+	QString			_sources[ 3 ];
+	TokenBuffer		_tokens[ 3 ];
+};
+
+namespace {
+
+// one line statements, blocks of a function and nested function bodies
+const char Statements[] = "local v%1 = f( %1, \"s\" ) + t.x[ %1 ] * 2\n";
+const char Blocks[] =
+		"function g%1( a )\n"
+		"	if a then\n"
+		"		for i = 1, a do\n"
+		"			x = { a = function() return i end, b = %1 }\n"
+		"		end\n"
+		"	end\n"
+		"end\n";
+const char Bodies[] =
+		"f( function() f( function() f( function() f( function()\n"
+		"	return %1\n"
+		"end ) end ) end ) end )\n";
+
+} // namespace
+
+void ValidateBench::initTestCase()
+{
+	_sources[ 0 ] = Generate( Statements, 1 );
+	_sources[ 1 ] = Generate( Blocks, 7 );
+	_sources[ 2 ] = Generate( Bodies, 3 );
+
+	for( int i = 0; i < 3; ++i )
+		_tokens[ i ] = TokenBuffer( _sources[ i ] );
+}
+
+void ValidateBench::Lex_data()
+{
+	AddSources();
+}
+
+void ValidateBench::Lex()
+{
+	QFETCH( int, source );
+
+	int count = 0;
+	QBENCHMARK {
+		TokenBuffer tokens( _sources[ source ] );
+		count = tokens.Count();
+	}
+	QCOMPARE( count, _tokens[ source ].Count() );
+}
+
+void ValidateBench::Validate_data()
+{
+	AddSources();
+}
+
+void ValidateBench::Validate()
+{
+	QFETCH( int, source );
+
+	bool valid = false;
+	QBENCHMARK {
+		AstParser2 parser( _sources[ source ], _tokens[ source ] );
+		valid = parser.Validate();
+	}
+	QVERIFY( valid );
+}
+
+void ValidateBench::Parse_data()
+{
+	AddSources();
+}
+
+void ValidateBench::Parse()
+{
+	QFETCH( int, source );
+
+	bool parsed = false;
+	QBENCHMARK {
+		AstParser2 parser( _sources[ source ], _tokens[ source ] );
+		parsed = parser.Parse();
+	}
+	QVERIFY( parsed );
+}
+
+/*
+** unit of the given lines repeated with %1 numbered up to Lines lines
+*/
+QString ValidateBench::Generate( const char* unit, int lines )
+{
+	const QString text = QString::fromLatin1( unit );
+	QString source;
+	source.reserve( Lines / lines * text.size() );
+	for( int i = 0; i < Lines / lines; ++i )
+		source += text.arg( i );
+	return source;
+}
+
+void ValidateBench::AddSources()
+{
+	QTest::addColumn< int >( "source" );
+
+	QTest::newRow( "statements" ) << 0;
+	QTest::newRow( "blocks" ) << 1;
+	QTest::newRow( "bodies" ) << 2;
+}
+
+QTEST_APPLESS_MAIN( ValidateBench )
+
+#include "ValidateBench.moc"
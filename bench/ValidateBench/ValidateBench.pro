@@ -0,0 +1,6 @@
+include( ../bench.pri )
+
+TARGET = ValidateBench
+
+SOURCES +=              \
+	ValidateBench.cpp   \
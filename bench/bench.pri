@@ -0,0 +1,23 @@
+# Benchmarks are QtTest cases with QBENCHMARK, run one with -help for
+# the options of the measurement (-tickcounter, -iterations...).
+
+QT += testlib
+QT += concurrent
+QT -= gui
+
+CONFIG += c++14
+CONFIG += console
+CONFIG += release
+CONFIG -= app_bundle
+
+INCLUDEPATH += $$PWD/..
+
+HEADERS +=              \
+	$$PWD/../Data/*.h	\
+	$$PWD/../Lexer/*.h	\
+	$$PWD/../Parser/*.h	\
+
+SOURCES +=              \
+	$$PWD/../Data/*.cpp	\
+	$$PWD/../Lexer/*.cpp	\
+	$$PWD/../Parser/*.cpp	\
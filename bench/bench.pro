@@ -0,0 +1,10 @@
+TEMPLATE = subdirs
+
+SUBDIRS +=				\
+	KeywordBench		\
+	ScanBench			\
+	ConcatBench			\
+	ValidateBench		\
+	LongStringBench		\
+	ParallelBench		\
+	DeepBodyBench		\
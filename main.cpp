@@ -38,7 +38,7 @@
 **
 ****************************************************************************/
 
-#include "mainwindow.h"
+#include "MainWindow.h"
 
 #include <QApplication>
 
@@ -0,0 +1,153 @@
+#include <QElapsedTimer>
+#include <QString>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtTest>
+
+#include "Data/AstItem.h"
+#include "Lexer/TokenBuffer.h"
+#include "Parser/AstParser2.h"
+#include "Parser/CancelToken.h"
+
+/*
+** AstParser2 stopped while it parses a large generated file on a worker,
+** the way ParseScheduler abandons a parse superseded by an edit. Latency
+** is the time from CancelToken::Cancel to the end of Parse, the partial
+** tree freed included. It is expected well under a millisecond, the bound
+** leaves room for waking up the waiting thread on a loaded machine.
+*/
+class CancelTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+
+	void Cancel_data();
+	void Cancel();
+	void Budget();
+
+private:
+	enum { Units = 100000 };
+
+	// milliseconds the parse runs before the cancel, a stop may take and
+	// the time budget
+	enum { StartDelay = 20 };
+	enum { MaxLatency = 5 };
+	enum { TimeBudget = 20 };
+
+	static QString	Generate	( const char* unit );
+	static bool		IsEmpty		( AstParser2& parser );
+
+private:
+	QString			_sources[ 3 ];
+	TokenBuffer		_tokens[ 3 ];
+};
+
+namespace {
+
+// one line of expressions, blocks of a function and function bodies
+// nested deeper than those parsed by native recursion
+const char Statements[] = "local v%1 = f( %1, \"s\" ) + t.x[ %1 ] * 2\n";
+const char Blocks[] =
+		"function g%1( a )\n"
+		"	if a then\n"
+		"		for i = 1, a do\n"
+		"			x = { a = function() return i end, b = %1 }\n"
+		"		end\n"
+		"	end\n"
+		"end\n";
+const char Bodies[] =
+		"f( function() f( function() f( function() f( function() f( function() f( function() "
+		"f( function() f( function() f( function() f( function() return %1 "
+		"end ) end ) end ) end ) end ) end ) end ) end ) end ) end )\n";
+
+} // namespace
+
+void CancelTest::initTestCase()
+{
+	_sources[ 0 ] = Generate( Statements );
+	_sources[ 1 ] = Generate( Blocks );
+	_sources[ 2 ] = Generate( Bodies );
+
+	for( int i = 0; i < 3; ++i )
+		_tokens[ i ] = TokenBuffer( _sources[ i ] );
+}
+
+void CancelTest::Cancel_data()
+{
+	QTest::addColumn< int >( "source" );
+	QTest::addColumn< bool >( "parallel" );
+
+	QTest::newRow( "statements" ) << 0 << false;
+	QTest::newRow( "statements parallel" ) << 0 << true;
+	QTest::newRow( "blocks" ) << 1 << false;
+	QTest::newRow( "bodies" ) << 2 << false;
+}
+
+void CancelTest::Cancel()
+{
+	QFETCH( int, source );
+	QFETCH( bool, parallel );
+
+	CancelToken token;
+	AstParser2 parser( _sources[ source ], _tokens[ source ] );
+	parser.SetCancelToken( &token );
+	parser.SetParallel( parallel );
+
+	QFuture< bool > parse = QtConcurrent::run( &parser, &AstParser2::Parse );
+	QTest::qSleep( StartDelay );
+	QVERIFY2( !parse.isFinished(), "parse done before the cancel, generate more units" );
+
+	QElapsedTimer timer;
+	timer.start();
+	token.Cancel();
+	parse.waitForFinished();
+	const qint64 latency = timer.nsecsElapsed();
+
+	QVERIFY2( latency < qint64( MaxLatency ) * 1000000,
+			  qPrintable( QString( "stopped after %1 us" ).arg( latency / 1000 ) ) );
+	QVERIFY( !parse.result() );
+	QVERIFY( parser.IsCancelled() );
+	QVERIFY( IsEmpty( parser ) );
+}
+
+void CancelTest::Budget()
+{
+	AstParser2 parser( _sources[ 1 ], _tokens[ 1 ] );
+	parser.SetTimeBudget( TimeBudget );
+
+	QElapsedTimer timer;
+	timer.start();
+	const bool parsed = parser.Parse();
+	const qint64 elapsed = timer.elapsed();
+
+	QVERIFY( !parsed );
+	QVERIFY( parser.IsCancelled() );
+	QVERIFY2( elapsed < TimeBudget + MaxLatency, qPrintable( QString( "stopped after %1 ms" ).arg( elapsed ) ) );
+	QVERIFY( IsEmpty( parser ) );
+}
+
+/*
+** unit repeated with %1 numbered
+*/
+QString CancelTest::Generate( const char* unit )
+{
+	const QString text = QString::fromLatin1( unit );
+	QString source;
+	source.reserve( Units * text.size() );
+	for( int i = 0; i < Units; ++i )
+		source += text.arg( i );
+	return source;
+}
+
+/*
+** cancelled parse leaves nothing of the partial tree
+*/
+bool CancelTest::IsEmpty( AstParser2& parser )
+{
+	return !parser.Result()->FirstChild() && parser.Diagnostics().isEmpty();
+}
+
+QTEST_APPLESS_MAIN( CancelTest )
+
+#include "CancelTest.moc"
@@ -0,0 +1,6 @@
+include( ../tests.pri )
+
+TARGET = CancelTest
+
+SOURCES +=              \
+	CancelTest.cpp      \
@@ -0,0 +1,223 @@
+#include <QCoreApplication>
+#include <QSignalSpy>
+#include <QString>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QVector>
+#include <QtTest>
+
+#include <random>
+
+#include "Highlighter.h"
+#include "Lexer/TokenBuffer.h"
+#include "Model/ParseScheduler.h"
+
+/*
+** Tokens the Highlighter keeps for the blocks of a QTextDocument, put
+** together the way ParseScheduler hands them to the parser. After each
+** random edit the lines ParseScheduler::EditedLines picks replace those of
+** the edit, or the text is lexed again from the edit when it picks none.
+** On open and after settled edits the whole text is assigned from
+** CachedTokens too, unless a block has no tokens. Every buffer has to
+** match a lex of the whole text: tokens, lines and the checkpoint of every
+** line.
+**
+** Edits put in and take out pieces of long brackets, comments, strings
+** and line breaks, so block states change and cascades run through many
+** blocks. Settled rows let the highlighter chain finish after each edit,
+** quick rows go on at once, with blocks still waiting for the chain.
+** Runs without a display with QT_QPA_PLATFORM=offscreen.
+*/
+class HighlighterTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void Edits_data();
+	void Edits();
+
+private:
+	enum { UnitCount = 2000 };
+	enum { EditCount = 300 };
+	enum { ChainTimeout = 10000 };
+
+	static QString	Generate		( int seed );
+	static ParseScheduler::Edit	Merged	( const QSignalSpy& changes );
+	static void		CompareBuffers	( const TokenBuffer& built, const TokenBuffer& lexed );
+};
+
+namespace {
+
+const char* const Units[] = {
+	"local v%1 = f( %1, \"s\" ) + t.x[ %1 ] * 2\n",
+	"function g%1( a )\n"
+	"	if a then return { a = function() return a end, b = %1 } end\n"
+	"end\n",
+	"--[[ note %1\n"
+	"   more ]] print( 'q' )\n",
+	"s%1 = [==[\n"
+	"long %1 ]]\n"
+	"]==] .. \"x\"\n",
+	"-- line comment %1\n"
+};
+
+// text put in by edits
+const char* const Pieces[] = {
+	"\n", "--[[", "]]", "[==[", "]==]", "--", "'s'", "\"s\"", "x", "end", " ", "[[", "\n]]\n"
+};
+
+} // namespace
+
+void HighlighterTest::Edits_data()
+{
+	QTest::addColumn< int >( "seed" );
+	QTest::addColumn< bool >( "settle" );
+
+	QTest::newRow( "settled 1" ) << 1 << true;
+	QTest::newRow( "settled 2" ) << 2 << true;
+	QTest::newRow( "quick 1" ) << 1 << false;
+	QTest::newRow( "quick 2" ) << 2 << false;
+}
+
+void HighlighterTest::Edits()
+{
+	QFETCH( int, seed );
+	QFETCH( bool, settle );
+
+	QTextDocument document;
+	Highlighter highlighter( &document );
+	document.setPlainText( Generate( seed ) );
+
+	QString source = document.toPlainText();
+	QVector< LineTokens > lines;
+	QTRY_VERIFY_WITH_TIMEOUT( highlighter.CachedTokens( lines ), ChainTimeout );
+	TokenBuffer tokens;
+	tokens.Assign( lines );
+	CompareBuffers( tokens, TokenBuffer( source ) );
+	if( QTest::currentTestFailed() )
+		return;
+
+	std::mt19937 random( seed );
+	const int pieces = int( sizeof( Pieces ) / sizeof( Pieces[ 0 ] ) );
+	QSignalSpy changes( &document, SIGNAL( contentsChange(int,int,int) ) );
+	int replaced = 0;
+	int assigned = 0;
+	for( int i = 0; i < EditCount; ++i ) {
+		const int size = document.characterCount() - 1;
+		const int position = int( random() % ( size + 1 ) );
+		const int removed = qMin( int( random() % 4 ), size - position );
+		const QString added = removed == 0 || random() % 2 ? QString::fromLatin1( Pieces[ random() % pieces ] ) : QString();
+
+		changes.clear();
+		QTextCursor cursor( &document );
+		cursor.setPosition( position );
+		cursor.setPosition( position + removed, QTextCursor::KeepAnchor );
+		cursor.insertText( added );
+		if( settle )
+			QTRY_VERIFY_WITH_TIMEOUT( highlighter.IsChainDone(), ChainTimeout );
+		else if( random() % 4 == 0 )
+			QCoreApplication::processEvents();
+
+		const QString text = document.toPlainText();
+		ParseScheduler::Job job;
+		job.Changed = Merged( changes );
+		job.FirstLine = 0;
+		job.RemovedLines = -1;
+
+		// a change out of the text is lexed anew, as Reparse does
+		const ParseScheduler::Edit& edit = job.Changed;
+		if( edit.Position + edit.Removed > source.size() || edit.Position + edit.Added > text.size() ) {
+			tokens.Lex( text );
+		}
+		else if( ParseScheduler::EditedLines( &document, &highlighter, tokens, job ) ) {
+			tokens.Replace( job.Lines, job.FirstLine, job.RemovedLines, edit.Position );
+			++replaced;
+		}
+		else {
+			tokens.Update( text, edit.Position, edit.Removed, edit.Added );
+		}
+		source = text;
+
+		const TokenBuffer lexed( text );
+		CompareBuffers( tokens, lexed );
+
+		// blocks with a short string open at the end have no tokens
+		if( settle && highlighter.CachedTokens( lines ) ) {
+			TokenBuffer whole;
+			whole.Assign( lines );
+			CompareBuffers( whole, lexed );
+			++assigned;
+		}
+		if( QTest::currentTestFailed() ) {
+			qWarning( "edit %d at %d removing %d adding \"%s\"", i, position, removed, qPrintable( added ) );
+			return;
+		}
+	}
+	if( settle ) {
+		QVERIFY( replaced > 0 );
+		QVERIFY( assigned > 0 );
+	}
+}
+
+/*
+** units picked at random with %1 numbered
+*/
+QString HighlighterTest::Generate( int seed )
+{
+	std::mt19937 random( seed );
+	const int units = int( sizeof( Units ) / sizeof( Units[ 0 ] ) );
+	QString source;
+	for( int i = 0; i < UnitCount; ++i )
+		source += QString::fromLatin1( Units[ random() % units ] ).arg( i );
+	return source;
+}
+
+/*
+** changes the document reported, the edit and the ones the highlighter
+** made restyling blocks, merged into one the way ParseScheduler does
+*/
+ParseScheduler::Edit HighlighterTest::Merged( const QSignalSpy& changes )
+{
+	ParseScheduler::Edit edit = { 0, 0, 0 };
+	for( int i = 0; i < changes.size(); ++i ) {
+		const int position = changes[ i ][ 0 ].toInt();
+		const int removed = changes[ i ][ 1 ].toInt();
+		const int added = changes[ i ][ 2 ].toInt();
+		if( i == 0 ) {
+			edit.Position = position;
+			edit.Removed = removed;
+			edit.Added = added;
+			continue;
+		}
+		const int start = qMin( edit.Position, position );
+		const int end = qMax( edit.Position + edit.Added, position + removed );
+		edit.Removed = end - ( edit.Added - edit.Removed ) - start;
+		edit.Added = end + added - removed - start;
+		edit.Position = start;
+	}
+	return edit;
+}
+
+void HighlighterTest::CompareBuffers( const TokenBuffer& built, const TokenBuffer& lexed )
+{
+	QCOMPARE( built.Count(), lexed.Count() );
+	for( int i = 0; i < lexed.Count(); ++i ) {
+		QCOMPARE( built.Type( i ), lexed.Type( i ) );
+		QCOMPARE( built.Offset( i ), lexed.Offset( i ) );
+		QCOMPARE( built.Length( i ), lexed.Length( i ) );
+		QCOMPARE( built.Line( i ), lexed.Line( i ) );
+	}
+
+	QCOMPARE( built.LineCount(), lexed.LineCount() );
+	for( int line = 0; line < lexed.LineCount(); ++line ) {
+		const LexerCheckpoint checkpoint = built.Checkpoint( line );
+		const LexerCheckpoint expected = lexed.Checkpoint( line );
+		QCOMPARE( checkpoint.Offset, expected.Offset );
+		QCOMPARE( checkpoint.Context, expected.Context );
+		QCOMPARE( checkpoint.Level, expected.Level );
+	}
+}
+
+QTEST_MAIN( HighlighterTest )
+
+#include "HighlighterTest.moc"
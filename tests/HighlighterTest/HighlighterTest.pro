@@ -0,0 +1,15 @@
+include( ../tests.pri )
+
+QT += gui
+QT += widgets
+
+TARGET = HighlighterTest
+
+HEADERS +=                              \
+	$$PWD/../../Highlighter.h           \
+	$$PWD/../../Model/ParseScheduler.h  \
+
+SOURCES +=                              \
+	HighlighterTest.cpp                 \
+	$$PWD/../../Highlighter.cpp         \
+	$$PWD/../../Model/ParseScheduler.cpp \
@@ -0,0 +1,146 @@
+#include <QString>
+#include <QVector>
+#include <QtTest>
+
+#include "Lexer/TokenBuffer.h"
+
+/*
+** Line breaks of TokenBuffer: "\n", "\r" and "\r\n" each end a line, "\n\r"
+** ends two, in code, comments and long brackets alike. Breaks checks the
+** line starts of a lexed text against the expected ones, the line of every
+** token and LineAt and Column at every offset, the break characters and
+** the end of the text included. Edits checks Update against a lex of the
+** whole new text where an edit joins or splits a "\r\n".
+*/
+class LineBreakTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void Breaks_data();
+	void Breaks();
+	void Edits_data();
+	void Edits();
+
+private:
+	static void		CompareLines	( const TokenBuffer& tokens, const QVector< int >& starts, int size );
+	static void		CompareBuffers	( const TokenBuffer& updated, const TokenBuffer& lexed );
+};
+
+void LineBreakTest::Breaks_data()
+{
+	QTest::addColumn< QString >( "source" );
+	QTest::addColumn< QVector< int > >( "starts" );
+
+	QTest::newRow( "empty" ) << QString() << QVector< int >{ 0 };
+	QTest::newRow( "lf" ) << QString( "a\nb\n" ) << QVector< int >{ 0, 2, 4 };
+	QTest::newRow( "cr" ) << QString( "a\rb\r" ) << QVector< int >{ 0, 2, 4 };
+	QTest::newRow( "crlf" ) << QString( "a\r\nb\r\n" ) << QVector< int >{ 0, 3, 6 };
+	QTest::newRow( "lf cr" ) << QString( "a\n\rb" ) << QVector< int >{ 0, 2, 3 };
+	QTest::newRow( "mixed" ) << QString( "a\r\nb\rc\nd" ) << QVector< int >{ 0, 3, 5, 7 };
+	QTest::newRow( "only cr" ) << QString( "\r" ) << QVector< int >{ 0, 1 };
+	QTest::newRow( "cr at end" ) << QString( "x\r" ) << QVector< int >{ 0, 2 };
+	QTest::newRow( "empty crlf lines" ) << QString( "\r\n\r\n" ) << QVector< int >{ 0, 2, 4 };
+	QTest::newRow( "comment" ) << QString( "-- c\r\nx" ) << QVector< int >{ 0, 6 };
+	QTest::newRow( "long string" ) << QString( "x = [[a\r\nb\rc]] y" ) << QVector< int >{ 0, 9, 11 };
+	QTest::newRow( "long comment" ) << QString( "--[==[\r\n\r]==] x" ) << QVector< int >{ 0, 8, 9 };
+	QTest::newRow( "long string first break" ) << QString( "x = [[\r\na]]\ry" ) << QVector< int >{ 0, 8, 12 };
+}
+
+void LineBreakTest::Breaks()
+{
+	QFETCH( QString, source );
+	QFETCH( QVector< int >, starts );
+
+	const TokenBuffer tokens( source );
+	CompareLines( tokens, starts, source.size() );
+}
+
+void LineBreakTest::Edits_data()
+{
+	QTest::addColumn< QString >( "source" );
+	QTest::addColumn< int >( "position" );
+	QTest::addColumn< int >( "removed" );
+	QTest::addColumn< QString >( "added" );
+
+	QTest::newRow( "lf after cr" ) << QString( "a\rb" ) << 2 << 0 << QString( "\n" );
+	QTest::newRow( "lf after cr at end" ) << QString( "a\r" ) << 2 << 0 << QString( "\n" );
+	QTest::newRow( "lf after cr in long string" ) << QString( "x = [[a\rb]] y" ) << 8 << 0 << QString( "\n" );
+	QTest::newRow( "lf after cr in comment" ) << QString( "-- a\rb" ) << 5 << 0 << QString( "\n" );
+	QTest::newRow( "cr before lf" ) << QString( "a\nb" ) << 1 << 0 << QString( "\r" );
+	QTest::newRow( "lf out of crlf" ) << QString( "a\r\nb" ) << 2 << 1 << QString();
+	QTest::newRow( "cr out of crlf" ) << QString( "a\r\nb" ) << 1 << 1 << QString();
+	QTest::newRow( "crlf split" ) << QString( "a\r\nb" ) << 2 << 0 << QString( "x" );
+	QTest::newRow( "crlf typed" ) << QString( "a\r\nb" ) << 1 << 2 << QString( "\r\n" );
+	QTest::newRow( "lf after cr of many" ) << QString( "a\rb\rc\rd" ) << 4 << 0 << QString( "\n" );
+}
+
+void LineBreakTest::Edits()
+{
+	QFETCH( QString, source );
+	QFETCH( int, position );
+	QFETCH( int, removed );
+	QFETCH( QString, added );
+
+	TokenBuffer tokens( source );
+	const QString edited = source.left( position ) + added + source.mid( position + removed );
+	tokens.Update( edited, position, removed, added.size() );
+
+	const TokenBuffer lexed( edited );
+	CompareBuffers( tokens, lexed );
+
+	QVector< int > starts;
+	for( int line = 0; line < lexed.LineCount(); ++line )
+		starts.append( lexed.LineStart( line ) );
+	CompareLines( tokens, starts, edited.size() );
+}
+
+/*
+** token lines are counted from 1, line starts and LineAt from 0
+*/
+void LineBreakTest::CompareLines( const TokenBuffer& tokens, const QVector< int >& starts, int size )
+{
+	QCOMPARE( tokens.LineCount(), starts.size() );
+	for( int line = 0; line < starts.size(); ++line )
+		QCOMPARE( tokens.LineStart( line ), starts[ line ] );
+
+	int line = 0;
+	for( int offset = 0; offset <= size; ++offset ) {
+		while( line + 1 < starts.size() && starts[ line + 1 ] <= offset )
+			++line;
+		QVERIFY2( tokens.LineAt( offset ) == line, qPrintable( QString( "line at %1" ).arg( offset ) ) );
+		QVERIFY2( tokens.Column( offset ) == offset - starts[ line ], qPrintable( QString( "column at %1" ).arg( offset ) ) );
+	}
+
+	for( int i = 0; i < tokens.Count(); ++i ) {
+		const int offset = tokens.Offset( i );
+		int expected = 0;
+		while( expected < starts.size() && starts[ expected ] <= offset )
+			++expected;
+		QVERIFY2( tokens.Line( i ) == expected, qPrintable( QString( "line of token %1" ).arg( i ) ) );
+	}
+}
+
+void LineBreakTest::CompareBuffers( const TokenBuffer& updated, const TokenBuffer& lexed )
+{
+	QCOMPARE( updated.Count(), lexed.Count() );
+	for( int i = 0; i < lexed.Count(); ++i ) {
+		QCOMPARE( updated.Type( i ), lexed.Type( i ) );
+		QCOMPARE( updated.Offset( i ), lexed.Offset( i ) );
+		QCOMPARE( updated.Length( i ), lexed.Length( i ) );
+		QCOMPARE( updated.Line( i ), lexed.Line( i ) );
+	}
+
+	QCOMPARE( updated.LineCount(), lexed.LineCount() );
+	for( int line = 0; line < lexed.LineCount(); ++line ) {
+		const LexerCheckpoint checkpoint = updated.Checkpoint( line );
+		const LexerCheckpoint expected = lexed.Checkpoint( line );
+		QCOMPARE( checkpoint.Offset, expected.Offset );
+		QCOMPARE( checkpoint.Context, expected.Context );
+		QCOMPARE( checkpoint.Level, expected.Level );
+	}
+}
+
+QTEST_APPLESS_MAIN( LineBreakTest )
+
+#include "LineBreakTest.moc"
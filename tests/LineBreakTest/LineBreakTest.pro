@@ -0,0 +1,6 @@
+include( ../tests.pri )
+
+TARGET = LineBreakTest
+
+SOURCES +=              \
+	LineBreakTest.cpp   \
@@ -0,0 +1,158 @@
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <QtTest>
+
+#include <random>
+
+#include "Data/AstTree.h"
+#include "Data/Diagnostic.h"
+#include "Parser/AstParser2.h"
+
+/*
+** AstParser2 with SetParallel against a serial parse of the same large
+** generated file: the flat trees node by node, the text of the merged
+** symbol of every name and the reported errors have to match. Broken
+** files have a syntax error now and then, some of them in a statement a
+** segment cut falls into. With a single core the parallel parse is a
+** serial one and the test passes trivially.
+*/
+class ParallelTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void Parse_data();
+	void Parse();
+
+private:
+	enum { UnitCount = 40000 };
+
+	static QString	Generate	( int seed, bool broken );
+	static void		CompareTrees( const AstTree& tree, const StringInterner& symbols,
+								  const AstTree& expected, const StringInterner& expectedSymbols );
+	static void		CompareDiagnostics( const AstParser2& parallel, const AstParser2& serial );
+};
+
+namespace {
+
+const char* const Units[] = {
+	"local v%1 = f( %1, \"s\" ) + t.x[ %1 ] * 2\n",
+	"function g%1( a )\n"
+	"	if a then\n"
+	"		for i = 1, a do\n"
+	"			x = { a = function() return i end, b = %1 }\n"
+	"		end\n"
+	"	end\n"
+	"end\n",
+	"local function h%1( self, ... ) return self.v%1 or { ... } end\n",
+	"do local y%1 = 3 repeat y%1 = y%1 + 1 until y%1 > %1 end\n"
+};
+
+// statements with a syntax error, the last ones leave a block open up
+// to the 'end' of a later unit
+const char* const Broken[] = {
+	"local = %1\n",
+	"x%1 = ( 1 +\n",
+	"if x%1 then\n",
+	"function k%1( a\n"
+};
+
+} // namespace
+
+void ParallelTest::Parse_data()
+{
+	QTest::addColumn< int >( "seed" );
+	QTest::addColumn< bool >( "broken" );
+
+	QTest::newRow( "valid 1" ) << 1 << false;
+	QTest::newRow( "valid 2" ) << 2 << false;
+	QTest::newRow( "broken 1" ) << 1 << true;
+	QTest::newRow( "broken 2" ) << 2 << true;
+}
+
+void ParallelTest::Parse()
+{
+	QFETCH( int, seed );
+	QFETCH( bool, broken );
+
+	const QString source = Generate( seed, broken );
+	const TokenBuffer tokens( source );
+	if( QThread::idealThreadCount() < 2 )
+		qWarning( "a single core, the parallel parse is a serial one" );
+
+	AstParser2 serial( source, tokens );
+	const bool parsed = serial.Parse();
+	const AstTree expected( serial.Result(), serial.Tokens() );
+
+	AstParser2 parallel( source, tokens );
+	parallel.SetParallel( true );
+	QCOMPARE( parallel.Parse(), parsed );
+	QCOMPARE( parsed, !broken );
+	const AstTree tree( parallel.Result(), parallel.Tokens() );
+
+	CompareTrees( tree, parallel.Interner(), expected, serial.Interner() );
+	CompareDiagnostics( parallel, serial );
+}
+
+/*
+** units picked at random with %1 numbered, about one in a thousand is a
+** broken one in broken files
+*/
+QString ParallelTest::Generate( int seed, bool broken )
+{
+	std::mt19937 random( seed );
+	const int units = int( sizeof( Units ) / sizeof( Units[ 0 ] ) );
+	const int brokenUnits = int( sizeof( Broken ) / sizeof( Broken[ 0 ] ) );
+	QString source;
+	for( int i = 0; i < UnitCount; ++i ) {
+		if( broken && random() % 1000 == 0 )
+			source += QString::fromLatin1( Broken[ random() % brokenUnits ] ).arg( i );
+		else
+			source += QString::fromLatin1( Units[ random() % units ] ).arg( i );
+	}
+	return source;
+}
+
+/*
+** Both trees are flattened from equal item trees, so nodes are compared
+** at the same index. Symbols are numbered in another order once segment
+** interners are merged, their texts are compared.
+*/
+void ParallelTest::CompareTrees( const AstTree& tree, const StringInterner& symbols,
+								 const AstTree& expected, const StringInterner& expectedSymbols )
+{
+	QCOMPARE( tree.Count(), expected.Count() );
+	for( int i = 0; i < tree.Count(); ++i ) {
+		const AstNode& node = tree.Node( i );
+		const AstNode& other = expected.Node( i );
+		const bool same = node.Info.AstType == other.Info.AstType && node.Info.Pos == other.Info.Pos
+				&& node.Info.Size == other.Info.Size && node.Info.Line == other.Info.Line
+				&& node.Info.Flags == other.Info.Flags && node.Parent == other.Parent
+				&& node.FirstChild == other.FirstChild && node.ChildrenCount == other.ChildrenCount
+				&& node.Row == other.Row && node.Hash == other.Hash;
+		QVERIFY2( same, qPrintable( QString( "node %1 of %2" ).arg( i ).arg( tree.TypeText( i ) ) ) );
+
+		if( node.Info.AstType == AstInfo::Name ) {
+			QVERIFY2( symbols.Text( node.Info.Symbol ) == expectedSymbols.Text( other.Info.Symbol ),
+					  qPrintable( QString( "symbol of node %1" ).arg( i ) ) );
+		}
+	}
+}
+
+void ParallelTest::CompareDiagnostics( const AstParser2& parallel, const AstParser2& serial )
+{
+	const QVector< Diagnostic >& diagnostics = parallel.Diagnostics();
+	const QVector< Diagnostic >& expected = serial.Diagnostics();
+	QCOMPARE( diagnostics.size(), expected.size() );
+	for( int i = 0; i < diagnostics.size(); ++i ) {
+		QCOMPARE( diagnostics[ i ].Description, expected[ i ].Description );
+		QCOMPARE( diagnostics[ i ].Pos, expected[ i ].Pos );
+		QCOMPARE( diagnostics[ i ].Size, expected[ i ].Size );
+		QCOMPARE( diagnostics[ i ].Line, expected[ i ].Line );
+	}
+}
+
+QTEST_APPLESS_MAIN( ParallelTest )
+
+#include "ParallelTest.moc"
@@ -0,0 +1,6 @@
+include( ../tests.pri )
+
+TARGET = ParallelTest
+
+SOURCES +=              \
+	ParallelTest.cpp    \
@@ -0,0 +1,239 @@
+#include <QString>
+#include <QVector>
+#include <QtTest>
+
+#include <random>
+
+#include "Data/AstTree.h"
+#include "Data/Diagnostic.h"
+#include "Parser/AstParser2.h"
+
+/*
+** Random edits of a generated file, each reparsed the way ParseScheduler
+** does it: AstParser2::Reparse of the parser kept from the text before and
+** AstTree::Patch of the tree kept with it. After every edit both have to
+** match a parse of the whole new text: the flat trees node by node with
+** their hashes, both interval indexes at every position and the reported
+** errors. Broken edits take out and put in pieces anywhere, so statements,
+** blocks and functions are broken and mended; the text stays valid under
+** statement edits, which put in and take out whole lines of statements.
+*/
+class ReparseTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void Edits_data();
+	void Edits();
+
+private:
+	enum { UnitCount = 60 };
+	enum { EditCount = 400 };
+
+	static QString	Generate	( int seed );
+	static void		RandomEdit	( std::mt19937& random, bool broken, const QString& source,
+								  int& position, int& removed, QString& added );
+	static bool		IsSame		( const AstNode& a, const AstNode& b );
+	static void		CompareTrees( const AstTree& patched, const AstTree& parsed, int size );
+	static void		CompareDiagnostics( const AstParser2& reparsed, const AstParser2& parsed );
+};
+
+namespace {
+
+const char* const Units[] = {
+	"local v%1 = f( %1, \"s\" ) + t.x[ %1 ] * 2\n",
+	"function g%1( a )\n"
+	"	if a then\n"
+	"		for i = 1, a do\n"
+	"			x = { a = function() return i end, b = %1 }\n"
+	"		end\n"
+	"	elseif b then return end\n"
+	"end\n",
+	"while x < %1 do\n"
+	"	repeat x = x + 1 until x > 2\n"
+	"	do local y = 3 end\n"
+	"end\n",
+	"t.m%1 = function( self, ... ) return self.v or { ... } end\n",
+	"--[[ note %1 ]] print( [[long\ntext]], 'q' )\n"
+};
+
+// text taken out or put in by broken edits
+const char* const Pieces[] = {
+	"end", "function() ", "(", ")", "x", "1", ", ", "= ", "return ", " ", "until ",
+	"\n", "do ", "if a then ", "local ", "--", "\"", "{", "}"
+};
+
+// lines put in and taken out by statement edits
+const char* const Statements[] = {
+	"x = 1\n",
+	"local y = { 1, f( 2 ) }\n",
+	"f( function() return 1 end )\n",
+	"if x then y = 2 else y = 3 end\n",
+	"for k, v in pairs( t ) do g( k ) end\n"
+};
+
+} // namespace
+
+void ReparseTest::Edits_data()
+{
+	QTest::addColumn< int >( "seed" );
+	QTest::addColumn< bool >( "broken" );
+
+	QTest::newRow( "broken 1" ) << 1 << true;
+	QTest::newRow( "broken 2" ) << 2 << true;
+	QTest::newRow( "statements 1" ) << 1 << false;
+	QTest::newRow( "statements 2" ) << 2 << false;
+}
+
+void ReparseTest::Edits()
+{
+	QFETCH( int, seed );
+	QFETCH( bool, broken );
+
+	QString source = Generate( seed );
+	AstParser2 parser( source );
+	parser.Parse();
+	AstTree tree( parser.Result(), parser.Tokens() );
+
+	std::mt19937 random( seed );
+	for( int i = 0; i < EditCount; ++i ) {
+		int position = 0;
+		int removed = 0;
+		QString added;
+		RandomEdit( random, broken, source, position, removed, added );
+
+		source = source.left( position ) + added + source.mid( position + removed );
+		parser.Reparse( source, position, removed, added.size() );
+		if( parser.Splice().Path.isEmpty() )
+			tree.Build( parser.Result(), parser.Tokens() );
+		else
+			tree.Patch( parser.Result(), parser.Tokens(), parser.Splice() );
+
+		AstParser2 fresh( source );
+		fresh.Parse();
+		const AstTree expected( fresh.Result(), fresh.Tokens() );
+
+		CompareTrees( tree, expected, source.size() );
+		CompareDiagnostics( parser, fresh );
+		if( QTest::currentTestFailed() ) {
+			qWarning( "edit %d at %d removing %d adding \"%s\"", i, position, removed, qPrintable( added ) );
+			return;
+		}
+	}
+}
+
+/*
+** units picked at random with %1 numbered
+*/
+QString ReparseTest::Generate( int seed )
+{
+	std::mt19937 random( seed );
+	const int units = int( sizeof( Units ) / sizeof( Units[ 0 ] ) );
+	QString source;
+	for( int i = 0; i < UnitCount; ++i )
+		source += QString::fromLatin1( Units[ random() % units ] ).arg( i );
+	return source;
+}
+
+/*
+** Broken edit replaces up to three characters anywhere by a piece or by
+** nothing. Statement edit puts a statement line in front of a line or
+** takes out the line if it is one of them.
+*/
+void ReparseTest::RandomEdit( std::mt19937& random, bool broken, const QString& source,
+							  int& position, int& removed, QString& added )
+{
+	if( broken ) {
+		const int pieces = int( sizeof( Pieces ) / sizeof( Pieces[ 0 ] ) );
+		position = int( random() % ( source.size() + 1 ) );
+		removed = qMin( int( random() % 4 ), source.size() - position );
+		added = random() % 2 ? QString::fromLatin1( Pieces[ random() % pieces ] ) : QString();
+		return;
+	}
+
+	const int statements = int( sizeof( Statements ) / sizeof( Statements[ 0 ] ) );
+	position = int( random() % ( source.size() + 1 ) );
+	position = position > 0 ? source.lastIndexOf( QLatin1Char( '\n' ), position - 1 ) + 1 : 0;
+	removed = 0;
+	added.clear();
+
+	const int end = source.indexOf( QLatin1Char( '\n' ), position ) + 1;
+	if( end > 0 && random() % 2 ) {
+		const QString line = source.mid( position, end - position );
+		for( int i = 0; i < statements; ++i ) {
+			if( line == QLatin1String( Statements[ i ] ) )
+				removed = line.size();
+		}
+	}
+	if( removed == 0 )
+		added = QString::fromLatin1( Statements[ random() % statements ] );
+}
+
+/*
+** node data but the symbol, interners of the two parsers differ
+*/
+bool ReparseTest::IsSame( const AstNode& a, const AstNode& b )
+{
+	return a.Info.AstType == b.Info.AstType && a.Info.Pos == b.Info.Pos && a.Info.Size == b.Info.Size
+			&& a.Info.Line == b.Info.Line && a.Info.Flags == b.Info.Flags && a.ChildrenCount == b.ChildrenCount
+			&& a.Row == b.Row && a.Hash == b.Hash;
+}
+
+/*
+** Nodes are compared through rows since Patch stores them in another
+** order. Both indexes are asked for every position of the text and for
+** ranges around every tenth one.
+*/
+void ReparseTest::CompareTrees( const AstTree& patched, const AstTree& parsed, int size )
+{
+	QCOMPARE( patched.Count(), parsed.Count() );
+
+	QVector< int > pending;
+	QVector< int > expected;
+	pending.append( AstTree::RootNode );
+	expected.append( AstTree::RootNode );
+	while( !pending.isEmpty() ) {
+		const int index = pending.takeLast();
+		const int other = expected.takeLast();
+		QVERIFY2( IsSame( patched.Node( index ), parsed.Node( other ) ),
+				  qPrintable( QString( "node %1 of %2" ).arg( index ).arg( patched.TypeText( index ) ) ) );
+		QCOMPARE( patched.Parent( index ) == AstTree::NoNode, parsed.Parent( other ) == AstTree::NoNode );
+		for( int row = 0; row < patched.ChildrenCount( index ); ++row ) {
+			pending.append( patched.Child( index, row ) );
+			expected.append( parsed.Child( other, row ) );
+		}
+	}
+
+	for( int pos = -1; pos <= size + 1; ++pos ) {
+		const int index = patched.NodeAt( pos );
+		const int other = parsed.NodeAt( pos );
+		QCOMPARE( index == AstTree::NoNode, other == AstTree::NoNode );
+		if( index != AstTree::NoNode )
+			QVERIFY2( IsSame( patched.Node( index ), parsed.Node( other ) ), qPrintable( QString( "at %1" ).arg( pos ) ) );
+	}
+
+	for( int pos = 0; pos <= size; pos += 10 ) {
+		const QVector< int > nodes = patched.NodesIn( pos, pos + 25 );
+		const QVector< int > others = parsed.NodesIn( pos, pos + 25 );
+		QCOMPARE( nodes.size(), others.size() );
+		for( int i = 0; i < nodes.size(); ++i )
+			QVERIFY2( IsSame( patched.Node( nodes[ i ] ), parsed.Node( others[ i ] ) ), qPrintable( QString( "in %1" ).arg( pos ) ) );
+	}
+}
+
+void ReparseTest::CompareDiagnostics( const AstParser2& reparsed, const AstParser2& parsed )
+{
+	const QVector< Diagnostic >& diagnostics = reparsed.Diagnostics();
+	const QVector< Diagnostic >& expected = parsed.Diagnostics();
+	QCOMPARE( diagnostics.size(), expected.size() );
+	for( int i = 0; i < diagnostics.size(); ++i ) {
+		QCOMPARE( diagnostics[ i ].Description, expected[ i ].Description );
+		QCOMPARE( diagnostics[ i ].Pos, expected[ i ].Pos );
+		QCOMPARE( diagnostics[ i ].Size, expected[ i ].Size );
+		QCOMPARE( diagnostics[ i ].Line, expected[ i ].Line );
+	}
+}
+
+QTEST_APPLESS_MAIN( ReparseTest )
+
+#include "ReparseTest.moc"
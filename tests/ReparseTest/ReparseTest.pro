@@ -0,0 +1,6 @@
+include( ../tests.pri )
+
+TARGET = ReparseTest
+
+SOURCES +=              \
+	ReparseTest.cpp     \
@@ -0,0 +1,200 @@
+#include <QString>
+#include <QVector>
+#include <QtTest>
+
+#include "Data/AstTree.h"
+#include "Parser/AstParser2.h"
+#include "Parser/ScopeResolver.h"
+
+/*
+** ScopeResolver on small snippets. A row names one use of a name by its
+** occurrence in the text and the occurrence expected to declare it, or
+** none for a global and the function body for an implicit 'self'; the
+** kind of the use is checked too. Every function body of the snippet is
+** then resolved alone by ResolveFunction, names inside of it have to get
+** the same kinds and declarations as from the whole tree, names outside
+** of it none.
+*/
+class ScopeTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void Resolve_data();
+	void Resolve();
+
+private:
+	// declaration of no occurrence: a global, or the implicit 'self'
+	enum { NoOccurrence = -1, FunctionBody = -2 };
+
+	static int		Occurrence		( const QString& source, const QString& name, int index );
+	static bool		IsInside		( const AstTree& tree, int node, int body );
+	static int		DeclarationNode	( const ScopeResolver& scopes, int node );
+};
+
+void ScopeTest::Resolve_data()
+{
+	QTest::addColumn< QString >( "source" );
+	QTest::addColumn< QString >( "name" );
+	QTest::addColumn< int >( "use" );
+	QTest::addColumn< int >( "declaration" );
+	QTest::addColumn< int >( "kind" );
+
+	QTest::newRow( "local" ) << QString( "local x = 1 return x" )
+			<< QString( "x" ) << 1 << 0 << int( ScopeResolver::LocalName );
+	QTest::newRow( "global" ) << QString( "local y = x" )
+			<< QString( "x" ) << 0 << int( NoOccurrence ) << int( ScopeResolver::GlobalName );
+	QTest::newRow( "declaration" ) << QString( "local x, y = 1" )
+			<< QString( "y" ) << 0 << 0 << int( ScopeResolver::DeclarationName );
+
+	QTest::newRow( "shadowing inside" ) << QString( "local x = 1 do local x = 2 y = x end z = x" )
+			<< QString( "x" ) << 2 << 1 << int( ScopeResolver::LocalName );
+	QTest::newRow( "shadowing after" ) << QString( "local x = 1 do local x = 2 y = x end z = x" )
+			<< QString( "x" ) << 3 << 0 << int( ScopeResolver::LocalName );
+	QTest::newRow( "shadowed parameter" ) << QString( "local function f( x ) local x = x return x end" )
+			<< QString( "x" ) << 3 << 1 << int( ScopeResolver::LocalName );
+
+	QTest::newRow( "local x = x" ) << QString( "local x = 1 do local x = x end" )
+			<< QString( "x" ) << 2 << 0 << int( ScopeResolver::LocalName );
+	QTest::newRow( "local x = x global" ) << QString( "local x = x" )
+			<< QString( "x" ) << 1 << int( NoOccurrence ) << int( ScopeResolver::GlobalName );
+	QTest::newRow( "local function" ) << QString( "local function f() return f() end" )
+			<< QString( "f" ) << 1 << 0 << int( ScopeResolver::UpvalueName );
+	QTest::newRow( "local f = function" ) << QString( "local f = function() return f() end" )
+			<< QString( "f" ) << 1 << int( NoOccurrence ) << int( ScopeResolver::GlobalName );
+
+	QTest::newRow( "until" ) << QString( "repeat local x = 1 until x" )
+			<< QString( "x" ) << 1 << 0 << int( ScopeResolver::LocalName );
+	QTest::newRow( "after until" ) << QString( "repeat local x = 1 until x return x" )
+			<< QString( "x" ) << 2 << int( NoOccurrence ) << int( ScopeResolver::GlobalName );
+	QTest::newRow( "until in function" ) << QString( "local x = 0 repeat local x = 1 until function() return x end" )
+			<< QString( "x" ) << 2 << 1 << int( ScopeResolver::UpvalueName );
+
+	QTest::newRow( "for body" ) << QString( "for i = 1, 2 do y = i end z = i" )
+			<< QString( "i" ) << 1 << 0 << int( ScopeResolver::LocalName );
+	QTest::newRow( "for after" ) << QString( "for i = 1, 2 do y = i end z = i" )
+			<< QString( "i" ) << 2 << int( NoOccurrence ) << int( ScopeResolver::GlobalName );
+	QTest::newRow( "for limit" ) << QString( "local i = 5 for i = 1, i do end" )
+			<< QString( "i" ) << 2 << 0 << int( ScopeResolver::LocalName );
+	QTest::newRow( "for in" ) << QString( "for k, v in pairs( t ) do f( v ) end" )
+			<< QString( "v" ) << 1 << 0 << int( ScopeResolver::LocalName );
+
+	QTest::newRow( "parameter" ) << QString( "local a = 1 function g( p ) return p + a end" )
+			<< QString( "p" ) << 1 << 0 << int( ScopeResolver::LocalName );
+	QTest::newRow( "upvalue" ) << QString( "local a = 1 function g( p ) return p + a end" )
+			<< QString( "a" ) << 1 << 0 << int( ScopeResolver::UpvalueName );
+
+	QTest::newRow( "self of method" ) << QString( "function t:m() return self end" )
+			<< QString( "self" ) << 0 << int( FunctionBody ) << int( ScopeResolver::LocalName );
+	QTest::newRow( "self of closure" ) << QString( "function t:m() return function() return self end end" )
+			<< QString( "self" ) << 0 << int( FunctionBody ) << int( ScopeResolver::UpvalueName );
+	QTest::newRow( "self of function" ) << QString( "function t.m() return self end" )
+			<< QString( "self" ) << 0 << int( NoOccurrence ) << int( ScopeResolver::GlobalName );
+	QTest::newRow( "self parameter" ) << QString( "function t.m( self ) return self end" )
+			<< QString( "self" ) << 1 << 0 << int( ScopeResolver::LocalName );
+
+	QTest::newRow( "method statement" ) << QString( "local a = {} function a.b:c() end" )
+			<< QString( "a" ) << 1 << 0 << int( ScopeResolver::LocalName );
+	QTest::newRow( "method name" ) << QString( "local c = {} function a.b:c() end" )
+			<< QString( "c" ) << 1 << int( NoOccurrence ) << int( ScopeResolver::NotName );
+	QTest::newRow( "method call" ) << QString( "local m = 1 t:m()" )
+			<< QString( "m" ) << 1 << int( NoOccurrence ) << int( ScopeResolver::NotName );
+	QTest::newRow( "method call object" ) << QString( "local t = {} t:m()" )
+			<< QString( "t" ) << 1 << 0 << int( ScopeResolver::LocalName );
+	QTest::newRow( "field" ) << QString( "local x = 1 t.x = x" )
+			<< QString( "x" ) << 1 << int( NoOccurrence ) << int( ScopeResolver::NotName );
+
+	QTest::newRow( "table key" ) << QString( "local k = 1 local t = { k = k, [ k ] = 2 }" )
+			<< QString( "k" ) << 1 << int( NoOccurrence ) << int( ScopeResolver::NotName );
+	QTest::newRow( "table value" ) << QString( "local k = 1 local t = { k = k, [ k ] = 2 }" )
+			<< QString( "k" ) << 2 << 0 << int( ScopeResolver::LocalName );
+	QTest::newRow( "bracket key" ) << QString( "local k = 1 local t = { k = k, [ k ] = 2 }" )
+			<< QString( "k" ) << 3 << 0 << int( ScopeResolver::LocalName );
+}
+
+void ScopeTest::Resolve()
+{
+	QFETCH( QString, source );
+	QFETCH( QString, name );
+	QFETCH( int, use );
+	QFETCH( int, declaration );
+	QFETCH( int, kind );
+
+	AstParser2 parser( source );
+	QVERIFY( parser.Parse() );
+	const AstTree tree( parser.Result(), parser.Tokens() );
+
+	ScopeResolver scopes;
+	scopes.Resolve( tree, parser.Interner() );
+
+	const int node = tree.NodeAt( Occurrence( source, name, use ) );
+	QCOMPARE( tree.Node( node ).Info.AstType, AstInfo::Name );
+	QCOMPARE( int( scopes.KindOf( node ) ), kind );
+	if( declaration == NoOccurrence ) {
+		QCOMPARE( scopes.DeclarationOf( node ), int( ScopeResolver::NoDeclaration ) );
+	}
+	else if( declaration == FunctionBody ) {
+		const int body = DeclarationNode( scopes, node );
+		QVERIFY( body != AstTree::NoNode );
+		QCOMPARE( tree.Node( body ).Info.AstType, AstInfo::FunctionBody );
+	}
+	else {
+		QCOMPARE( DeclarationNode( scopes, node ), tree.NodeAt( Occurrence( source, name, declaration ) ) );
+	}
+
+	for( int body = 0; body < tree.Count(); ++body ) {
+		if( tree.Node( body ).Info.AstType != AstInfo::FunctionBody )
+			continue;
+
+		ScopeResolver function;
+		function.ResolveFunction( tree, parser.Interner(), body );
+		for( int other = 0; other < tree.Count(); ++other ) {
+			const QString where = QString( "node %1 in body %2" ).arg( other ).arg( body );
+			if( IsInside( tree, other, body ) ) {
+				QVERIFY2( function.KindOf( other ) == scopes.KindOf( other ), qPrintable( where ) );
+				QVERIFY2( DeclarationNode( function, other ) == DeclarationNode( scopes, other ), qPrintable( where ) );
+			}
+			else if( function.KindOf( other ) != ScopeResolver::DeclarationName ) {
+				QVERIFY2( function.KindOf( other ) == ScopeResolver::NotName, qPrintable( where ) );
+			}
+		}
+	}
+}
+
+/*
+** position of the index-th occurrence of name as a whole word
+*/
+int ScopeTest::Occurrence( const QString& source, const QString& name, int index )
+{
+	int pos = -1;
+	while( index >= 0 ) {
+		pos = source.indexOf( name, pos + 1 );
+		if( pos < 0 )
+			return -1;
+		const int end = pos + name.size();
+		const bool before = pos > 0 && ( source[ pos - 1 ].isLetterOrNumber() || source[ pos - 1 ] == QLatin1Char( '_' ) );
+		const bool after = end < source.size() && ( source[ end ].isLetterOrNumber() || source[ end ] == QLatin1Char( '_' ) );
+		if( !before && !after )
+			--index;
+	}
+	return pos;
+}
+
+bool ScopeTest::IsInside( const AstTree& tree, int node, int body )
+{
+	for( ; node != AstTree::NoNode; node = tree.Parent( node ) ) {
+		if( node == body )
+			return true;
+	}
+	return false;
+}
+
+int ScopeTest::DeclarationNode( const ScopeResolver& scopes, int node )
+{
+	const int declaration = scopes.DeclarationOf( node );
+	return declaration == ScopeResolver::NoDeclaration ? int( AstTree::NoNode ) : scopes.DeclarationAt( declaration ).Node;
+}
+
+QTEST_APPLESS_MAIN( ScopeTest )
+
+#include "ScopeTest.moc"
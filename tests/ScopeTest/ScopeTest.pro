@@ -0,0 +1,6 @@
+include( ../tests.pri )
+
+TARGET = ScopeTest
+
+SOURCES +=              \
+	ScopeTest.cpp       \
@@ -0,0 +1,322 @@
+#include <QString>
+#include <QVector>
+#include <QtTest>
+
+#include <random>
+
+#include "Lexer/Lexer2.h"
+#include "Lexer/TokenBuffer.h"
+
+/*
+** Edits of one TokenBuffer against a lex of the whole new text. Updates
+** lexes each random edit again with Update, Replaces hands Replace the
+** edited lines lexed one by one, as the highlighter lexes blocks. After
+** every edit tokens, lines and the checkpoint of every line have to match.
+**
+** Edits put in and take out pieces of long brackets, comments, strings
+** and line breaks, "\r\n" and lone "\r" too where rows ask for them, so
+** lexing states change far behind an edit. Some edits remove or paste
+** long runs of text, so the gap of the buffer has to grow and to take
+** many tokens in. Document lines never hold a "\r", Replaces uses "\n".
+*/
+class TokenBufferTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void Updates_data();
+	void Updates();
+	void Replaces_data();
+	void Replaces();
+
+private:
+	enum { UnitCount = 300 };
+	enum { EditCount = 1000 };
+
+	static QString	Generate		( std::mt19937& random, bool crlf );
+	static void		Edit			( std::mt19937& random, bool crlf, const QString& source,
+									  int& position, int& removed, QString& added );
+	static bool		LexLines		( const QString& source, int firstLine, int lineCount,
+									  const LexerCheckpoint& start, QVector< LineTokens >& lines );
+	static void		CompareBuffers	( const TokenBuffer& edited, const TokenBuffer& lexed );
+};
+
+namespace {
+
+const char* const Units[] = {
+	"local v%1 = f( %1, \"s\" ) + t.x[ %1 ] * 2\n",
+	"function g%1( a )\n"
+	"	if a then return { a = function() return a end, b = %1 } end\n"
+	"end\n",
+	"--[[ note %1\n"
+	"   more ]] print( 'q' )\n",
+	"s%1 = [==[\n"
+	"long %1 ]]\n"
+	"]==] .. \"x\"\n",
+	"-- line comment %1\n",
+	"t%1 = [[\n"
+	"\n"
+	"]]\n"
+};
+
+// text put in by edits
+const char* const Pieces[] = {
+	"\n", "--[[", "]]", "[==[", "]==]", "--", "'", "\"", "x", "end", " ", "[[", "\n]]\n", "--[=[", "]=]"
+};
+
+// put in as well by rows with "\r"
+const char* const BreakPieces[] = {
+	"\r", "\r\n", "\n\r", "[[\r\n", "--[[\r"
+};
+
+/*
+** line starts in the state of the checkpoint, outside of any string,
+** Replace takes such lines only
+*/
+bool IsSameStart( const LexerCheckpoint& line, const LexerCheckpoint& checkpoint )
+{
+	if( line.Context != checkpoint.Context )
+		return false;
+	return line.Context == LC_CODE || ( line.Context == LC_LONG_COMMENT && line.Level == checkpoint.Level );
+}
+
+} // namespace
+
+void TokenBufferTest::Updates_data()
+{
+	QTest::addColumn< int >( "seed" );
+	QTest::addColumn< bool >( "crlf" );
+
+	QTest::newRow( "lf 1" ) << 1 << false;
+	QTest::newRow( "lf 2" ) << 2 << false;
+	QTest::newRow( "crlf 1" ) << 1 << true;
+	QTest::newRow( "crlf 2" ) << 2 << true;
+}
+
+void TokenBufferTest::Updates()
+{
+	QFETCH( int, seed );
+	QFETCH( bool, crlf );
+
+	std::mt19937 random( seed );
+	QString source = Generate( random, crlf );
+	TokenBuffer tokens( source );
+
+	for( int i = 0; i < EditCount; ++i ) {
+		int position;
+		int removed;
+		QString added;
+		Edit( random, crlf, source, position, removed, added );
+		source.replace( position, removed, added );
+
+		const int count = tokens.Count();
+		const TokenDelta delta = tokens.Update( source, position, removed, added.size() );
+		QCOMPARE( tokens.Count(), count - delta.Removed + delta.Inserted );
+
+		const TokenBuffer lexed( source );
+		CompareBuffers( tokens, lexed );
+		if( QTest::currentTestFailed() ) {
+			qWarning( "edit %d: %d characters at %d replaced by %d", i, removed, position, added.size() );
+			return;
+		}
+	}
+}
+
+void TokenBufferTest::Replaces_data()
+{
+	QTest::addColumn< int >( "seed" );
+
+	QTest::newRow( "1" ) << 1;
+	QTest::newRow( "2" ) << 2;
+}
+
+/*
+** Lines are picked as ParseScheduler::EditedLines picks blocks: from the
+** line the edit starts in up to the first line behind the edit that starts
+** where and in the state the old text has it start. A first line inside a
+** long string is moved up to a line outside of it. Where a line can not
+** be cached, with a short string open at its end, the edit is lexed by
+** Update.
+*/
+void TokenBufferTest::Replaces()
+{
+	QFETCH( int, seed );
+
+	std::mt19937 random( seed );
+	QString source = Generate( random, false );
+	TokenBuffer tokens( source );
+
+	int replaced = 0;
+	for( int i = 0; i < EditCount; ++i ) {
+		int position;
+		int removed;
+		QString added;
+		Edit( random, false, source, position, removed, added );
+		source.replace( position, removed, added );
+
+		const TokenBuffer lexed( source );
+		const int delta = added.size() - removed;
+		const int lineDelta = lexed.LineCount() - tokens.LineCount();
+		const int last = lexed.LineAt( position + added.size() );
+
+		int first = tokens.LineAt( position );
+		LexerCheckpoint start = tokens.Checkpoint( first );
+		while( first > 0 && start.Context != LC_CODE && start.Context != LC_LONG_COMMENT )
+			start = tokens.Checkpoint( --first );
+
+		int end = last + 1;
+		while( end < lexed.LineCount() ) {
+			const int old = end - lineDelta;
+			if( old >= first && old < tokens.LineCount() && tokens.LineStart( old ) + delta == lexed.LineStart( end )
+					&& IsSameStart( lexed.Checkpoint( end ), tokens.Checkpoint( old ) ) )
+				break;
+			++end;
+		}
+		const int removedLines = ( end < lexed.LineCount() ? end - lineDelta : tokens.LineCount() ) - first;
+
+		QVector< LineTokens > lines;
+		const int count = tokens.Count();
+		TokenDelta change;
+		if( LexLines( source, first, end - first, start, lines ) ) {
+			change = tokens.Replace( lines, first, removedLines, position );
+			++replaced;
+		}
+		else {
+			change = tokens.Update( source, position, removed, added.size() );
+		}
+		QCOMPARE( tokens.Count(), count - change.Removed + change.Inserted );
+
+		CompareBuffers( tokens, lexed );
+		if( QTest::currentTestFailed() ) {
+			qWarning( "edit %d: %d characters at %d replaced by %d, lines %d-%d", i, removed, position, added.size(), first, end );
+			return;
+		}
+	}
+	QVERIFY( replaced > EditCount / 2 );
+}
+
+QString TokenBufferTest::Generate( std::mt19937& random, bool crlf )
+{
+	QString source;
+	for( int i = 0; i < UnitCount; ++i ) {
+		QString unit = QString( Units[ random() % ( sizeof( Units ) / sizeof( Units[ 0 ] ) ) ] ).arg( i );
+		if( crlf && random() % 2 )
+			unit.replace( QLatin1String( "\n" ), QLatin1String( "\r\n" ) );
+		source += unit;
+	}
+	return source;
+}
+
+/*
+** random edit of source: mostly a piece typed over a few characters, now
+** and then a long run removed or a long run of the text pasted
+*/
+void TokenBufferTest::Edit( std::mt19937& random, bool crlf, const QString& source,
+							int& position, int& removed, QString& added )
+{
+	position = random() % ( source.size() + 1 );
+	const int rest = source.size() - position;
+	added.clear();
+
+	switch( random() % 20 ) {
+	case 0:
+		removed = qMin( rest, int( random() % 2000 ) );
+		break;
+	case 1: {
+		removed = 0;
+		const int from = random() % ( source.size() + 1 );
+		added = source.mid( from, random() % 3000 );
+		break;
+	}
+	default:
+		removed = qMin( rest, int( random() % 4 ) );
+		if( crlf && random() % 3 == 0 )
+			added = BreakPieces[ random() % ( sizeof( BreakPieces ) / sizeof( BreakPieces[ 0 ] ) ) ];
+		else
+			added = Pieces[ random() % ( sizeof( Pieces ) / sizeof( Pieces[ 0 ] ) ) ];
+		break;
+	}
+}
+
+/*
+** Lines [firstLine, firstLine + lineCount) of source lexed one by one, the
+** first starting in the state of start. False if a line has a short string
+** open at its end, the highlighter does not cache such a line.
+*/
+bool TokenBufferTest::LexLines( const QString& source, int firstLine, int lineCount,
+								const LexerCheckpoint& start, QVector< LineTokens >& lines )
+{
+	int begin = 0;
+	for( int i = 0; i < firstLine; ++i )
+		begin = source.indexOf( QLatin1Char( '\n' ), begin ) + 1;
+
+	LexerContext context = start.Context;
+	int level = start.Context == LC_CODE ? -1 : start.Level;
+	for( int i = firstLine; i < firstLine + lineCount; ++i ) {
+		int next = source.indexOf( QLatin1Char( '\n' ), begin );
+		if( next < 0 )
+			next = source.size();
+		const QString text = source.mid( begin, next - begin );
+		begin = next + 1;
+
+		LineTokens line;
+		line.Length = text.size() + 1;
+		line.Context = context;
+		line.Level = level;
+
+		LexerState state = Lexer2::InitialState( &text );
+		if( context != LC_CODE ) {
+			state.Context = context;
+			state.Level = level;
+		}
+
+		Lexer2 lexer( state );
+		for( TokenType type = lexer.Next(); type != TT_END_OF_FILE; type = lexer.Next() ) {
+			const int begin = lexer.CurrentStart();
+			const int end = lexer.CurrentPos();
+			const bool longString = lexer.State().Context == LC_LONG_STRING;
+			if( type == TT_ERROR && !longString && end == text.size()
+					&& ( text[ begin ] == QLatin1Char( '"' ) || text[ begin ] == QLatin1Char( '\'' ) ) )
+				return false;
+
+			const LineToken token = { quint16( begin ), quint16( end - begin ), qint8( type ) };
+			line.Tokens.append( token );
+		}
+		lines.append( line );
+
+		context = lexer.State().Context;
+		if( context == LC_LONG_COMMENT || context == LC_LONG_STRING ) {
+			level = lexer.State().Level;
+		}
+		else {
+			context = LC_CODE;
+			level = -1;
+		}
+	}
+	return true;
+}
+
+void TokenBufferTest::CompareBuffers( const TokenBuffer& edited, const TokenBuffer& lexed )
+{
+	QCOMPARE( edited.Count(), lexed.Count() );
+	for( int i = 0; i < lexed.Count(); ++i ) {
+		QCOMPARE( edited.Type( i ), lexed.Type( i ) );
+		QCOMPARE( edited.Offset( i ), lexed.Offset( i ) );
+		QCOMPARE( edited.Length( i ), lexed.Length( i ) );
+		QCOMPARE( edited.Line( i ), lexed.Line( i ) );
+	}
+
+	QCOMPARE( edited.LineCount(), lexed.LineCount() );
+	for( int line = 0; line < lexed.LineCount(); ++line ) {
+		const LexerCheckpoint checkpoint = edited.Checkpoint( line );
+		const LexerCheckpoint expected = lexed.Checkpoint( line );
+		QCOMPARE( checkpoint.Offset, expected.Offset );
+		QCOMPARE( checkpoint.Token, expected.Token );
+		QCOMPARE( checkpoint.Context, expected.Context );
+		QCOMPARE( checkpoint.Level, expected.Level );
+	}
+}
+
+QTEST_APPLESS_MAIN( TokenBufferTest )
+
+#include "TokenBufferTest.moc"
@@ -0,0 +1,6 @@
+include( ../tests.pri )
+
+TARGET = TokenBufferTest
+
+SOURCES +=              \
+	TokenBufferTest.cpp \
@@ -0,0 +1,22 @@
+# Tests are QtTest cases, "make check" runs all of them.
+
+QT += testlib
+QT += concurrent
+QT -= gui
+
+CONFIG += c++14
+CONFIG += console
+CONFIG += testcase
+CONFIG -= app_bundle
+
+INCLUDEPATH += $$PWD/..
+
+HEADERS +=              \
+	$$PWD/../Data/*.h	\
+	$$PWD/../Lexer/*.h	\
+	$$PWD/../Parser/*.h	\
+
+SOURCES +=              \
+	$$PWD/../Data/*.cpp	\
+	$$PWD/../Lexer/*.cpp	\
+	$$PWD/../Parser/*.cpp	\
@@ -0,0 +1,10 @@
+TEMPLATE = subdirs
+
+SUBDIRS +=				\
+	CancelTest			\
+	HighlighterTest		\
+	LineBreakTest		\
+	ParallelTest		\
+	ReparseTest			\
+	ScopeTest			\
+	TokenBufferTest		\